@@ -6,52 +6,34 @@ from pathlib import Path
 total_tests = 0
 total_failed_tests = 0
 
-# Runs a single test through the program
-def run_test(mode, key, iv, plaintext, expected_out):
-    # Command to run the executable in encrypt mode
-    # str(len(key)*4) is because the key is encoded in hex, with 4 bits per character
-    # We multiply by 4 to get the number of bits in the key
-    command = ['./main','enc',mode,'-k',str(len(key)*4), '-iv']
-    
-    # Execute the command and wait for it to finish
-    # We send the output to a pipe so we can read the output
-    # Send the plaintext, key and iv as input
-    proc = subprocess.run(command, stdout=PIPE, input=bytes(str(plaintext) + "\n" + str(key) + "\n" + str(iv) + "\n", "UTF-8"))
-
-    # The process failing is no good
-    if proc.returncode != 0:
-        return False
-    
-    # Convert the output from bytes to a string
-    output = proc.stdout.decode('utf-8')
-    # Find the position of the ciphertext and remove the unnecessary parts
-    idx = output.find("CIPHERTEXT: ")
-    ciphertxt = output[idx + 12: idx + 12 + int((len(plaintext) + 32)*(3/2))]
-    ciphertxt = ciphertxt.replace(" ", "").lower()
-    
-    # Compare the ciphertext
-    if ciphertxt[:len(expected_out)] != expected_out:
-    	return False
-    	
-    # Run it in the reverse direction
-    command = ['./main','dec',mode, str(len(key)*4), '-iv']
-    proc = subprocess.run(command, stdout=PIPE, input=bytes(str(ciphertxt) + "\n" + str(key) + "\n" + str(iv) + "\n", "UTF-8"))
+# Runs a list of records through the program in batch mode
+# Each record is (mode, direction, key, iv, data) and one result line is returned per record
+def run_batch(records):
+    lines = ["{0} {1} {2} {3} {4}".format(mode, direction, key, iv if iv else "-", data if data else "-")
+             for (mode, direction, key, iv, data) in records]
+    proc = subprocess.run(['./main', 'batch'], stdout=PIPE, input=bytes("\n".join(lines) + "\n", "UTF-8"))
 
-    if proc.returncode != 0:
-        return False
+    # The process failing or losing records is no good
+    results = proc.stdout.decode('utf-8').splitlines()
+    if proc.returncode != 0 or len(results) != len(records):
+        return ["ERROR"] * len(records)
+
+    return results
+
+# Runs the tests through the program, encrypting every vector and then decrypting the results
+# All of the vectors in a file go through a single process
+def run_tests(mode, tests):
+    encrypted = run_batch([(mode, "enc", key, iv, plaintext) for (key, iv, plaintext, exp_out) in tests])
+
+    # Compare the ciphertext, which has an extra block of padding
+    passed = [len(ctx) == len(exp_out) + 32 and ctx[:len(exp_out)] == exp_out
+              for ((key, iv, plaintext, exp_out), ctx) in zip(tests, encrypted)]
+
+    # Run it in the reverse direction
+    decrypted = run_batch([(mode, "dec", key, iv, ctx) for ((key, iv, plaintext, exp_out), ctx) in zip(tests, encrypted)])
 
-    
-    output = proc.stdout.decode('utf-8')
-    idx = output.find("DECRPYTED PLAINTEXT: ")
-    ptx = output[idx + 21: idx + 21 + int((len(plaintext))*(3/2))]
-    ptx = ptx.replace(" ", "").lower()
-    
-    
     # Compare the plaintext
-    if ptx[:len(plaintext)] != plaintext:
-    	return False
-    
-    return True
+    return [ok and ptx == plaintext for (ok, (key, iv, plaintext, exp_out), ptx) in zip(passed, tests, decrypted)]
 
 # Runs all of the encrypt tests contained in a file
 def run_test_file(filename):
@@ -71,6 +53,7 @@ def run_test_file(filename):
 
     test_file = open(filename, "r", encoding="utf-8", newline='\r\n')
     
+    tests = []
     seen_encrypt = False
     while test_file:
         line = test_file.readline()
@@ -98,7 +81,39 @@ def run_test_file(filename):
                 plaintext = test_file.readline()[12:-2]
                 exp_out = test_file.readline()[13:-2]
 
-            if not run_test(test_name, key, iv, plaintext, exp_out):
+            tests.append((key.lower(), iv.lower(), plaintext.lower(), exp_out.lower()))
+
+    for passed in run_tests(test_name, tests):
+        if not passed:
+            failed_tests += 1
+        num_tests += 1
+
+    print("Passed {0} out of {1}".format(num_tests - failed_tests, num_tests))
+    return (num_tests, failed_tests)
+
+# Decrypts CTR and OFB files in place whose padding is invalid, which must fail and leave every byte as it was
+# The lengths that are not a multiple of 16 check the partial last block is restored too
+def run_in_place_tests():
+    num_tests = 0
+    failed_tests = 0
+    key = "000102030405060708090a0b0c0d0e0f"
+    print("Running test: in place decryption failures")
+
+    for (mode, iv) in [("ofb", "f0" * 16), ("ctr", "f0" * 8)]:
+        for length in [16, 40, 47, 64]:
+            path = "in_place_test.bin"
+            data = bytes((i * 37 + length) % 256 for i in range(length))
+            with open(path, "wb") as test_file:
+                test_file.write(data)
+
+            proc = subprocess.run(['./main', 'dec', mode, '128', '--key', key, '--iv', iv, '--in', path,
+                                   '--mmap', '--in-place'], stdout=PIPE, stderr=PIPE)
+            with open(path, "rb") as test_file:
+                restored = test_file.read()
+            os.remove(path)
+
+            if proc.returncode != 3 or restored != data:
+                print("Failed: {0} with {1} bytes".format(mode, length))
                 failed_tests += 1
             num_tests += 1
 
@@ -106,6 +121,10 @@ def run_test_file(filename):
     return (num_tests, failed_tests)
 
 
+(t, f) = run_in_place_tests()
+total_tests += t
+total_failed_tests += f
+
 testDirectory = "./KAT"
 
 for entry in Path(testDirectory).iterdir():
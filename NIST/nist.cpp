@@ -0,0 +1,328 @@
+/**
+  @file nist.cpp: In-process runner for the NIST AES validation vectors
+  Reads every .rsp file in a directory (KAT by default) and checks both the [ENCRYPT] and [DECRYPT]
+  sections of the Known Answer, Multiblock Message and Monte Carlo tests for ECB, CBC, CFB128 and OFB.
+  The vectors are not padded, so they are run through the block level mode kernels.
+  Files are spread over all cores.
+  Usage: ./nist [directory]
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <dirent.h>
+#include "AESmodes.hpp"
+#include "hexcodec.hpp"
+
+// Monte Carlo tests chain 1000 iterations for each of 100 outputs
+#define MCT_INNER 1000
+
+// One vector from a .rsp file
+struct Vector {
+    bool encrypting;
+    std::vector<unsigned char> key;
+    std::vector<unsigned char> iv;
+    std::vector<unsigned char> plaintext;
+    std::vector<unsigned char> ciphertext;
+};
+
+// Result of one file
+struct FileResult {
+    std::string name;
+    bool skipped = false;
+    int total = 0;
+    int failed = 0;
+};
+
+
+/**
+  Run whole blocks through the mode kernels
+  @param mode: mode of operation
+  @param encrypting: true to encrypt, false to decrypt
+  @param expandedKey: key schedule from keyExpansion()
+  @param chain: chaining value, the IV at the start
+  @param input: whole blocks of input
+  @param output: resized to the output
+  @return none
+*/
+static void runBlocks(AESMode mode, bool encrypting, const std::vector<unsigned char>& expandedKey,
+                      std::array<unsigned char, NUM_BYTES>& chain, const std::vector<unsigned char>& input,
+                      std::vector<unsigned char>& output) {
+    const std::size_t numBlocks = input.size() / NUM_BYTES;
+    output.resize(input.size());
+
+    switch (mode) {
+        case MODE_ECB:
+            if (encrypting)
+                encrypt_ecb_blocks(input.data(), output.data(), numBlocks, expandedKey);
+            else
+                decrypt_ecb_blocks(input.data(), output.data(), numBlocks, expandedKey);
+            break;
+        case MODE_CBC:
+            if (encrypting)
+                encrypt_cbc_blocks(input.data(), output.data(), numBlocks, expandedKey, chain);
+            else
+                decrypt_cbc_blocks(input.data(), output.data(), numBlocks, expandedKey, chain);
+            break;
+        case MODE_CFB:
+            if (encrypting)
+                encrypt_cfb_blocks(input.data(), output.data(), numBlocks, expandedKey, chain);
+            else
+                decrypt_cfb_blocks(input.data(), output.data(), numBlocks, expandedKey, chain);
+            break;
+        default:
+            crypt_ofb_blocks(input.data(), output.data(), numBlocks, expandedKey, chain);
+            break;
+    }
+}
+
+/**
+  Expand a key for the kernels
+  @param key: the key
+  @return the key schedule
+*/
+static std::vector<unsigned char> expand(const std::vector<unsigned char>& key) {
+    std::vector<unsigned char> expandedKey(16 * (key.size() / 4 + 7), 0);
+    keyExpansion(key, expandedKey, key.size());
+    return expandedKey;
+}
+
+/**
+  Run a single KAT or MMT vector
+  @param mode: mode of operation
+  @param vector: the vector
+  @return true if the output matches
+*/
+static bool runVector(AESMode mode, const Vector& vector) {
+    std::array<unsigned char, NUM_BYTES> chain{0};
+    std::copy(vector.iv.begin(), vector.iv.end(), chain.begin());
+
+    std::vector<unsigned char> output;
+    if (vector.encrypting) {
+        runBlocks(mode, true, expand(vector.key), chain, vector.plaintext, output);
+        return output == vector.ciphertext;
+    }
+    runBlocks(mode, false, expand(vector.key), chain, vector.ciphertext, output);
+    return output == vector.plaintext;
+}
+
+/**
+  Run a Monte Carlo test, checking each of the 100 recorded outputs
+  Follows the AESAVS Monte Carlo procedure: 1000 chained single block operations per output,
+  then the key is XORed with the last output bits and the next input is taken from the last outputs
+  @param mode: mode of operation
+  @param vectors: the recorded vectors of one section, in order
+  @param result: pass and fail counts are added to this
+  @return none
+*/
+static void runMonteCarlo(AESMode mode, const std::vector<Vector>& vectors, FileResult& result) {
+    if (vectors.empty())
+        return;
+
+    const bool encrypting = vectors[0].encrypting;
+    std::vector<unsigned char> key = vectors[0].key;
+    std::vector<unsigned char> iv = vectors[0].iv;
+    std::vector<unsigned char> input = encrypting ? vectors[0].plaintext : vectors[0].ciphertext;
+
+    for (const Vector& vector : vectors) {
+        const std::vector<unsigned char>& expectedInput = encrypting ? vector.plaintext : vector.ciphertext;
+        const std::vector<unsigned char>& expectedOutput = encrypting ? vector.ciphertext : vector.plaintext;
+        bool passed = key == vector.key && iv == vector.iv && input == expectedInput;
+
+        const std::vector<unsigned char> expandedKey = expand(key);
+        std::array<unsigned char, NUM_BYTES> chain{0};
+        std::copy(iv.begin(), iv.end(), chain.begin());
+
+        std::vector<unsigned char> output;
+        std::vector<unsigned char> previous;
+        for (int j = 0; j < MCT_INNER; j++) {
+            previous = output;
+            runBlocks(mode, encrypting, expandedKey, chain, input, output);
+
+            // ECB feeds each output straight back in, the chained modes feed in the output from two steps back
+            if (mode == MODE_ECB)
+                input = output;
+            else if (j == 0)
+                input = iv;
+            else
+                input = previous;
+        }
+
+        passed = passed && output == expectedOutput;
+        result.total++;
+        if (!passed)
+            result.failed++;
+
+        // Key update uses the last key-size bits of the final two outputs
+        std::vector<unsigned char> tail = previous;
+        tail.insert(tail.end(), output.begin(), output.end());
+        for (std::size_t i = 0; i < key.size(); i++) {
+            key[i] ^= tail[tail.size() - key.size() + i];
+        }
+
+        if (mode == MODE_ECB) {
+            input = output;
+        }
+        else {
+            iv = output;
+            input = previous;
+        }
+    }
+}
+
+/**
+  Take the hex value from a "NAME = value" line
+  @param line: the line
+  @return the bytes of the value
+*/
+static std::vector<unsigned char> lineValue(const std::string& line) {
+    std::vector<unsigned char> value;
+    std::size_t equals = line.find('=');
+    if (equals != std::string::npos)
+        hexDecode(line.data() + equals + 1, line.size() - equals - 1, value);
+    return value;
+}
+
+/**
+  Run all of the tests in one .rsp file
+  @param path: path of the file
+  @param name: file name
+  @return the file's result
+*/
+static FileResult runFile(const std::string& path, const std::string& name) {
+    FileResult result;
+    result.name = name;
+
+    AESMode mode = MODE_INVALID;
+    if (name.compare(0, 3, "ECB") == 0)
+        mode = MODE_ECB;
+    else if (name.compare(0, 3, "CBC") == 0)
+        mode = MODE_CBC;
+    else if (name.compare(0, 6, "CFB128") == 0)
+        mode = MODE_CFB;
+    else if (name.compare(0, 3, "OFB") == 0)
+        mode = MODE_OFB;
+
+    // CFB1 and CFB8 are not implemented
+    if (mode == MODE_INVALID) {
+        result.skipped = true;
+        return result;
+    }
+    const bool monteCarlo = name.find("MCT") != std::string::npos;
+
+    std::ifstream file(path);
+    std::string line;
+    std::vector<Vector> section;
+    Vector current;
+    bool encrypting = true;
+    bool inVector = false;
+
+    // Vectors end with their output line, sections end at the next header or the end of the file
+    auto finishSection = [&]() {
+        if (monteCarlo) {
+            runMonteCarlo(mode, section, result);
+        }
+        else {
+            for (const Vector& vector : section) {
+                result.total++;
+                if (!runVector(mode, vector))
+                    result.failed++;
+            }
+        }
+        section.clear();
+    };
+
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (line.compare(0, 9, "[ENCRYPT]") == 0 || line.compare(0, 9, "[DECRYPT]") == 0) {
+            finishSection();
+            encrypting = line[1] == 'E';
+        }
+        else if (line.compare(0, 5, "COUNT") == 0) {
+            current = Vector();
+            current.encrypting = encrypting;
+            inVector = true;
+        }
+        else if (inVector && line.compare(0, 3, "KEY") == 0) {
+            current.key = lineValue(line);
+        }
+        else if (inVector && line.compare(0, 2, "IV") == 0) {
+            current.iv = lineValue(line);
+        }
+        else if (inVector && line.compare(0, 9, "PLAINTEXT") == 0) {
+            current.plaintext = lineValue(line);
+            if (!encrypting) {
+                section.push_back(current);
+                inVector = false;
+            }
+        }
+        else if (inVector && line.compare(0, 10, "CIPHERTEXT") == 0) {
+            current.ciphertext = lineValue(line);
+            if (encrypting) {
+                section.push_back(current);
+                inVector = false;
+            }
+        }
+    }
+    finishSection();
+
+    return result;
+}
+
+int main(int argc, char** argv) {
+    const std::string directory = argc > 1 ? argv[1] : "KAT";
+
+    std::vector<std::string> names;
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        std::cout << "Unable to open directory " << directory << std::endl;
+        return 2;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".rsp") == 0)
+            names.push_back(name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    // Each worker takes the next file until none are left
+    std::vector<FileResult> results(names.size());
+    std::atomic<std::size_t> next(0);
+    unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < numThreads; t++) {
+        workers.emplace_back([&]() {
+            for (std::size_t i = next++; i < names.size(); i = next++) {
+                results[i] = runFile(directory + "/" + names[i], names[i]);
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    int total = 0;
+    int failed = 0;
+    for (const FileResult& result : results) {
+        if (result.skipped) {
+            std::cout << "Skipping test: " << result.name << std::endl;
+            continue;
+        }
+        std::cout << "Running test: " << result.name << std::endl;
+        std::cout << "Passed " << (result.total - result.failed) << " out of " << result.total << std::endl;
+        total += result.total;
+        failed += result.failed;
+    }
+
+    std::cout << "Passed " << (total - failed) << " out of " << total << std::endl;
+    return failed == 0 ? 0 : 1;
+}
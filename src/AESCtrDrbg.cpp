@@ -0,0 +1,176 @@
+/**
+  @file AESCtrDrbg.cpp: CTR_DRBG (NIST SP 800-90A) deterministic random bit generator built on the AES cipher
+*/
+#include <algorithm>
+#include "AESCtrDrbg.hpp"
+#include "encrypt.hpp"
+
+
+/**
+  AESCtrDrbg constructor
+  The generator must be instantiated with entropy before use
+  @return none
+*/
+AESCtrDrbg::AESCtrDrbg() : key(DRBG_KEY_LENGTH, 0), expandedKey(16 * (DRBG_KEY_LENGTH / 4 + 7), 0), V(),
+                           reseedCounter(0), instantiated(false) {
+}
+
+/**
+  AESCtrDrbg deconstructor
+  @return none
+*/
+AESCtrDrbg::~AESCtrDrbg() {
+    uninstantiate();
+}
+
+/**
+  AESCtrDrbg::uninstantiate
+  Wipes the internal state, the generator must be instantiated again before use
+  @return none
+*/
+void AESCtrDrbg::uninstantiate() {
+    volatile unsigned char* wipe = this->key.data();
+    for (std::size_t i = 0; i < this->key.size(); i++) {
+        wipe[i] = 0;
+    }
+    wipe = this->expandedKey.data();
+    for (std::size_t i = 0; i < this->expandedKey.size(); i++) {
+        wipe[i] = 0;
+    }
+    wipe = this->V.data();
+    for (std::size_t i = 0; i < NUM_BYTES; i++) {
+        wipe[i] = 0;
+    }
+    this->reseedCounter = 0;
+    this->instantiated = false;
+}
+
+/**
+  AESCtrDrbg::incrementV
+  Increments V as a 128 bit big endian counter
+  @return none
+*/
+void AESCtrDrbg::incrementV() {
+    for (int i = NUM_BYTES - 1; i >= 0; i--) {
+        this->V[i] = this->V[i] + 1;
+        if (this->V[i] != 0)
+            break;
+    }
+}
+
+/**
+  AESCtrDrbg::update
+  CTR_DRBG_Update, derives a new key and V from the current state and the provided data
+  @param providedData: DRBG_SEED_LENGTH bytes to mix into the state
+  @return none
+*/
+void AESCtrDrbg::update(const std::array<unsigned char, DRBG_SEED_LENGTH>& providedData) {
+    std::array<unsigned char, DRBG_SEED_LENGTH> temp{0};
+    std::array<unsigned char, NUM_BYTES> outputBlock{0};
+
+    for (std::size_t i = 0; i < DRBG_SEED_LENGTH; i += NUM_BYTES) {
+        incrementV();
+        encryptExpanded(this->V, outputBlock, this->expandedKey);
+        std::copy(outputBlock.begin(), outputBlock.end(), temp.begin() + i);
+    }
+
+    for (std::size_t i = 0; i < DRBG_SEED_LENGTH; i++) {
+        temp[i] ^= providedData[i];
+    }
+
+    std::copy(temp.begin(), temp.begin() + DRBG_KEY_LENGTH, this->key.begin());
+    std::copy(temp.begin() + DRBG_KEY_LENGTH, temp.end(), this->V.begin());
+    keyExpansion(this->key, this->expandedKey, DRBG_KEY_LENGTH);
+
+    std::fill(temp.begin(), temp.end(), 0);
+    std::fill(outputBlock.begin(), outputBlock.end(), 0);
+}
+
+/**
+  AESCtrDrbg::instantiate
+  Seeds the generator from full entropy input
+  @param entropy: DRBG_SEED_LENGTH bytes of entropy
+  @param personalization: DRBG_SEED_LENGTH bytes of personalization string, or nullptr for none
+  @return none
+*/
+void AESCtrDrbg::instantiate(const unsigned char* entropy, const unsigned char* personalization) {
+    std::array<unsigned char, DRBG_SEED_LENGTH> seed{0};
+    for (std::size_t i = 0; i < DRBG_SEED_LENGTH; i++) {
+        seed[i] = entropy[i] ^ (personalization ? personalization[i] : 0);
+    }
+
+    std::fill(this->key.begin(), this->key.end(), 0);
+    this->V.fill(0);
+    keyExpansion(this->key, this->expandedKey, DRBG_KEY_LENGTH);
+
+    update(seed);
+    this->reseedCounter = 1;
+    this->instantiated = true;
+
+    std::fill(seed.begin(), seed.end(), 0);
+}
+
+/**
+  AESCtrDrbg::reseed
+  Mixes fresh entropy into the state and resets the reseed counter
+  @param entropy: DRBG_SEED_LENGTH bytes of entropy
+  @param additional: DRBG_SEED_LENGTH bytes of additional input, or nullptr for none
+  @return none
+*/
+void AESCtrDrbg::reseed(const unsigned char* entropy, const unsigned char* additional) {
+    std::array<unsigned char, DRBG_SEED_LENGTH> seed{0};
+    for (std::size_t i = 0; i < DRBG_SEED_LENGTH; i++) {
+        seed[i] = entropy[i] ^ (additional ? additional[i] : 0);
+    }
+
+    update(seed);
+    this->reseedCounter = 1;
+
+    std::fill(seed.begin(), seed.end(), 0);
+}
+
+/**
+  AESCtrDrbg::needsReseed
+  @return True if the generator has not been seeded or has reached its reseed interval
+*/
+bool AESCtrDrbg::needsReseed() const {
+    return !this->instantiated || this->reseedCounter > DRBG_RESEED_INTERVAL;
+}
+
+/**
+  AESCtrDrbg::generate
+  Produces pseudorandom bytes by encrypting successive values of V
+  @param dest: buffer to fill
+  @param numBytes: number of bytes to produce, at most DRBG_MAX_REQUEST
+  @param additional: DRBG_SEED_LENGTH bytes of additional input, or nullptr for none
+  @return True on success, false if a reseed is required or the request is too large
+*/
+bool AESCtrDrbg::generate(unsigned char* dest, std::size_t numBytes, const unsigned char* additional) {
+    if (needsReseed() || numBytes > DRBG_MAX_REQUEST)
+        return false;
+
+    std::array<unsigned char, DRBG_SEED_LENGTH> additionalInput{0};
+    if (additional) {
+        std::copy(additional, additional + DRBG_SEED_LENGTH, additionalInput.begin());
+        update(additionalInput);
+    }
+
+    std::array<unsigned char, NUM_BYTES> outputBlock{0};
+    std::size_t filled = 0;
+    while (filled < numBytes) {
+        incrementV();
+        encryptExpanded(this->V, outputBlock, this->expandedKey);
+
+        std::size_t count = std::min((std::size_t) NUM_BYTES, numBytes - filled);
+        std::copy(outputBlock.begin(), outputBlock.begin() + count, dest + filled);
+        filled += count;
+    }
+
+    // Backtracking resistance, the state used for this output is replaced
+    update(additionalInput);
+    this->reseedCounter++;
+
+    std::fill(outputBlock.begin(), outputBlock.end(), 0);
+    std::fill(additionalInput.begin(), additionalInput.end(), 0);
+    return true;
+}
@@ -0,0 +1,51 @@
+/**
+  @file AESCtrDrbg.hpp: CTR_DRBG (NIST SP 800-90A) deterministic random bit generator built on the AES cipher
+*/
+#ifndef AES_CTRDRBG_HPP
+#define AES_CTRDRBG_HPP
+
+#include <vector>
+#include <array>
+#include <cstddef>
+#include "AESmath.hpp"
+
+// AES-256 CTR_DRBG without a derivation function (SP 800-90A, Table 3)
+#define DRBG_KEY_LENGTH 32
+#define DRBG_SEED_LENGTH (DRBG_KEY_LENGTH + NUM_BYTES)
+// Largest single request, 2^19 bits
+#define DRBG_MAX_REQUEST 65536
+// Number of generate calls allowed before a reseed is required
+#define DRBG_RESEED_INTERVAL 65536
+
+
+//AESCtrDrbg class
+class AESCtrDrbg {
+public:
+    AESCtrDrbg();
+
+    ~AESCtrDrbg();
+
+    void instantiate(const unsigned char* entropy, const unsigned char* personalization);
+
+    void reseed(const unsigned char* entropy, const unsigned char* additional);
+
+    bool generate(unsigned char* dest, std::size_t numBytes, const unsigned char* additional);
+
+    bool needsReseed() const;
+
+    void uninstantiate();
+
+private:
+    void update(const std::array<unsigned char, DRBG_SEED_LENGTH>& providedData);
+
+    void incrementV();
+
+    std::vector<unsigned char> key;
+    std::vector<unsigned char> expandedKey;
+    std::array<unsigned char, NUM_BYTES> V;
+    unsigned long long reseedCounter;
+    bool instantiated;
+};
+
+
+#endif //AES_CTRDRBG_HPP
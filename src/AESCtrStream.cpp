@@ -0,0 +1,121 @@
+/**
+  @file AESCtrStream.cpp: CTR keystream shared by concurrent writers under one key and nonce
+  Writers reserve a range of counter blocks with one fetch-add and then encrypt their range on their own,
+  so no two writers ever use the same keystream and nothing is locked while encrypting. Counter blocks
+  use the layout of encrypt_ctr(): the nonce followed by the block number as a big-endian 64-bit integer.
+  A record that ends partway through a block leaves the rest of that block's keystream unused, so every
+  record starts on a block boundary and can be decrypted from its first block number alone.
+*/
+
+#include <algorithm>
+#include "AESCtrStream.hpp"
+#include "AESmodes.hpp"
+#include "AESStats.hpp"
+#include "AESTrace.hpp"
+
+
+/**
+  AESCtrStream constructor
+  @param key: vector of hex values representing key to use
+  @param nonce: NUM_BYTES/2 byte nonce, which must never be used again with this key
+  @param firstBlock: block number the first reservation starts at, to continue an existing stream
+  @return none
+*/
+AESCtrStream::AESCtrStream(const std::vector<unsigned char> &key, const std::array<unsigned char, NUM_BYTES / 2> &nonce,
+                           std::uint64_t firstBlock)
+        : expandedKey(16 * (key.size() / 4 + 7), 0), nonce(nonce), next(firstBlock) {
+    keyExpansion(key, this->expandedKey, key.size());
+}
+
+/**
+  AESCtrStream deconstructor
+  Wipes the key schedule
+  @return none
+*/
+AESCtrStream::~AESCtrStream() {
+    std::fill(this->expandedKey.begin(), this->expandedKey.end(), 0);
+}
+
+/**
+  Reserves the counter blocks for one record, safe to call from any number of threads at once
+  @param length: number of bytes in the record
+  @param firstBlock: set to the block number the record starts at
+  @return True on success, false if the record is too long or the stream's counter is used up
+*/
+bool AESCtrStream::reserve(std::size_t length, std::uint64_t &firstBlock) noexcept(true) {
+    const std::uint64_t numBlocks = ((std::uint64_t) length + NUM_BYTES - 1) / NUM_BYTES;
+    if (numBlocks > CTR_STREAM_MAX_RESERVATION)
+        return false;
+
+    // Relaxed is enough, the reserved range is the only thing the counter hands out
+    firstBlock = this->next.fetch_add(numBlocks, std::memory_order_relaxed);
+    return firstBlock < CTR_STREAM_BLOCK_LIMIT && firstBlock + numBlocks <= CTR_STREAM_BLOCK_LIMIT;
+}
+
+/**
+  Encrypts or decrypts a record at its reserved position, the operation is its own inverse
+  Safe to call from many threads at once, input and output may be the same buffer
+  @param firstBlock: block number from reserve()
+  @param input: length bytes of input
+  @param output: length bytes of output
+  @param length: number of bytes to process
+  @return True on success
+*/
+bool AESCtrStream::crypt(std::uint64_t firstBlock, const unsigned char *input, unsigned char *output,
+                         std::size_t length) const noexcept(true) {
+    try {
+        AESTrace::Span span("crypt record", "block", (std::int64_t) firstBlock);
+        const std::size_t numBlocks = length / NUM_BYTES;
+        const std::size_t tailLength = length % NUM_BYTES;
+        AES_STAT_ADD(STAT_BYTES_IN, length);
+        AES_STAT_ADD(STAT_BYTES_OUT, length);
+        AES_STAT_ADD(AESStats::blocks(MODE_CTR, true), numBlocks + (tailLength != 0));
+
+        std::array<unsigned char, NUM_BYTES> counter;
+        std::copy(this->nonce.begin(), this->nonce.end(), counter.begin());
+        for (std::size_t i = 0; i < NUM_BYTES / 2; i++) {
+            counter[NUM_BYTES - 1 - i] = (unsigned char) (firstBlock >> (8 * i));
+        }
+
+        crypt_ctr_blocks(input, output, numBlocks, this->expandedKey, counter);
+
+        // A partial last block uses the start of its keystream block, the rest is never used
+        if (tailLength != 0) {
+            std::array<unsigned char, NUM_BYTES> keystream{0};
+            encryptExpanded(counter, keystream, this->expandedKey);
+            for (std::size_t j = 0; j < tailLength; j++) {
+                output[numBlocks * NUM_BYTES + j] = input[numBlocks * NUM_BYTES + j] ^ keystream[j];
+            }
+            keystream.fill(0);
+        }
+
+    } catch (std::exception &e) {
+        //Catch exception by lvalue or reference per ERR61-CPP
+        return false;
+    }
+    return true;
+}
+
+/**
+  Reserves the counter blocks for a record and encrypts it
+  @param input: length bytes of plaintext
+  @param output: length bytes of ciphertext
+  @param length: number of bytes in the record
+  @param firstBlock: set to the block number the record starts at, which a reader needs to decrypt it
+  @return True on success, false if the counter blocks could not be reserved
+*/
+bool AESCtrStream::append(const unsigned char *input, unsigned char *output, std::size_t length,
+                          std::uint64_t &firstBlock) noexcept(true) {
+    if (!reserve(length, firstBlock))
+        return false;
+    return crypt(firstBlock, input, output, length);
+}
+
+/**
+  The block number the next reservation will start at
+  Save it with the log to continue the stream later with the same key and nonce
+  @return the next unreserved block
+*/
+std::uint64_t AESCtrStream::nextBlock() const {
+    return this->next.load(std::memory_order_relaxed);
+}
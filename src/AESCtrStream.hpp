@@ -0,0 +1,49 @@
+/**
+  @file AESCtrStream.hpp: CTR keystream shared by concurrent writers under one key and nonce
+*/
+#ifndef AES_CTR_STREAM_HPP
+#define AES_CTR_STREAM_HPP
+
+#include <vector>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "AESmath.hpp"
+
+// Largest reservation, in blocks, so the block counter cannot wrap while threads race past the limit
+#define CTR_STREAM_MAX_RESERVATION (1ull << 32)
+// Reservations fail once the counter reaches this block, long before it can wrap to reuse keystream
+#define CTR_STREAM_BLOCK_LIMIT (1ull << 63)
+
+
+//AESCtrStream class
+class AESCtrStream {
+public:
+    AESCtrStream(const std::vector<unsigned char> &key, const std::array<unsigned char, NUM_BYTES / 2> &nonce,
+                 std::uint64_t firstBlock = 0);
+
+    AESCtrStream(const AESCtrStream&) = delete;
+
+    AESCtrStream& operator=(const AESCtrStream&) = delete;
+
+    ~AESCtrStream();
+
+    bool reserve(std::size_t length, std::uint64_t &firstBlock) noexcept(true);
+
+    bool crypt(std::uint64_t firstBlock, const unsigned char *input, unsigned char *output,
+               std::size_t length) const noexcept(true);
+
+    bool append(const unsigned char *input, unsigned char *output, std::size_t length,
+                std::uint64_t &firstBlock) noexcept(true);
+
+    std::uint64_t nextBlock() const;
+
+private:
+    std::vector<unsigned char> expandedKey;
+    std::array<unsigned char, NUM_BYTES / 2> nonce;
+    std::atomic<std::uint64_t> next;
+};
+
+
+#endif //AES_CTR_STREAM_HPP
@@ -0,0 +1,238 @@
+/**
+  @file AESKeyCache.cpp: Cache of expanded key schedules
+  Schedules are found by a SipHash-2-4 fingerprint of the key under a random per-cache hash key, so
+  the fingerprints reveal nothing about the keys and cannot be steered into one shard.
+  Each shard is an LRU list under its own lock. Keys and schedules are zeroed when they leave the
+  cache, a schedule still in use is zeroed once its last user lets go of it.
+*/
+
+#include <algorithm>
+#include "AESKeyCache.hpp"
+#include "AESRand.hpp"
+#include "AESTrace.hpp"
+
+
+/**
+  Zero memory in a way the compiler cannot remove
+  @param data: memory to zero
+  @param length: number of bytes
+  @return none
+*/
+static void secureZero(unsigned char* data, std::size_t length) {
+    volatile unsigned char* bytes = data;
+    for (std::size_t i = 0; i < length; i++) {
+        bytes[i] = 0;
+    }
+}
+
+/**
+  Rotate left
+*/
+static inline std::uint64_t rotate(std::uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/**
+  One SipHash round
+*/
+static inline void sipRound(std::uint64_t& v0, std::uint64_t& v1, std::uint64_t& v2, std::uint64_t& v3) {
+    v0 += v1; v1 = rotate(v1, 13); v1 ^= v0; v0 = rotate(v0, 32);
+    v2 += v3; v3 = rotate(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = rotate(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = rotate(v1, 17); v1 ^= v2; v2 = rotate(v2, 32);
+}
+
+/**
+  SipHash-2-4
+  @param key: 128 bit hash key
+  @param data: message
+  @param length: length of the message
+  @return the 64 bit hash
+*/
+static std::uint64_t sipHash(const std::array<std::uint64_t, 2>& key, const unsigned char* data, std::size_t length) {
+    std::uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+    std::uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+    std::uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+    std::uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+
+    const std::size_t whole = length - (length % 8);
+    for (std::size_t i = 0; i < whole; i += 8) {
+        std::uint64_t word = 0;
+        for (int j = 7; j >= 0; j--) {
+            word = (word << 8) | data[i + j];
+        }
+        v3 ^= word;
+        sipRound(v0, v1, v2, v3);
+        sipRound(v0, v1, v2, v3);
+        v0 ^= word;
+    }
+
+    std::uint64_t last = (std::uint64_t) length << 56;
+    for (std::size_t j = 0; j < length % 8; j++) {
+        last |= (std::uint64_t) data[whole + j] << (8 * j);
+    }
+    v3 ^= last;
+    sipRound(v0, v1, v2, v3);
+    sipRound(v0, v1, v2, v3);
+    v0 ^= last;
+
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; i++) {
+        sipRound(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/**
+  Compare two keys in constant time
+  @return true if the keys are equal
+*/
+static bool sameKey(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b) {
+    if (a.size() != b.size())
+        return false;
+    unsigned char difference = 0;
+    for (std::size_t i = 0; i < a.size(); i++) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+/**
+  AESKeyCache constructor
+  @param capacity: number of schedules kept, spread evenly over the shards
+*/
+AESKeyCache::AESKeyCache(std::size_t capacity)
+        : shardCapacity(std::max<std::size_t>((capacity + KEY_CACHE_SHARDS - 1) / KEY_CACHE_SHARDS, 1)),
+          hitCount(0), missCount(0), evictionCount(0) {
+    AESRand::threadLocal().fillBytes((unsigned char*) this->hashKey.data(), sizeof(this->hashKey));
+}
+
+/**
+  AESKeyCache destructor
+  Zeroes every key and schedule
+*/
+AESKeyCache::~AESKeyCache() {
+    this->clear();
+    secureZero((unsigned char*) this->hashKey.data(), sizeof(this->hashKey));
+}
+
+/**
+  Fingerprint of a key
+  @param key: key to fingerprint
+  @return keyed hash of the key
+*/
+std::uint64_t AESKeyCache::fingerprint(const std::vector<unsigned char>& key) const {
+    return sipHash(this->hashKey, key.data(), key.size());
+}
+
+/**
+  Zero an entry's key and release its schedule, which is zeroed once no longer in use
+  @param entry: entry leaving the cache
+  @return none
+*/
+void AESKeyCache::evict(Entry& entry) {
+    secureZero(entry.key.data(), entry.key.size());
+    entry.schedule.reset();
+}
+
+/**
+  Get the schedule for a key, expanding and caching it on a miss
+  The schedule stays valid for as long as the returned pointer is held, even if it is evicted
+  @param key: 16, 24 or 32 byte key
+  @return the expanded key schedule
+*/
+std::shared_ptr<const std::vector<unsigned char>> AESKeyCache::get(const std::vector<unsigned char>& key) {
+    AESTrace::Span span("key cache");
+    const std::uint64_t print = this->fingerprint(key);
+    Shard& shard = this->shards[print % KEY_CACHE_SHARDS];
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.index.find(print);
+        if (found != shard.index.end() && sameKey(found->second->key, key)) {
+            shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+            this->hitCount++;
+            return found->second->schedule;
+        }
+    }
+    this->missCount++;
+
+    // Expand without holding the lock, the deleter zeroes the schedule when its last user is done
+    std::vector<unsigned char>* expanded = new std::vector<unsigned char>(16 * (key.size() / 4 + 7), 0);
+    std::shared_ptr<const std::vector<unsigned char>> schedule(expanded, [](const std::vector<unsigned char>* wiped) {
+        secureZero(const_cast<unsigned char*>(wiped->data()), wiped->size());
+        delete wiped;
+    });
+    keyExpansion(key, *expanded, (unsigned char) key.size());
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(print);
+    if (found != shard.index.end()) {
+        // Another thread cached it meanwhile, or a different key has the same fingerprint and is replaced
+        if (sameKey(found->second->key, key))
+            return found->second->schedule;
+        evict(*found->second);
+        shard.entries.erase(found->second);
+        shard.index.erase(found);
+    }
+
+    shard.entries.push_front(Entry{print, key, schedule});
+    shard.index[print] = shard.entries.begin();
+
+    while (shard.entries.size() > this->shardCapacity) {
+        Entry& oldest = shard.entries.back();
+        shard.index.erase(oldest.fingerprint);
+        evict(oldest);
+        shard.entries.pop_back();
+        this->evictionCount++;
+    }
+    return schedule;
+}
+
+/**
+  Remove every schedule, zeroing the keys
+  @return none
+*/
+void AESKeyCache::clear() {
+    for (Shard& shard : this->shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (Entry& entry : shard.entries) {
+            evict(entry);
+        }
+        shard.entries.clear();
+        shard.index.clear();
+    }
+}
+
+/**
+  Number of lookups that found their schedule
+  @return hit count
+*/
+std::uint64_t AESKeyCache::hits() const {
+    return this->hitCount;
+}
+
+/**
+  Number of lookups that had to expand the key
+  @return miss count
+*/
+std::uint64_t AESKeyCache::misses() const {
+    return this->missCount;
+}
+
+/**
+  Number of schedules dropped to stay within the capacity
+  @return eviction count
+*/
+std::uint64_t AESKeyCache::evictions() const {
+    return this->evictionCount;
+}
+
+/**
+  Process-wide cache
+  @return the shared cache
+*/
+AESKeyCache& AESKeyCache::shared() {
+    static AESKeyCache cache;
+    return cache;
+}
@@ -0,0 +1,72 @@
+/**
+  @file AESKeyCache.hpp: Cache of expanded key schedules
+*/
+#ifndef AES_KEY_CACHE_HPP
+#define AES_KEY_CACHE_HPP
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <array>
+#include <cstdint>
+#include "AESmath.hpp"
+
+// Default number of schedules kept
+#define KEY_CACHE_CAPACITY 256
+// Number of independently locked shards
+#define KEY_CACHE_SHARDS 16
+
+
+//AESKeyCache class
+class AESKeyCache {
+public:
+    explicit AESKeyCache(std::size_t capacity = KEY_CACHE_CAPACITY);
+
+    AESKeyCache(const AESKeyCache&) = delete;
+
+    AESKeyCache& operator=(const AESKeyCache&) = delete;
+
+    ~AESKeyCache();
+
+    std::shared_ptr<const std::vector<unsigned char>> get(const std::vector<unsigned char>& key);
+
+    void clear();
+
+    std::uint64_t hits() const;
+
+    std::uint64_t misses() const;
+
+    std::uint64_t evictions() const;
+
+    static AESKeyCache& shared();
+
+private:
+    struct Entry {
+        std::uint64_t fingerprint;
+        std::vector<unsigned char> key;
+        std::shared_ptr<const std::vector<unsigned char>> schedule;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<std::uint64_t, std::list<Entry>::iterator> index;
+    };
+
+    std::uint64_t fingerprint(const std::vector<unsigned char>& key) const;
+
+    static void evict(Entry& entry);
+
+    std::array<std::uint64_t, 2> hashKey;
+    std::size_t shardCapacity;
+    std::array<Shard, KEY_CACHE_SHARDS> shards;
+    std::atomic<std::uint64_t> hitCount;
+    std::atomic<std::uint64_t> missCount;
+    std::atomic<std::uint64_t> evictionCount;
+};
+
+
+#endif //AES_KEY_CACHE_HPP
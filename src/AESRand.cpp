@@ -1,20 +1,68 @@
 /**
   @file AESrand.cpp: randomness class
 */
-#include <random>
 #include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
 #include "AESRand.hpp"
 #include "encrypt.hpp"
 
+// Incremented in the child after every fork() so generators know to reseed
+static std::atomic<unsigned long> forkCounter(0);
+static std::once_flag forkHandlerFlag;
+
+/**
+  Child side fork handler
+  @return none
+*/
+static void onFork() {
+    forkCounter.fetch_add(1, std::memory_order_relaxed);
+}
+
 
 /**
   AESRand constructor
+  Nothing is read from the system until bytes are first requested
+  @return none
+*/
+AESRand::AESRand() : drbg(), buffer(), available(0), forkGeneration(0) {
+    std::call_once(forkHandlerFlag, []() { pthread_atfork(nullptr, nullptr, onFork); });
+    this->forkGeneration = forkCounter.load(std::memory_order_relaxed);
+}
 
+/**
+  AESRand::threadLocal
+  Returns the generator owned by the calling thread
+  Each thread seeds its own instance independently, so no lock is shared between threads
+  @return the calling thread's generator
+*/
+AESRand& AESRand::threadLocal() {
+    static thread_local AESRand instance;
+    return instance;
+}
+
+/**
+  AESRand::checkFork
+  A forked child inherits the parent's generator state and would repeat its output,
+  so buffered bytes are discarded and the DRBG is reseeded from fresh entropy
   @return none
 */
-AESRand::AESRand() {
-    //Open /dev/urandom with the input and binary parameter
-    this->urandom = std::ifstream("/dev/urandom", std::ios_base::in | std::ios_base::binary);
+void AESRand::checkFork() {
+    const unsigned long generation = forkCounter.load(std::memory_order_relaxed);
+    if (generation != this->forkGeneration) {
+        this->forkGeneration = generation;
+        std::fill(this->buffer.begin(), this->buffer.end(), 0);
+        this->available = 0;
+        this->drbg.uninstantiate();
+    }
 }
 
 /**
@@ -22,21 +70,142 @@ AESRand::AESRand() {
   @return none
 */
 AESRand::~AESRand() {
-    //Close the file
-    this->urandom.close();
+    //Wipe any unused random bytes
+    volatile unsigned char* wipe = this->buffer.data();
+    for (std::size_t i = 0; i < RAND_BUFFER_SIZE; i++) {
+        wipe[i] = 0;
+    }
+}
+
+/**
+  AESRand::readSystemRandom
+  Reads bytes straight from the kernel using the getrandom() syscall
+  Falls back to /dev/urandom only if the syscall is not available
+  @param dest: buffer to fill
+  @param numBytes: the number of random bytes needed
+  @return none
+*/
+void AESRand::readSystemRandom(unsigned char* dest, std::size_t numBytes) {
+    std::size_t filled = 0;
+
+#ifdef SYS_getrandom
+    while (filled < numBytes) {
+        long got = syscall(SYS_getrandom, dest + filled, numBytes - filled, 0);
+        if (got > 0) {
+            filled += (std::size_t) got;
+        }
+        //Retry if interrupted by a signal
+        else if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        //Only an unsupported syscall falls through to /dev/urandom
+        else if (got < 0 && errno == ENOSYS) {
+            break;
+        }
+        else {
+            throw std::runtime_error("getrandom failed");
+        }
+    }
+#endif
+
+    if (filled < numBytes) {
+        int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Unable to open /dev/urandom");
+        }
+        while (filled < numBytes) {
+            ssize_t got = read(fd, dest + filled, numBytes - filled);
+            if (got > 0) {
+                filled += (std::size_t) got;
+            }
+            else if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            else {
+                close(fd);
+                throw std::runtime_error("Unable to read /dev/urandom");
+            }
+        }
+        close(fd);
+    }
+}
+
+/**
+  AESRand::generateFromDrbg
+  Generates bytes with the AES CTR_DRBG, seeding it from the kernel the first time
+  and reseeding whenever its reseed interval is reached
+  @param dest: buffer to fill
+  @param numBytes: the number of random bytes needed
+  @return none
+*/
+void AESRand::generateFromDrbg(unsigned char* dest, std::size_t numBytes) {
+    std::size_t filled = 0;
+    while (filled < numBytes) {
+        std::size_t count = std::min((std::size_t) DRBG_MAX_REQUEST, numBytes - filled);
+
+        if (this->drbg.needsReseed()) {
+            std::array<unsigned char, DRBG_SEED_LENGTH> entropy{0};
+            readSystemRandom(entropy.data(), DRBG_SEED_LENGTH);
+
+            //Personalize with the process and thread so no two generators share a seed even if entropy repeats
+            std::array<unsigned char, DRBG_SEED_LENGTH> personalization{0};
+            unsigned long long pid = (unsigned long long) getpid();
+            unsigned long long tid = (unsigned long long) std::hash<std::thread::id>()(std::this_thread::get_id());
+            for (std::size_t i = 0; i < 8; i++) {
+                personalization[i] = (unsigned char) (pid >> (8 * i));
+                personalization[8 + i] = (unsigned char) (tid >> (8 * i));
+            }
+
+            this->drbg.instantiate(entropy.data(), personalization.data());
+            std::fill(entropy.begin(), entropy.end(), 0);
+        }
+
+        if (!this->drbg.generate(dest + filled, count, nullptr)) {
+            throw std::runtime_error("CTR_DRBG generate failed");
+        }
+        filled += count;
+    }
+}
+
+/**
+  AESRand::fillBytes
+  Fills a caller provided buffer with random bytes
+  Small requests are served from the internal buffer, which is refilled lazily from the CTR_DRBG,
+  requests larger than the buffer are generated directly into the destination
+  @param dest: buffer to fill
+  @param numBytes: the number of random bytes needed
+  @return none
+*/
+void AESRand::fillBytes(unsigned char* dest, std::size_t numBytes) {
+    checkFork();
+
+    if (numBytes >= RAND_BUFFER_SIZE) {
+        generateFromDrbg(dest, numBytes);
+        return;
+    }
+
+    if (numBytes > this->available) {
+        generateFromDrbg(this->buffer.data(), RAND_BUFFER_SIZE);
+        this->available = RAND_BUFFER_SIZE;
+    }
+
+    //Hand out bytes from the end of the buffer and wipe them so they are never reused
+    unsigned char* start = this->buffer.data() + (this->available - numBytes);
+    std::copy(start, start + numBytes, dest);
+    std::fill(start, start + numBytes, 0);
+    this->available -= numBytes;
 }
 
 /**
   AESRand::generateBytes
-  Generates some number of bytes using Unix/Linux /dev/urandom
+  Generates some number of bytes using the AES CTR_DRBG seeded from the kernel
   @param numBytes: The number of random bytes needed
   @return A vector with the random bytes
 */
 std::vector<unsigned char> AESRand::generateBytes(unsigned int numBytes) {
     std::vector<unsigned char> ret(numBytes, 0);
 
-    //Cast the unsigned char array to a char array since ifstream returns char
-    this->urandom.read((char*)ret.data(), numBytes);
+    fillBytes(ret.data(), numBytes);
 
     return ret;
 }
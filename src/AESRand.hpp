@@ -6,11 +6,12 @@
 
 #include <vector>
 #include <array>
-#include <random>
-#include <iostream>
-#include <fstream>
+#include <cstddef>
 #include "AESmath.hpp"
+#include "AESCtrDrbg.hpp"
 
+// Size of the internal buffer that random bytes are served from
+#define RAND_BUFFER_SIZE 4096
 
 
 //AESRand class
@@ -22,8 +23,22 @@ public:
 
     std::vector<unsigned char> generateBytes(unsigned int numBytes);
 
+    void fillBytes(unsigned char* dest, std::size_t numBytes);
+
+    static AESRand& threadLocal();
+
 private:
-    std::ifstream urandom;
+    void checkFork();
+
+    void readSystemRandom(unsigned char* dest, std::size_t numBytes);
+
+    void generateFromDrbg(unsigned char* dest, std::size_t numBytes);
+
+    AESCtrDrbg drbg;
+
+    std::array<unsigned char, RAND_BUFFER_SIZE> buffer;
+    std::size_t available;
+    unsigned long forkGeneration;
 };
 
 
@@ -0,0 +1,136 @@
+/**
+  @file AESStats.cpp: Runtime statistics counters
+  Each thread counts into its own ThreadCounters without locks or shared cache lines. A snapshot sums
+  the counters of the live threads and the totals left behind by threads that have exited.
+  reset() records a baseline that later snapshots are taken relative to, so no thread's counters are
+  ever written by another thread.
+*/
+
+#include <iomanip>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include "AESStats.hpp"
+
+namespace {
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<AESStats::ThreadCounters*> threads;
+    AESStats::Values retired{};
+    AESStats::Values baseline{};
+};
+
+/**
+  The registry of thread counters
+  Never destroyed, so threads exiting during static destruction can still fold their counters in
+  @return the registry
+*/
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+/**
+  Totals of every thread since the program started
+  @param state: the registry, locked by the caller
+  @return the totals
+*/
+AESStats::Values totals(Registry& state) {
+    AESStats::Values values = state.retired;
+    for (AESStats::ThreadCounters* thread : state.threads)
+        for (std::size_t i = 0; i < values.size(); i++)
+            values[i] += thread->values[i].load(std::memory_order_relaxed);
+    return values;
+}
+
+}
+
+/**
+  ThreadCounters constructor
+  Registers the calling thread's counters
+  @return none
+*/
+AESStats::ThreadCounters::ThreadCounters() {
+    for (std::atomic<std::uint64_t>& value : this->values)
+        value.store(0, std::memory_order_relaxed);
+    Registry& state = registry();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.threads.push_back(this);
+}
+
+/**
+  ThreadCounters destructor
+  Folds the counters into the retired totals as the thread exits
+  @return none
+*/
+AESStats::ThreadCounters::~ThreadCounters() {
+    Registry& state = registry();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (std::size_t i = 0; i < this->values.size(); i++)
+        state.retired[i] += this->values[i].load(std::memory_order_relaxed);
+    state.threads.erase(std::remove(state.threads.begin(), state.threads.end(), this), state.threads.end());
+}
+
+/**
+  Whether the counters were compiled in
+  @return True if built with AES_STATS
+*/
+bool AESStats::enabled() {
+#ifdef AES_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+  Sums the counters of all threads
+  Counts still being added by running threads may or may not be included
+  @return the counters since the program started or the last reset()
+*/
+AESStats::Values AESStats::snapshot() {
+    Registry& state = registry();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    Values values = totals(state);
+    for (std::size_t i = 0; i < values.size(); i++)
+        values[i] -= state.baseline[i];
+    return values;
+}
+
+/**
+  Starts the counters again from zero
+  @return none
+*/
+void AESStats::reset() {
+    Registry& state = registry();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.baseline = totals(state);
+}
+
+/**
+  Writes the counters in a readable form, leaving out modes that processed no blocks
+  @param out: stream to write to
+  @return none
+*/
+void AESStats::report(std::ostream& out) {
+    if (!enabled()) {
+        out << "Statistics are not compiled in, build with -DAES_STATS.\n";
+        return;
+    }
+    const Values values = snapshot();
+    static const char* modeNames[MODE_INVALID] = {"ECB", "CBC", "CTS", "CFB", "OFB", "CTR"};
+
+    out << "Key expansions: " << values[STAT_KEY_EXPANSIONS] << "\n"
+        << "Bytes in: " << values[STAT_BYTES_IN] << ", bytes out: " << values[STAT_BYTES_OUT] << "\n"
+        << "Padding failures: " << values[STAT_PADDING_FAILURES] << "\n";
+    for (int mode = 0; mode < MODE_INVALID; mode++) {
+        const std::uint64_t encrypted = values[blocks((AESMode) mode, true)];
+        const std::uint64_t decrypted = values[blocks((AESMode) mode, false)];
+        if (encrypted != 0 || decrypted != 0)
+            out << modeNames[mode] << " blocks encrypted: " << encrypted << ", decrypted: " << decrypted << "\n";
+    }
+    out << std::fixed << std::setprecision(3)
+        << "Time in key setup: " << values[STAT_NS_KEY_SETUP] / 1e6 << " ms, cipher: " << values[STAT_NS_CIPHER] / 1e6
+        << " ms, read: " << values[STAT_NS_READ] / 1e6 << " ms, write: " << values[STAT_NS_WRITE] / 1e6 << " ms\n";
+}
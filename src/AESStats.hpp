@@ -0,0 +1,91 @@
+/**
+  @file AESStats.hpp: Runtime statistics counters
+  Counting is compiled in when AES_STATS is defined. Without it the AES_STAT macros expand to nothing
+  and AESStats::snapshot() returns zeros.
+*/
+#ifndef AES_STATS_HPP
+#define AES_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include "AESmodes.hpp"
+
+// Counters kept per thread. Blocks are counted per mode and direction from STAT_BLOCKS.
+enum AESStat {
+    STAT_KEY_EXPANSIONS,
+    STAT_BYTES_IN,
+    STAT_BYTES_OUT,
+    STAT_PADDING_FAILURES,
+    STAT_NS_KEY_SETUP,
+    STAT_NS_CIPHER,
+    STAT_NS_READ,
+    STAT_NS_WRITE,
+    STAT_BLOCKS,
+    STAT_COUNT = STAT_BLOCKS + 2 * MODE_INVALID
+};
+
+
+//AESStats class
+class AESStats {
+public:
+    typedef std::array<std::uint64_t, STAT_COUNT> Values;
+
+    static bool enabled();
+
+    static Values snapshot();
+
+    static void reset();
+
+    static void report(std::ostream& out);
+
+    static AESStat blocks(AESMode mode, bool encrypting) {
+        return (AESStat) (STAT_BLOCKS + 2 * mode + (encrypting ? 0 : 1));
+    }
+
+    //Counters of one thread, only ever written by that thread
+    struct ThreadCounters {
+        ThreadCounters();
+
+        ~ThreadCounters();
+
+        void add(AESStat stat, std::uint64_t amount) {
+            values[stat].store(values[stat].load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        std::array<std::atomic<std::uint64_t>, STAT_COUNT> values;
+    };
+
+    static ThreadCounters& local() {
+        static thread_local ThreadCounters counters;
+        return counters;
+    }
+
+    //Adds the time from construction to destruction to a counter
+    class Timer {
+    public:
+        explicit Timer(AESStat stat) : stat(stat), start(std::chrono::steady_clock::now()) {}
+
+        ~Timer() {
+            local().add(stat, (std::uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+        }
+
+    private:
+        AESStat stat;
+        std::chrono::steady_clock::time_point start;
+    };
+};
+
+#ifdef AES_STATS
+#define AES_STAT_ADD(stat, amount) AESStats::local().add((stat), (std::uint64_t) (amount))
+#define AES_STAT_TIMER(name, stat) AESStats::Timer name(stat)
+#else
+#define AES_STAT_ADD(stat, amount) ((void) 0)
+#define AES_STAT_TIMER(name, stat) ((void) 0)
+#endif
+
+
+#endif //AES_STATS_HPP
@@ -0,0 +1,187 @@
+/**
+  @file AESTrace.cpp: Span tracing in the Chrome trace event format
+  Every thread records into its own fixed size buffer, which only that thread writes. A slot is filled
+  before the count is published with a release store, so writeFile() can read the published spans of
+  running threads without locks. Buffers outlive their threads so spans of finished workers are kept.
+  The output loads in Perfetto (ui.perfetto.dev) or chrome://tracing.
+*/
+
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include "AESTrace.hpp"
+
+std::atomic<bool> AESTrace::enabled(false);
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    const char* argName;
+    std::int64_t begin;
+    std::int64_t end;
+    std::int64_t arg;
+};
+
+struct ThreadBuffer {
+    unsigned tid;
+    std::string name;
+    std::atomic<std::size_t> count;
+    std::atomic<std::uint64_t> dropped;
+    std::unique_ptr<TraceEvent[]> events;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::int64_t startTime = 0;
+};
+
+/**
+  The registry of thread buffers
+  Never destroyed, so threads still running at exit can keep recording
+  @return the registry
+*/
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+thread_local ThreadBuffer* localBuffer = nullptr;
+
+/**
+  The calling thread's buffer, created on first use
+  @return the buffer
+*/
+ThreadBuffer& threadBuffer() {
+    if (localBuffer == nullptr) {
+        std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+        buffer->count.store(0, std::memory_order_relaxed);
+        buffer->dropped.store(0, std::memory_order_relaxed);
+        buffer->events.reset(new TraceEvent[TRACE_BUFFER_EVENTS]);
+
+        Registry& state = registry();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        buffer->tid = (unsigned) state.buffers.size() + 1;
+        localBuffer = buffer.get();
+        state.buffers.push_back(std::move(buffer));
+    }
+    return *localBuffer;
+}
+
+/**
+  Writes a string as a JSON string literal
+  @param out: destination
+  @param text: the string
+  @return none
+*/
+void writeJsonString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if ((unsigned char) c < 0x20)
+            out << ' ';
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+}
+
+/**
+  Turns tracing on, timestamps are relative to the first call
+  @return none
+*/
+void AESTrace::start() {
+    Registry& state = registry();
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.startTime == 0)
+            state.startTime = now();
+    }
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+/**
+  Names the calling thread in the trace
+  @param name: the thread's name
+  @return none
+*/
+void AESTrace::nameThread(const char* name) {
+    if (!active())
+        return;
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    buffer.name = name;
+}
+
+/**
+  Records a complete span on the calling thread, dropping it if the thread's buffer is full
+  @param name: span name, a string literal
+  @param begin: start time from now()
+  @param end: end time from now()
+  @param argName: name of the span's argument, a string literal, or nullptr for none
+  @param arg: value of the argument
+  @return none
+*/
+void AESTrace::record(const char* name, std::int64_t begin, std::int64_t end, const char* argName, std::int64_t arg) {
+    ThreadBuffer& buffer = threadBuffer();
+    const std::size_t count = buffer.count.load(std::memory_order_relaxed);
+    if (count >= TRACE_BUFFER_EVENTS) {
+        buffer.dropped.store(buffer.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    TraceEvent& event = buffer.events[count];
+    event.name = name;
+    event.argName = argName;
+    event.begin = begin;
+    event.end = end;
+    event.arg = arg;
+    buffer.count.store(count + 1, std::memory_order_release);
+}
+
+/**
+  Writes the spans recorded so far as Chrome trace event JSON
+  Threads may keep recording, spans they publish after this point are left out
+  @param path: file to write
+  @return True on success
+*/
+bool AESTrace::writeFile(const std::string& path) {
+    std::ofstream out(path);
+    Registry& state = registry();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    const long pid = (long) getpid();
+    std::uint64_t dropped = 0;
+
+    out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    bool first = true;
+    for (const std::unique_ptr<ThreadBuffer>& buffer : state.buffers) {
+        if (!buffer->name.empty()) {
+            out << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+                << ", \"tid\": " << buffer->tid << ", \"args\": {\"name\": ";
+            writeJsonString(out, buffer->name);
+            out << "}}";
+            first = false;
+        }
+
+        const std::size_t count = buffer->count.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; i++) {
+            const TraceEvent& event = buffer->events[i];
+            out << (first ? "\n" : ",\n") << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": " << pid
+                << ", \"tid\": " << buffer->tid << ", \"ts\": " << (event.begin - state.startTime) / 1000.0
+                << ", \"dur\": " << (event.end - event.begin) / 1000.0;
+            if (event.argName != nullptr)
+                out << ", \"args\": {\"" << event.argName << "\": " << event.arg << "}";
+            out << "}";
+            first = false;
+        }
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+    out << "\n], \"otherData\": {\"dropped_spans\": " << dropped << "}}\n";
+    return out.good();
+}
@@ -0,0 +1,65 @@
+/**
+  @file AESTrace.hpp: Span tracing in the Chrome trace event format
+  Tracing is off until AESTrace::start() is called, and a span then costs one relaxed load when off.
+*/
+#ifndef AES_TRACE_HPP
+#define AES_TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Spans kept per thread, later ones are dropped and counted
+#define TRACE_BUFFER_EVENTS 65536
+
+
+//AESTrace class
+class AESTrace {
+public:
+    static void start();
+
+    static bool writeFile(const std::string& path);
+
+    static void nameThread(const char* name);
+
+    static bool active() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static std::int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void record(const char* name, std::int64_t begin, std::int64_t end, const char* argName, std::int64_t arg);
+
+    //Records the time from construction to destruction as a complete event, if tracing was on at construction
+    //The names must be string literals, they are kept as pointers
+    class Span {
+    public:
+        explicit Span(const char* name, const char* argName = nullptr, std::int64_t arg = 0)
+                : name(name), argName(argName), arg(arg), begin(active() ? now() : 0) {}
+
+        ~Span() {
+            if (this->begin != 0)
+                record(this->name, this->begin, now(), this->argName, this->arg);
+        }
+
+        Span(const Span&) = delete;
+
+        Span& operator=(const Span&) = delete;
+
+    private:
+        const char* name;
+        const char* argName;
+        std::int64_t arg;
+        std::int64_t begin;
+    };
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+
+#endif //AES_TRACE_HPP
@@ -1,15 +1,25 @@
 /**
   @file AESmath.cpp: Math and common functions to encryption and decryption
 */
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include "AESmath.hpp"
+#include "AESStats.hpp"
+#include "AESTrace.hpp"
 
 // From Appendix A of the AES spec
 // This is the first byte of the rcon word array which is x^(i-1) in GF(2^8)
 std::array<unsigned char, 11> rcon1_i_bytes = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36 };
 
+// Lookup used by getSboxValue() and invGetSboxValue()
+static std::atomic<SboxBackend> sboxBackend(SBOX_TABLE);
+
 
 /**
   Multiplies a by b in GF(2^8) 
+  Uses masks instead of branching on the bits of either operand, so mixColumns() and invMixColumns(),
+  which multiply state bytes, take the same time whatever the state is
   @param a: the first polynomial
   @param b: the second polynomial
   @return a * b in GF(2^8)
@@ -17,15 +27,11 @@ std::array<unsigned char, 11> rcon1_i_bytes = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x
 unsigned char galoisFieldMult(unsigned char a, unsigned char b) {
 	unsigned char product = 0;
 	for (unsigned char i = 0; i < 8; i++) {
-		if ((b & 1) == 1) {
-			product ^= a;
-		}
+		//Add a when the low bit of b is set
+		product ^= a & (unsigned char) (0 - (b & 1));
 
-		unsigned char aHighBit = a & 0x80;
-		a = a << 1;
-		if (aHighBit) {
-			a ^= 0x1b;
-		}
+		//Multiply a by x, reducing by the polynomial when the high bit shifts out
+		a = (unsigned char) ((a << 1) ^ (0x1b & (0 - (a >> 7))));
 
 		b = b >> 1;
 	}
@@ -63,6 +69,9 @@ unsigned char galoisFieldInv(unsigned char a) {
   @return none
 */
 void keyExpansion(const std::vector<unsigned char>& key, std::vector<unsigned char>&  expansion, unsigned char keysize) {
+	AES_STAT_ADD(STAT_KEY_EXPANSIONS, 1);
+	AES_STAT_TIMER(timer, STAT_NS_KEY_SETUP);
+	AESTrace::Span span("key setup", "bytes", keysize);
 	int Nk = keysize / 4;
 	int Nr = (Nk + 6);
 
@@ -121,7 +130,7 @@ void keyExpansion(const std::vector<unsigned char>& key, std::vector<unsigned ch
   @param key: vector of hex values representing the key
   @return none
 */
-void addRoundKey(std::array<unsigned char, 16>& state, unsigned char* key) {
+void addRoundKey(std::array<unsigned char, 16>& state, const unsigned char* key) {
 	for (std::size_t i = 0; i < NUM_BYTES; i++) {
 		state[i] = state[i] ^ key[i];
 	}
@@ -129,11 +138,11 @@ void addRoundKey(std::array<unsigned char, 16>& state, unsigned char* key) {
 
 
 /**
-  Computes inverse sbox value.
+  Computes sbox value from the field inverse and the affine transformation.
   @param index: byte of state array whose value to compute
-  @return inverse sbox value of index
+  @return sbox value of index
 */
-unsigned char getSboxValue(unsigned char index) {
+static unsigned char computeSboxValue(unsigned char index) {
 	unsigned char inv = galoisFieldInv(index);
 	unsigned char matRow = 0xF1; // 11110001
 	unsigned char out = 0;
@@ -162,7 +171,7 @@ unsigned char getSboxValue(unsigned char index) {
   @param index: byte of state array whose value to compute
   @return inverse sbox value of index
 */
-unsigned char invGetSboxValue(unsigned char index) {
+static unsigned char computeInvSboxValue(unsigned char index) {
   unsigned char matRow = 0xA4; // 10100100
   unsigned char out = 0;
 
@@ -185,3 +194,203 @@ unsigned char invGetSboxValue(unsigned char index) {
 
   return galoisFieldInv(out);
 }
+
+
+/**
+  Builds a 256 entry lookup table from one of the sbox computations.
+  @param compute: function computing a single sbox entry
+  @return table of every sbox value
+*/
+static std::array<unsigned char, 256> buildSboxTable(unsigned char (*compute)(unsigned char)) {
+	std::array<unsigned char, 256> table;
+	for (int i = 0; i < 256; i++) {
+		table[i] = compute((unsigned char) i);
+	}
+	return table;
+}
+
+
+/**
+  Reads a table entry by touching every entry, so the memory accesses and the time taken do not depend
+  on the index, unlike an indexed load whose cache line reveals the index to a cache timing attack.
+  @param table: sbox or inverse sbox
+  @param index: entry to read
+  @return table[index]
+*/
+static unsigned char constantTimeLookup(const std::array<unsigned char, 256>& table, unsigned char index) {
+	unsigned char value = 0;
+	for (unsigned i = 0; i < 256; i++) {
+		// (difference - 1) >> 8 has its low byte set only when the difference is zero
+		const unsigned difference = i ^ index;
+		value |= table[i] & (unsigned char) ((difference - 1) >> 8);
+	}
+	return value;
+}
+
+
+/**
+  The sbox table, computed once on first use since each computation takes 253 field multiplications.
+  @return table of every sbox value
+*/
+static const std::array<unsigned char, 256>& sboxTable() {
+	static const std::array<unsigned char, 256> sbox = buildSboxTable(computeSboxValue);
+	return sbox;
+}
+
+
+/**
+  Looks up the sbox value.
+  @param index: byte of state array whose value to compute
+  @return sbox value of index
+*/
+unsigned char getSboxValue(unsigned char index) {
+	const std::array<unsigned char, 256>& sbox = sboxTable();
+	if (sboxBackend.load(std::memory_order_relaxed) == SBOX_CONSTANT_TIME)
+		return constantTimeLookup(sbox, index);
+	return sbox[index];
+}
+
+
+/**
+  Looks up the inverse sbox value.
+  @param index: byte of state array whose value to compute
+  @return inverse sbox value of index
+*/
+unsigned char invGetSboxValue(unsigned char index) {
+	static const std::array<unsigned char, 256> invSbox = buildSboxTable(computeInvSboxValue);
+	if (sboxBackend.load(std::memory_order_relaxed) == SBOX_CONSTANT_TIME)
+		return constantTimeLookup(invSbox, index);
+	return invSbox[index];
+}
+
+
+/**
+  Selects how sbox values are looked up, for every thread
+  @param backend: SBOX_TABLE or SBOX_CONSTANT_TIME
+  @return none
+*/
+void setSboxBackend(SboxBackend backend) {
+	sboxBackend.store(backend, std::memory_order_relaxed);
+}
+
+
+/**
+  The current sbox lookup
+  @return the backend in use
+*/
+SboxBackend getSboxBackend() {
+	return sboxBackend.load(std::memory_order_relaxed);
+}
+
+
+/**
+  Applies the sbox to each byte of a word from every lane of a key expansion batch
+  With the constant-time lookup one scan of the table serves all the bytes, instead of one scan per byte.
+  @param words: KEY_EXPANSION_BATCH words to substitute in place
+  @return none
+*/
+static void subWordBatch(std::uint32_t* words) {
+	const std::array<unsigned char, 256>& sbox = sboxTable();
+	if (sboxBackend.load(std::memory_order_relaxed) == SBOX_CONSTANT_TIME) {
+		std::uint32_t values[KEY_EXPANSION_BATCH] = {0};
+		for (std::uint32_t i = 0; i < 256; i++) {
+			// The entry repeated in every byte, picked out for each byte that equals i
+			const std::uint32_t entry = sbox[i] * 0x01010101u;
+			const std::uint32_t pattern = i * 0x01010101u;
+			for (std::size_t l = 0; l < KEY_EXPANSION_BATCH; l++) {
+				// Each byte of difference is zero where the word's byte equals i, then becomes 0xFF
+				const std::uint32_t difference = words[l] ^ pattern;
+				std::uint32_t zero = ~difference;
+				zero &= zero >> 4;
+				zero &= zero >> 2;
+				zero &= zero >> 1;
+				values[l] |= entry & ((zero & 0x01010101u) * 0xFF);
+			}
+		}
+		std::copy(values, values + KEY_EXPANSION_BATCH, words);
+		return;
+	}
+
+	for (std::size_t l = 0; l < KEY_EXPANSION_BATCH; l++) {
+		const std::uint32_t word = words[l];
+		words[l] = (std::uint32_t) sbox[word & 0xFF] | (std::uint32_t) sbox[(word >> 8) & 0xFF] << 8 |
+		           (std::uint32_t) sbox[(word >> 16) & 0xFF] << 16 | (std::uint32_t) sbox[word >> 24] << 24;
+	}
+}
+
+
+/**
+  Computes the AES key expansion of many keys of the same size at once
+  Up to KEY_EXPANSION_BATCH keys are expanded in lockstep with their words interleaved, so every step of
+  the schedule is one loop across the keys that the compiler can vectorize, and their sbox lookups are
+  independent of each other. Gives the same schedules as keyExpansion() on each key.
+  @param keys: the input keys, each keysize bytes
+  @param expansions: resized to one schedule per key, each 16 * (keysize/4 + 7) bytes
+  @param keysize: the size of every key in bytes
+  				  Note: the key should be 16, 24, or 32 bytes large
+  @return none
+*/
+void keyExpansionBatch(const std::vector<std::vector<unsigned char>>& keys,
+                       std::vector<std::vector<unsigned char>>& expansions, unsigned char keysize) {
+	AES_STAT_ADD(STAT_KEY_EXPANSIONS, keys.size());
+	AES_STAT_TIMER(timer, STAT_NS_KEY_SETUP);
+	AESTrace::Span span("key setup", "keys", (std::int64_t) keys.size());
+	const std::size_t Nk = keysize / 4;
+	const std::size_t Nr = Nk + 6;
+	const std::size_t numWords = 4 * (Nr + 1);
+	expansions.resize(keys.size());
+
+	// Word i of lane l is words[i][l], with its first byte in the low 8 bits
+	std::uint32_t words[60][KEY_EXPANSION_BATCH];
+	std::uint32_t temp[KEY_EXPANSION_BATCH];
+
+	for (std::size_t first = 0; first < keys.size(); first += KEY_EXPANSION_BATCH) {
+		// Lanes past the last key expand zeros and are thrown away
+		const std::size_t lanes = std::min<std::size_t>(KEY_EXPANSION_BATCH, keys.size() - first);
+		for (std::size_t i = 0; i < Nk; i++) {
+			for (std::size_t l = 0; l < KEY_EXPANSION_BATCH; l++) {
+				const unsigned char* key = (l < lanes) ? keys[first + l].data() + 4 * i : nullptr;
+				words[i][l] = (key == nullptr) ? 0 : (std::uint32_t) key[0] | (std::uint32_t) key[1] << 8 |
+				                                     (std::uint32_t) key[2] << 16 | (std::uint32_t) key[3] << 24;
+			}
+		}
+
+		for (std::size_t i = Nk; i < numWords; i++) {
+			std::copy(words[i - 1], words[i - 1] + KEY_EXPANSION_BATCH, temp);
+			if (i % Nk == 0) {
+				//ROTWORD, SUBWORD and Xor with Rcon[i/Nk], which only changes the first byte
+				for (std::size_t l = 0; l < KEY_EXPANSION_BATCH; l++) {
+					temp[l] = (temp[l] >> 8) | (temp[l] << 24);
+				}
+				subWordBatch(temp);
+				for (std::size_t l = 0; l < KEY_EXPANSION_BATCH; l++) {
+					temp[l] ^= rcon1_i_bytes[(i / Nk) - 1];
+				}
+			}
+			else if (Nk > 6 && i % Nk == 4) {
+				//SUBWORD
+				subWordBatch(temp);
+			}
+
+			//w[i] = w[i-Nk] xor temp
+			for (std::size_t l = 0; l < KEY_EXPANSION_BATCH; l++) {
+				words[i][l] = words[i - Nk][l] ^ temp[l];
+			}
+		}
+
+		for (std::size_t l = 0; l < lanes; l++) {
+			std::vector<unsigned char>& expansion = expansions[first + l];
+			expansion.resize(4 * numWords);
+			for (std::size_t i = 0; i < numWords; i++) {
+				const std::uint32_t word = words[i][l];
+				expansion[4 * i] = (unsigned char) word;
+				expansion[4 * i + 1] = (unsigned char) (word >> 8);
+				expansion[4 * i + 2] = (unsigned char) (word >> 16);
+				expansion[4 * i + 3] = (unsigned char) (word >> 24);
+			}
+		}
+	}
+
+	std::fill(&words[0][0], &words[0][0] + 60 * KEY_EXPANSION_BATCH, 0u);
+	std::fill(temp, temp + KEY_EXPANSION_BATCH, 0u);
+}
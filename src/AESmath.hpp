@@ -9,12 +9,21 @@
 
 // State size
 #define NUM_BYTES 16
+// Keys expanded in lockstep by keyExpansionBatch()
+#define KEY_EXPANSION_BATCH 16
+
+// Sbox lookups: an indexed table, or a scan of the whole table that does not depend on the index
+enum SboxBackend { SBOX_TABLE, SBOX_CONSTANT_TIME, SBOX_INVALID };
 
 unsigned char galoisFieldMult(unsigned char a, unsigned char b);
 unsigned char galoisFieldInv(unsigned char a);
 unsigned char getSboxValue(unsigned char index);
 unsigned char invGetSboxValue(unsigned char index);
 void keyExpansion(const std::vector<unsigned char>& key, std::vector<unsigned char>&  expansion, unsigned char keysize);
-void addRoundKey(std::array<unsigned char, 16>& state, unsigned char* key);
+void keyExpansionBatch(const std::vector<std::vector<unsigned char>>& keys,
+                       std::vector<std::vector<unsigned char>>& expansions, unsigned char keysize);
+void addRoundKey(std::array<unsigned char, 16>& state, const unsigned char* key);
+void setSboxBackend(SboxBackend backend);
+SboxBackend getSboxBackend();
 
 #endif
\ No newline at end of file
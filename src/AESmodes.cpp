@@ -3,23 +3,54 @@
   Implementation of modes of operation for AES-128
 */
 #include "AESmodes.hpp"
+#include "AESStats.hpp"
 #include <iostream>
+#include <algorithm>
 
-bool remove_padding(std::vector<unsigned char> &input) noexcept(false) {
-    const int lastByte = (int) input.back();
-    //Only continue if the last byte is in the valid range
-    if (lastByte <= NUM_BYTES && lastByte > 0) {
-        //Verify that the padding is okay
-        for (std::size_t i = 0; i < lastByte; i++) {
-            if (input.at(input.size() - i - 1) != lastByte)
-                //Do nothing and return
-                return false;
-        }
-        input.erase(input.end() - lastByte, input.end());
-        return true;
+/**
+  Counts a message processed by one of the mode functions
+  @param mode: mode of operation
+  @param encrypting: true for encryption, false for decryption
+  @param inputSize: number of bytes of input
+  @param outputSize: number of bytes of output
+  @return none
+*/
+static inline void countMessage(AESMode mode, bool encrypting, std::size_t inputSize, std::size_t outputSize) {
+    AES_STAT_ADD(STAT_BYTES_IN, inputSize);
+    AES_STAT_ADD(STAT_BYTES_OUT, outputSize);
+    AES_STAT_ADD(AESStats::blocks(mode, encrypting), (std::max(inputSize, outputSize) + NUM_BYTES - 1) / NUM_BYTES);
+}
+
+/**
+  Checks PKCS#7 padding and finds the length of the message without it, in constant time
+  All NUM_BYTES bytes of the last block are examined with masks instead of branches, whatever the
+  padding byte is, so the time taken does not depend on whether the padding is valid. The data is
+  not modified, callers shrink their buffer to the returned length.
+  @param data: decrypted message
+  @param length: number of bytes of data, at least NUM_BYTES
+  @param unpaddedLength: set to the length without padding, or 0 if the padding is invalid
+  @return True if the padding is valid
+*/
+bool unpadded_length(const unsigned char *data, std::size_t length, std::size_t &unpaddedLength) noexcept(true) {
+    unpaddedLength = 0;
+    if (length < NUM_BYTES)
+        return false;
+
+    const unsigned char *block = data + length - NUM_BYTES;
+    const unsigned int pad = block[NUM_BYTES - 1];
+    // Nonzero if the padding byte is 0 or more than NUM_BYTES
+    unsigned int bad = ((pad - 1) >> 8) | ((NUM_BYTES - pad) >> 8);
+    for (unsigned int i = 0; i < NUM_BYTES; i++) {
+        // All ones for the last pad bytes of the block
+        const unsigned int inPadding = 0u - ((NUM_BYTES - 1 - i - pad) >> 31);
+        bad |= inPadding & (block[i] ^ pad);
     }
-    //If an improper padding value was given, also do nothing
-    return false;
+
+    // bad is below 2^24, so this is 1 only when it is zero
+    const unsigned int valid = (bad - 1) >> 31;
+    AES_STAT_ADD(STAT_PADDING_FAILURES, valid ^ 1);
+    unpaddedLength = (length - pad) & (0 - (std::size_t) valid);
+    return valid != 0;
 }
 
 /**
@@ -39,6 +70,7 @@ bool remove_padding(std::vector<unsigned char> &input) noexcept(false) {
 bool encrypt_ecb(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key) noexcept(true) {
     try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
         // Calculate padding length, then copy input array and padding into plaintext
         
         const std::size_t inputSize = input.size();
@@ -86,6 +118,7 @@ bool encrypt_ecb(const std::vector<unsigned char> &input, std::vector<unsigned c
         output.clear();
         return false;
     }
+    countMessage(MODE_ECB, true, input.size(), output.size());
     return true;
 }
 
@@ -107,6 +140,7 @@ bool encrypt_ecb(const std::vector<unsigned char> &input, std::vector<unsigned c
 bool decrypt_ecb(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key) noexcept(true) {
     try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
         const std::size_t inputSize = input.size();
 
         // Loop over number of blocks
@@ -130,12 +164,14 @@ bool decrypt_ecb(const std::vector<unsigned char> &input, std::vector<unsigned c
             }
         }
 
-        if (!remove_padding(output)) {
+        std::size_t plaintextLength = 0;
+        if (!unpadded_length(output.data(), output.size(), plaintextLength)) {
             std::cout << "Decryption Error" << std::endl;
             //Erase the output to avoid any other information leaking
             output.clear();
             return false;
         }
+        output.resize(plaintextLength);
 
     } catch (std::exception &e) {
         //Catch exception by lvalue or reference per ERR61-CPP
@@ -144,6 +180,7 @@ bool decrypt_ecb(const std::vector<unsigned char> &input, std::vector<unsigned c
         return false;
     }
 
+    countMessage(MODE_ECB, false, input.size(), output.size());
     return true;
 
 }
@@ -167,6 +204,7 @@ bool decrypt_ecb(const std::vector<unsigned char> &input, std::vector<unsigned c
 bool encrypt_cbc(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true) {
     try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
         // Calculate padding length, then copy input array and padding into plaintext
         const std::size_t inputSize = input.size();
         const std::size_t padLength = NUM_BYTES - (inputSize % NUM_BYTES);
@@ -223,6 +261,7 @@ bool encrypt_cbc(const std::vector<unsigned char> &input, std::vector<unsigned c
         output.clear();
         return false;
     }
+    countMessage(MODE_CBC, true, input.size(), output.size());
     return true;
 }
 
@@ -245,6 +284,7 @@ bool encrypt_cbc(const std::vector<unsigned char> &input, std::vector<unsigned c
 bool decrypt_cbc(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true) {
     try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
         const std::size_t inputSize = input.size();
 
         // Decrypt the first block
@@ -285,12 +325,14 @@ bool decrypt_cbc(const std::vector<unsigned char> &input, std::vector<unsigned c
 
 
         // Remove padding
-        if (!remove_padding(output)) {
+        std::size_t plaintextLength = 0;
+        if (!unpadded_length(output.data(), output.size(), plaintextLength)) {
             std::cout << "Decryption Error" << std::endl;
             //Erase the output to avoid any other information leaking
             output.clear();
             return false;
         }
+        output.resize(plaintextLength);
 
     } catch (std::exception &e) {
         //Catch exception by lvalue or reference per ERR61-CPP
@@ -298,6 +340,7 @@ bool decrypt_cbc(const std::vector<unsigned char> &input, std::vector<unsigned c
         output.clear();
         return false;
     }
+    countMessage(MODE_CBC, false, input.size(), output.size());
     return true;
 
 }
@@ -339,6 +382,7 @@ bool encrypt_ctr(const std::vector<unsigned char> &input, std::vector<unsigned c
                  const std::vector<unsigned char> &key,
                  const std::array<unsigned char, NUM_BYTES / 2> &nonce) noexcept(true) {
     try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
         // Calculate padding length, then copy input array and padding into plaintext
         const std::size_t inputSize = input.size();
         const std::size_t padLength = NUM_BYTES - (inputSize % NUM_BYTES);
@@ -380,6 +424,7 @@ bool encrypt_ctr(const std::vector<unsigned char> &input, std::vector<unsigned c
         output.clear();
         return false;
     }
+    countMessage(MODE_CTR, true, input.size(), output.size());
     return true;
 
 }
@@ -403,6 +448,7 @@ bool decrypt_ctr(const std::vector<unsigned char> &input, std::vector<unsigned c
                  const std::vector<unsigned char> &key,
                  const std::array<unsigned char, NUM_BYTES / 2> &nonce) noexcept(true) {
     try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
 
         const std::size_t inputSize = input.size();
 
@@ -429,12 +475,14 @@ bool decrypt_ctr(const std::vector<unsigned char> &input, std::vector<unsigned c
         }
 
         // Remove padding
-        if (!remove_padding(output)) {
+        std::size_t plaintextLength = 0;
+        if (!unpadded_length(output.data(), output.size(), plaintextLength)) {
             std::cout << "Decryption Error" << std::endl;
             //Erase the output to avoid any other information leaking
             output.clear();
             return false;
         }
+        output.resize(plaintextLength);
 
     } catch (std::exception &e) {
         //Catch exception by lvalue or reference per ERR61-CPP
@@ -442,6 +490,7 @@ bool decrypt_ctr(const std::vector<unsigned char> &input, std::vector<unsigned c
         output.clear();
         return false;
     }
+    countMessage(MODE_CTR, false, input.size(), output.size());
     return true;
 }
 
@@ -463,6 +512,7 @@ bool decrypt_ctr(const std::vector<unsigned char> &input, std::vector<unsigned c
 bool encrypt_cfb(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true) {
     try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
 
         // Calculate padding length, then copy input array and padding into plaintext
         const std::size_t inputSize = input.size();
@@ -516,6 +566,7 @@ bool encrypt_cfb(const std::vector<unsigned char> &input, std::vector<unsigned c
         output.clear();
         return false;
     }
+    countMessage(MODE_CFB, true, input.size(), output.size());
     return true;
 }
 
@@ -537,6 +588,7 @@ bool encrypt_cfb(const std::vector<unsigned char> &input, std::vector<unsigned c
 bool decrypt_cfb(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true) {
     try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
         const std::size_t inputSize = input.size();
 
         // Encrypt the first block
@@ -571,12 +623,14 @@ bool decrypt_cfb(const std::vector<unsigned char> &input, std::vector<unsigned c
             }
         }
         // Remove padding
-        if (!remove_padding(output)) {
+        std::size_t plaintextLength = 0;
+        if (!unpadded_length(output.data(), output.size(), plaintextLength)) {
             std::cout << "Decryption Error" << std::endl;
             //Erase the output to avoid any other information leaking
             output.clear();
             return false;
         }
+        output.resize(plaintextLength);
 
     } catch (std::exception &e) {
         //Catch exception by lvalue or reference per ERR61-CPP
@@ -584,6 +638,7 @@ bool decrypt_cfb(const std::vector<unsigned char> &input, std::vector<unsigned c
         output.clear();
         return false;
     }
+    countMessage(MODE_CFB, false, input.size(), output.size());
     return true;
 }
 
@@ -605,6 +660,7 @@ bool decrypt_cfb(const std::vector<unsigned char> &input, std::vector<unsigned c
 bool encrypt_ofb(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true) {
     try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
         // Calculate padding length, then copy input array and padding into plaintext
         const std::size_t inputSize = input.size();
         const std::size_t padLength = NUM_BYTES - (inputSize % NUM_BYTES);
@@ -659,6 +715,7 @@ bool encrypt_ofb(const std::vector<unsigned char> &input, std::vector<unsigned c
 
         return false;
     }
+    countMessage(MODE_OFB, true, input.size(), output.size());
     return true;
 }
 
@@ -680,6 +737,7 @@ bool encrypt_ofb(const std::vector<unsigned char> &input, std::vector<unsigned c
 bool decrypt_ofb(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true) {
     try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
 
         const std::size_t inputSize = input.size();
 
@@ -715,12 +773,14 @@ bool decrypt_ofb(const std::vector<unsigned char> &input, std::vector<unsigned c
             }
         }
         // Remove padding
-        if (!remove_padding(output)) {
+        std::size_t plaintextLength = 0;
+        if (!unpadded_length(output.data(), output.size(), plaintextLength)) {
             std::cout << "Decryption Error" << std::endl;
             //Erase the output to avoid any other information leaking
             output.clear();
             return false;
         }
+        output.resize(plaintextLength);
     } catch (std::exception &e) {
         //Catch exception by lvalue or reference per ERR61-CPP
         std::cout << "Decryption Error" << std::endl;
@@ -728,5 +788,397 @@ bool decrypt_ofb(const std::vector<unsigned char> &input, std::vector<unsigned c
         return false;
     }
 
+    countMessage(MODE_OFB, false, input.size(), output.size());
     return true;
 }
+
+/**
+  Cipher with CBC mode using ciphertext stealing (CBC-CS3, NIST SP 800-38A Addendum)
+  The final partial block is zero-filled for encryption and the last two ciphertext blocks are swapped,
+  with the penultimate block truncated, so no padding is added and the ciphertext has the same length as the input
+    Guaranteed no exceptions by:
+    handling all exceptions per ERR51-CPP
+        Related: Honoring exception specifications, all exceptions will be caught per ERR55-CPP
+    not throwing exceptions across execution boundaries (library to application) per ERR59-CPP
+    Guaranteeing Strong exception safety per ERR56-CPP
+        Program state will not be modified
+            Input, key, and IV are constant and output vector is cleared when catching an exception
+  @param input: vector of hex values representing plaintext, at least NUM_BYTES (16) bytes long
+  @param output: vector of hex values representing ciphertext (same length as input)
+  @param key: vector of hex values representing key to use
+  @param IV: initialization vector to use
+  @return True on success
+*/
+bool encrypt_cbc_cs3(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
+                     const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true) {
+    try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
+        const std::size_t inputSize = input.size();
+
+        // Ciphertext stealing needs at least one full block
+        if (inputSize < NUM_BYTES) {
+            std::cout << "Encryption Error" << std::endl;
+            output.clear();
+            return false;
+        }
+
+        const std::size_t numBlocks = (inputSize + NUM_BYTES - 1) / NUM_BYTES;
+        // Number of bytes in the final (possibly partial) block
+        const std::size_t lastLength = inputSize - ((numBlocks - 1) * NUM_BYTES);
+
+        std::array<unsigned char, NUM_BYTES> block{0};
+        std::array<unsigned char, NUM_BYTES> outputBlock{0};
+        std::array<unsigned char, NUM_BYTES> previous{0};
+        std::copy(IV.begin(), IV.end(), previous.begin());
+
+        // Encrypt all blocks before the last two with regular CBC
+        for (std::size_t i = 0; i + 2 < numBlocks; i++) {
+            for (std::size_t j = 0; j < NUM_BYTES; j++) {
+                block.at(j) = input.at(j + (i * NUM_BYTES)) ^ previous.at(j);
+            }
+
+            encrypt(block, outputBlock, key);
+
+            for (std::size_t j = 0; j < NUM_BYTES; j++) {
+                output.push_back(outputBlock.at(j));
+            }
+            previous = outputBlock;
+        }
+
+        // A single block message is plain CBC
+        if (numBlocks == 1) {
+            for (std::size_t j = 0; j < NUM_BYTES; j++) {
+                block.at(j) = input.at(j) ^ previous.at(j);
+            }
+
+            encrypt(block, outputBlock, key);
+
+            for (std::size_t j = 0; j < NUM_BYTES; j++) {
+                output.push_back(outputBlock.at(j));
+            }
+            countMessage(MODE_CTS, true, input.size(), output.size());
+            return true;
+        }
+
+        // Encrypt the penultimate block
+        const std::size_t penultimate = (numBlocks - 2) * NUM_BYTES;
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            block.at(j) = input.at(penultimate + j) ^ previous.at(j);
+        }
+
+        std::array<unsigned char, NUM_BYTES> stolenBlock{0};
+        encrypt(block, stolenBlock, key);
+
+        // Encrypt the zero-filled last block chained on the penultimate ciphertext
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            unsigned char plainByte = (j < lastLength) ? input.at(penultimate + NUM_BYTES + j) : 0;
+            block.at(j) = plainByte ^ stolenBlock.at(j);
+        }
+
+        encrypt(block, outputBlock, key);
+
+        // CS3 always swaps the last two blocks, then truncates the penultimate ciphertext
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            output.push_back(outputBlock.at(j));
+        }
+        for (std::size_t j = 0; j < lastLength; j++) {
+            output.push_back(stolenBlock.at(j));
+        }
+
+    } catch (std::exception &e) {
+        //Catch exception by lvalue or reference per ERR61-CPP
+        std::cout << "Encryption Error" << std::endl;
+        output.clear();
+        return false;
+    }
+    countMessage(MODE_CTS, true, input.size(), output.size());
+    return true;
+}
+
+/**
+  Inverse cipher with CBC mode using ciphertext stealing (CBC-CS3, NIST SP 800-38A Addendum)
+    Guaranteed no exceptions by:
+    handling all exceptions per ERR51-CPP
+        Related: Honoring exception specifications, all exceptions will be caught per ERR55-CPP
+    not throwing exceptions across execution boundaries (library to application) per ERR59-CPP
+    Guaranteeing Strong exception safety per ERR56-CPP
+        Program state will not be modified
+            Input, key, and IV are constant and output vector is cleared when catching an exception
+  @param input: vector of hex values representing ciphertext, at least NUM_BYTES (16) bytes long
+  @param output: vector of hex values representing plaintext (same length as input)
+  @param key: vector of hex values representing key to use
+  @param IV: initialization vector to use
+  @return True on success
+*/
+bool decrypt_cbc_cs3(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
+                     const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true) {
+    try {
+        AES_STAT_TIMER(timer, STAT_NS_CIPHER);
+        const std::size_t inputSize = input.size();
+
+        if (inputSize < NUM_BYTES) {
+            std::cout << "Decryption Error" << std::endl;
+            output.clear();
+            return false;
+        }
+
+        const std::size_t numBlocks = (inputSize + NUM_BYTES - 1) / NUM_BYTES;
+        const std::size_t lastLength = inputSize - ((numBlocks - 1) * NUM_BYTES);
+
+        std::array<unsigned char, NUM_BYTES> block{0};
+        std::array<unsigned char, NUM_BYTES> outputBlock{0};
+        std::array<unsigned char, NUM_BYTES> previous{0};
+        std::copy(IV.begin(), IV.end(), previous.begin());
+
+        // Decrypt all blocks before the last two with regular CBC
+        for (std::size_t i = 0; i + 2 < numBlocks; i++) {
+            for (std::size_t j = 0; j < NUM_BYTES; j++) {
+                block.at(j) = input.at(j + (i * NUM_BYTES));
+            }
+
+            decrypt(block, outputBlock, key);
+
+            for (std::size_t j = 0; j < NUM_BYTES; j++) {
+                output.push_back(outputBlock.at(j) ^ previous.at(j));
+            }
+            previous = block;
+        }
+
+        // A single block message is plain CBC
+        if (numBlocks == 1) {
+            for (std::size_t j = 0; j < NUM_BYTES; j++) {
+                block.at(j) = input.at(j);
+            }
+
+            decrypt(block, outputBlock, key);
+
+            for (std::size_t j = 0; j < NUM_BYTES; j++) {
+                output.push_back(outputBlock.at(j) ^ previous.at(j));
+            }
+            countMessage(MODE_CTS, false, input.size(), output.size());
+            return true;
+        }
+
+        // The full block in the penultimate position is the encryption of the final block
+        const std::size_t penultimate = (numBlocks - 2) * NUM_BYTES;
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            block.at(j) = input.at(penultimate + j);
+        }
+
+        std::array<unsigned char, NUM_BYTES> lastDecrypted{0};
+        decrypt(block, lastDecrypted, key);
+
+        // Rebuild the stolen ciphertext block from the truncated tail and the decrypted final block
+        std::array<unsigned char, NUM_BYTES> stolenBlock{0};
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            stolenBlock.at(j) = (j < lastLength) ? input.at(penultimate + NUM_BYTES + j) : lastDecrypted.at(j);
+        }
+
+        decrypt(stolenBlock, outputBlock, key);
+
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            output.push_back(outputBlock.at(j) ^ previous.at(j));
+        }
+        for (std::size_t j = 0; j < lastLength; j++) {
+            output.push_back(lastDecrypted.at(j) ^ stolenBlock.at(j));
+        }
+
+    } catch (std::exception &e) {
+        //Catch exception by lvalue or reference per ERR61-CPP
+        std::cout << "Decryption Error" << std::endl;
+        output.clear();
+        return false;
+    }
+    countMessage(MODE_CTS, false, input.size(), output.size());
+    return true;
+}
+
+/**
+  Block level mode kernels
+  These process whole blocks without padding, using a key already expanded with keyExpansion(),
+  and carry the chaining value between calls so long inputs can be processed in chunks.
+  Input and output may point to the same buffer.
+  The chaining value is the previous ciphertext block for CBC and CFB, the previous keystream block for OFB,
+  and the counter block for CTR. Start it with the IV, or the nonce followed by zeros for CTR.
+*/
+
+/**
+  Encrypts whole blocks with ECB mode
+  @param input: numBlocks * NUM_BYTES bytes of plaintext
+  @param output: numBlocks * NUM_BYTES bytes of ciphertext
+  @param numBlocks: number of blocks to process
+  @param expandedKey: key schedule from keyExpansion()
+  @return none
+*/
+void encrypt_ecb_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey) noexcept(false) {
+    std::array<unsigned char, NUM_BYTES> block{0};
+    std::array<unsigned char, NUM_BYTES> outputBlock{0};
+
+    for (std::size_t i = 0; i < numBlocks; i++) {
+        std::copy(input + (i * NUM_BYTES), input + ((i + 1) * NUM_BYTES), block.begin());
+        encryptExpanded(block, outputBlock, expandedKey);
+        std::copy(outputBlock.begin(), outputBlock.end(), output + (i * NUM_BYTES));
+    }
+}
+
+/**
+  Decrypts whole blocks with ECB mode
+  @param input: numBlocks * NUM_BYTES bytes of ciphertext
+  @param output: numBlocks * NUM_BYTES bytes of plaintext
+  @param numBlocks: number of blocks to process
+  @param expandedKey: key schedule from keyExpansion()
+  @return none
+*/
+void decrypt_ecb_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey) noexcept(false) {
+    std::array<unsigned char, NUM_BYTES> block{0};
+    std::array<unsigned char, NUM_BYTES> outputBlock{0};
+
+    for (std::size_t i = 0; i < numBlocks; i++) {
+        std::copy(input + (i * NUM_BYTES), input + ((i + 1) * NUM_BYTES), block.begin());
+        decryptExpanded(block, outputBlock, expandedKey);
+        std::copy(outputBlock.begin(), outputBlock.end(), output + (i * NUM_BYTES));
+    }
+}
+
+/**
+  Encrypts whole blocks with CBC mode
+  @param input: numBlocks * NUM_BYTES bytes of plaintext
+  @param output: numBlocks * NUM_BYTES bytes of ciphertext
+  @param numBlocks: number of blocks to process
+  @param expandedKey: key schedule from keyExpansion()
+  @param chain: previous ciphertext block (the IV at the start), updated to the last ciphertext block
+  @return none
+*/
+void encrypt_cbc_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey,
+                        std::array<unsigned char, NUM_BYTES> &chain) noexcept(false) {
+    std::array<unsigned char, NUM_BYTES> block{0};
+
+    for (std::size_t i = 0; i < numBlocks; i++) {
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            block[j] = input[j + (i * NUM_BYTES)] ^ chain[j];
+        }
+        encryptExpanded(block, chain, expandedKey);
+        std::copy(chain.begin(), chain.end(), output + (i * NUM_BYTES));
+    }
+}
+
+/**
+  Decrypts whole blocks with CBC mode
+  @param input: numBlocks * NUM_BYTES bytes of ciphertext
+  @param output: numBlocks * NUM_BYTES bytes of plaintext
+  @param numBlocks: number of blocks to process
+  @param expandedKey: key schedule from keyExpansion()
+  @param chain: previous ciphertext block (the IV at the start), updated to the last ciphertext block
+  @return none
+*/
+void decrypt_cbc_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey,
+                        std::array<unsigned char, NUM_BYTES> &chain) noexcept(false) {
+    std::array<unsigned char, NUM_BYTES> block{0};
+    std::array<unsigned char, NUM_BYTES> outputBlock{0};
+
+    for (std::size_t i = 0; i < numBlocks; i++) {
+        // Keep the ciphertext before the output overwrites it when working in place
+        std::copy(input + (i * NUM_BYTES), input + ((i + 1) * NUM_BYTES), block.begin());
+        decryptExpanded(block, outputBlock, expandedKey);
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            output[j + (i * NUM_BYTES)] = outputBlock[j] ^ chain[j];
+        }
+        chain = block;
+    }
+}
+
+/**
+  Encrypts whole blocks with CFB128 mode
+  @param input: numBlocks * NUM_BYTES bytes of plaintext
+  @param output: numBlocks * NUM_BYTES bytes of ciphertext
+  @param numBlocks: number of blocks to process
+  @param expandedKey: key schedule from keyExpansion()
+  @param chain: previous ciphertext block (the IV at the start), updated to the last ciphertext block
+  @return none
+*/
+void encrypt_cfb_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey,
+                        std::array<unsigned char, NUM_BYTES> &chain) noexcept(false) {
+    std::array<unsigned char, NUM_BYTES> outputBlock{0};
+
+    for (std::size_t i = 0; i < numBlocks; i++) {
+        encryptExpanded(chain, outputBlock, expandedKey);
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            chain[j] = outputBlock[j] ^ input[j + (i * NUM_BYTES)];
+            output[j + (i * NUM_BYTES)] = chain[j];
+        }
+    }
+}
+
+/**
+  Decrypts whole blocks with CFB128 mode
+  @param input: numBlocks * NUM_BYTES bytes of ciphertext
+  @param output: numBlocks * NUM_BYTES bytes of plaintext
+  @param numBlocks: number of blocks to process
+  @param expandedKey: key schedule from keyExpansion()
+  @param chain: previous ciphertext block (the IV at the start), updated to the last ciphertext block
+  @return none
+*/
+void decrypt_cfb_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey,
+                        std::array<unsigned char, NUM_BYTES> &chain) noexcept(false) {
+    std::array<unsigned char, NUM_BYTES> outputBlock{0};
+
+    for (std::size_t i = 0; i < numBlocks; i++) {
+        encryptExpanded(chain, outputBlock, expandedKey);
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            chain[j] = input[j + (i * NUM_BYTES)];
+            output[j + (i * NUM_BYTES)] = outputBlock[j] ^ chain[j];
+        }
+    }
+}
+
+/**
+  Encrypts or decrypts whole blocks with OFB mode, the operation is its own inverse
+  @param input: numBlocks * NUM_BYTES bytes of input
+  @param output: numBlocks * NUM_BYTES bytes of output
+  @param numBlocks: number of blocks to process
+  @param expandedKey: key schedule from keyExpansion()
+  @param chain: previous keystream block (the IV at the start), updated to the last keystream block
+  @return none
+*/
+void crypt_ofb_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                      const std::vector<unsigned char> &expandedKey,
+                      std::array<unsigned char, NUM_BYTES> &chain) noexcept(false) {
+    std::array<unsigned char, NUM_BYTES> outputBlock{0};
+
+    for (std::size_t i = 0; i < numBlocks; i++) {
+        encryptExpanded(chain, outputBlock, expandedKey);
+        chain = outputBlock;
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            output[j + (i * NUM_BYTES)] = input[j + (i * NUM_BYTES)] ^ outputBlock[j];
+        }
+    }
+}
+
+/**
+  Encrypts or decrypts whole blocks with CTR mode, the operation is its own inverse
+  @param input: numBlocks * NUM_BYTES bytes of input
+  @param output: numBlocks * NUM_BYTES bytes of output
+  @param numBlocks: number of blocks to process
+  @param expandedKey: key schedule from keyExpansion()
+  @param counter: counter block (nonce followed by the block counter), incremented once per block
+  @return none
+*/
+void crypt_ctr_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                      const std::vector<unsigned char> &expandedKey,
+                      std::array<unsigned char, NUM_BYTES> &counter) noexcept(false) {
+    std::array<unsigned char, NUM_BYTES> outputBlock{0};
+
+    for (std::size_t i = 0; i < numBlocks; i++) {
+        encryptExpanded(counter, outputBlock, expandedKey);
+        for (std::size_t j = 0; j < NUM_BYTES; j++) {
+            output[j + (i * NUM_BYTES)] = input[j + (i * NUM_BYTES)] ^ outputBlock[j];
+        }
+        incrementCounter(counter, NUM_BYTES / 2);
+    }
+}
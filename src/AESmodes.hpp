@@ -9,7 +9,10 @@
 #include "decrypt.hpp"
 #include <vector>
 
-bool remove_padding(std::vector<unsigned char> &input) noexcept(false);
+// Modes of operation selectable on the command line
+enum AESMode { MODE_ECB, MODE_CBC, MODE_CTS, MODE_CFB, MODE_OFB, MODE_CTR, MODE_INVALID };
+
+bool unpadded_length(const unsigned char *data, std::size_t length, std::size_t &unpaddedLength) noexcept(true);
 
 bool encrypt_ecb(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key) noexcept(true);
@@ -23,6 +26,12 @@ bool encrypt_cbc(const std::vector<unsigned char> &input, std::vector<unsigned c
 bool decrypt_cbc(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true);
 
+bool encrypt_cbc_cs3(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
+                     const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true);
+
+bool decrypt_cbc_cs3(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
+                     const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true);
+
 bool encrypt_ctr(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key,
                  const std::array<unsigned char, NUM_BYTES / 2> &nonce) noexcept(true);
@@ -43,6 +52,38 @@ bool encrypt_ofb(const std::vector<unsigned char> &input, std::vector<unsigned c
 bool decrypt_ofb(const std::vector<unsigned char> &input, std::vector<unsigned char> &output,
                  const std::vector<unsigned char> &key, const std::vector<unsigned char> &IV) noexcept(true);
 
+void incrementCounter(std::array<unsigned char, NUM_BYTES> &counter, int numCounterBytes) noexcept(false);
+
+void encrypt_ecb_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey) noexcept(false);
+
+void decrypt_ecb_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey) noexcept(false);
+
+void encrypt_cbc_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey,
+                        std::array<unsigned char, NUM_BYTES> &chain) noexcept(false);
+
+void decrypt_cbc_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey,
+                        std::array<unsigned char, NUM_BYTES> &chain) noexcept(false);
+
+void encrypt_cfb_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey,
+                        std::array<unsigned char, NUM_BYTES> &chain) noexcept(false);
+
+void decrypt_cfb_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                        const std::vector<unsigned char> &expandedKey,
+                        std::array<unsigned char, NUM_BYTES> &chain) noexcept(false);
+
+void crypt_ofb_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                      const std::vector<unsigned char> &expandedKey,
+                      std::array<unsigned char, NUM_BYTES> &chain) noexcept(false);
+
+void crypt_ctr_blocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks,
+                      const std::vector<unsigned char> &expandedKey,
+                      std::array<unsigned char, NUM_BYTES> &counter) noexcept(false);
+
 void printEncryptOutput(std::vector<unsigned char> &output);
 
 void printDecryptOutput(std::vector<unsigned char> &output);
@@ -0,0 +1,329 @@
+/**
+  @file AESstream.cpp: Incremental encryption and decryption of data supplied in chunks
+  The output is identical to passing the whole input to the matching encrypt_ or decrypt_ function:
+  PKCS#7 padding for every mode except CTS, which uses ciphertext stealing
+*/
+#include <algorithm>
+#include <stdexcept>
+#include "AESstream.hpp"
+#include "AESStats.hpp"
+#include "AESTrace.hpp"
+
+
+/**
+  AESStream constructor
+  Expands the key once for the whole stream
+  @param mode: mode of operation
+  @param encrypting: true to encrypt, false to decrypt
+  @param key: vector of hex values representing key to use
+  @param iv: NUM_BYTES byte IV for CBC, CTS, CFB and OFB, NUM_BYTES/2 byte nonce for CTR, empty for ECB
+  @return none
+*/
+AESStream::AESStream(AESMode mode, bool encrypting, const std::vector<unsigned char> &key,
+                     const std::vector<unsigned char> &iv)
+        : mode(mode), encrypting(encrypting), key(key), expandedKey(16 * (key.size() / 4 + 7), 0), chain(), pending() {
+    keyExpansion(this->key, this->expandedKey, key.size());
+
+    // For CTR the nonce fills the upper half and the counter starts at zero
+    this->chain.fill(0);
+    std::copy(iv.begin(), iv.begin() + std::min(iv.size(), (std::size_t) NUM_BYTES), this->chain.begin());
+}
+
+/**
+  AESStream constructor for a key that has already been expanded
+  Lets callers that reuse one key for many messages skip the key schedule
+  @param mode: mode of operation
+  @param encrypting: true to encrypt, false to decrypt
+  @param key: vector of hex values representing key to use
+  @param expandedKey: key schedule of key from keyExpansion()
+  @param iv: NUM_BYTES byte IV for CBC, CTS, CFB and OFB, NUM_BYTES/2 byte nonce for CTR, empty for ECB
+  @return none
+*/
+AESStream::AESStream(AESMode mode, bool encrypting, const std::vector<unsigned char> &key,
+                     const std::vector<unsigned char> &expandedKey, const std::vector<unsigned char> &iv)
+        : mode(mode), encrypting(encrypting), key(key), expandedKey(expandedKey), chain(), pending() {
+    this->chain.fill(0);
+    std::copy(iv.begin(), iv.begin() + std::min(iv.size(), (std::size_t) NUM_BYTES), this->chain.begin());
+}
+
+/**
+  AESStream deconstructor
+  Wipes the key material and any buffered data
+  @return none
+*/
+AESStream::~AESStream() {
+    std::fill(this->key.begin(), this->key.end(), 0);
+    std::fill(this->expandedKey.begin(), this->expandedKey.end(), 0);
+    std::fill(this->pending.begin(), this->pending.end(), 0);
+    this->chain.fill(0);
+}
+
+/**
+  Number of trailing bytes that must be kept back until the end of the stream is known
+  Encryption keeps the partial last block for padding, decryption keeps the last block so its padding
+  can be removed, and CTS keeps the last two blocks so they can be swapped
+  @param available: number of bytes available to process
+  @return number of bytes to keep back
+*/
+std::size_t AESStream::holdBack(std::size_t available) const {
+    if (available == 0)
+        return 0;
+
+    if (this->mode == MODE_CTS)
+        return available <= 2 * NUM_BYTES ? available : ((available - 1) % NUM_BYTES) + 1 + NUM_BYTES;
+
+    if (this->encrypting)
+        return available % NUM_BYTES;
+
+    return ((available - 1) % NUM_BYTES) + 1;
+}
+
+/**
+  Runs the block kernel for the stream's mode and direction
+  @param input: numBlocks * NUM_BYTES bytes of input
+  @param output: numBlocks * NUM_BYTES bytes of output
+  @param numBlocks: number of blocks to process
+  @return none
+*/
+void AESStream::processBlocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks) {
+    AES_STAT_TIMER(timer, STAT_NS_CIPHER);
+    AES_STAT_ADD(AESStats::blocks(this->mode, this->encrypting), numBlocks);
+    AESTrace::Span span(this->encrypting ? "encrypt" : "decrypt", "blocks", (std::int64_t) numBlocks);
+    switch (this->mode) {
+        case MODE_ECB:
+            if (this->encrypting)
+                encrypt_ecb_blocks(input, output, numBlocks, this->expandedKey);
+            else
+                decrypt_ecb_blocks(input, output, numBlocks, this->expandedKey);
+            break;
+        case MODE_CBC:
+        case MODE_CTS:
+            if (this->encrypting)
+                encrypt_cbc_blocks(input, output, numBlocks, this->expandedKey, this->chain);
+            else
+                decrypt_cbc_blocks(input, output, numBlocks, this->expandedKey, this->chain);
+            break;
+        case MODE_CFB:
+            if (this->encrypting)
+                encrypt_cfb_blocks(input, output, numBlocks, this->expandedKey, this->chain);
+            else
+                decrypt_cfb_blocks(input, output, numBlocks, this->expandedKey, this->chain);
+            break;
+        case MODE_OFB:
+            crypt_ofb_blocks(input, output, numBlocks, this->expandedKey, this->chain);
+            break;
+        case MODE_CTR:
+            crypt_ctr_blocks(input, output, numBlocks, this->expandedKey, this->chain);
+            break;
+        default:
+            throw std::invalid_argument("Invalid mode");
+    }
+}
+
+/**
+  Processes the next chunk of input
+  Whole blocks are written to the output as soon as they are known not to be part of the final block(s)
+  Guaranteed no exceptions by handling all exceptions per ERR51-CPP
+  @param input: next chunk of input bytes
+  @param length: number of bytes in the chunk
+  @param output: vector the processed bytes are appended to
+  @return True on success
+*/
+bool AESStream::update(const unsigned char *input, std::size_t length, std::vector<unsigned char> &output) noexcept(true) {
+    try {
+        const std::size_t available = this->pending.size() + length;
+        const std::size_t numBlocks = (available - holdBack(available)) / NUM_BYTES;
+        AES_STAT_ADD(STAT_BYTES_IN, length);
+        AES_STAT_ADD(STAT_BYTES_OUT, numBlocks * NUM_BYTES);
+
+        if (numBlocks == 0) {
+            this->pending.insert(this->pending.end(), input, input + length);
+            return true;
+        }
+
+        const std::size_t outputStart = output.size();
+        output.resize(outputStart + (numBlocks * NUM_BYTES));
+        unsigned char *out = output.data() + outputStart;
+
+        // Complete the first block from buffered bytes before working straight from the input
+        std::size_t consumed = 0;
+        std::size_t blocksDone = 0;
+        if (!this->pending.empty()) {
+            std::size_t needed = (NUM_BYTES - (this->pending.size() % NUM_BYTES)) % NUM_BYTES;
+            needed = std::min(needed, length);
+            this->pending.insert(this->pending.end(), input, input + needed);
+            consumed = needed;
+
+            std::size_t pendingBlocks = std::min(this->pending.size() / NUM_BYTES, numBlocks);
+            processBlocks(this->pending.data(), out, pendingBlocks);
+            this->pending.erase(this->pending.begin(), this->pending.begin() + (pendingBlocks * NUM_BYTES));
+            blocksDone = pendingBlocks;
+        }
+
+        processBlocks(input + consumed, out + (blocksDone * NUM_BYTES), numBlocks - blocksDone);
+        consumed += (numBlocks - blocksDone) * NUM_BYTES;
+
+        this->pending.insert(this->pending.end(), input + consumed, input + length);
+
+    } catch (std::exception &e) {
+        //Catch exception by lvalue or reference per ERR61-CPP
+        return false;
+    }
+    return true;
+}
+
+/**
+  Processes the final 16 to 32 bytes of a CTS stream, as in encrypt_cbc_cs3() and decrypt_cbc_cs3()
+  @param output: vector the final bytes are appended to
+  @return none
+*/
+void AESStream::stealCiphertext(std::vector<unsigned char> &output) {
+    const std::size_t lastLength = this->pending.size() - NUM_BYTES;
+    std::array<unsigned char, NUM_BYTES> penultimate{0};
+    std::array<unsigned char, NUM_BYTES> last{0};
+
+    // A single block message is plain CBC
+    if (lastLength == 0) {
+        processBlocks(this->pending.data(), penultimate.data(), 1);
+        output.insert(output.end(), penultimate.begin(), penultimate.end());
+        return;
+    }
+
+    if (this->encrypting) {
+        AES_STAT_ADD(AESStats::blocks(MODE_CTS, true), 2);
+        // Encrypt the penultimate block, then the zero-filled last block chained on it
+        encrypt_cbc_blocks(this->pending.data(), penultimate.data(), 1, this->expandedKey, this->chain);
+        std::copy(this->pending.begin() + NUM_BYTES, this->pending.end(), last.begin());
+        encrypt_cbc_blocks(last.data(), last.data(), 1, this->expandedKey, this->chain);
+
+        // The last two blocks are swapped and the penultimate ciphertext truncated
+        output.insert(output.end(), last.begin(), last.end());
+        output.insert(output.end(), penultimate.begin(), penultimate.begin() + lastLength);
+    }
+    else {
+        AES_STAT_ADD(AESStats::blocks(MODE_CTS, false), 2);
+        // The full block is the encryption of the final block, chained on the stolen ciphertext block
+        decrypt_ecb_blocks(this->pending.data(), last.data(), 1, this->expandedKey);
+
+        std::array<unsigned char, NUM_BYTES> stolen = last;
+        std::copy(this->pending.begin() + NUM_BYTES, this->pending.end(), stolen.begin());
+        decrypt_cbc_blocks(stolen.data(), penultimate.data(), 1, this->expandedKey, this->chain);
+
+        for (std::size_t j = 0; j < lastLength; j++) {
+            last[j] ^= stolen[j];
+        }
+        output.insert(output.end(), penultimate.begin(), penultimate.end());
+        output.insert(output.end(), last.begin(), last.begin() + lastLength);
+    }
+}
+
+/**
+  Processes the held back bytes at the end of the stream
+  Encryption pads the final block, decryption checks and removes the padding
+  Guaranteed no exceptions by handling all exceptions per ERR51-CPP
+  @param output: vector the final bytes are appended to
+  @return True on success, false for a malformed input or invalid padding
+*/
+bool AESStream::finish(std::vector<unsigned char> &output) noexcept(true) {
+    try {
+        AESTrace::Span span("padding");
+        const std::size_t outputStart = output.size();
+
+        // Ciphertext stealing covers the final two blocks in one go, chained on the last ciphertext block
+        if (this->mode == MODE_CTS) {
+            if (this->pending.size() < NUM_BYTES)
+                return false;
+
+            stealCiphertext(output);
+            this->pending.clear();
+            AES_STAT_ADD(STAT_BYTES_OUT, output.size() - outputStart);
+            return true;
+        }
+
+        std::vector<unsigned char> block(NUM_BYTES, 0);
+
+        if (this->encrypting) {
+            // PKCS#7 padding (source: https://www.ibm.com/docs/en/zos/2.1.0?topic=rules-pkcs-padding-method)
+            const std::size_t padLength = NUM_BYTES - this->pending.size();
+            std::copy(this->pending.begin(), this->pending.end(), block.begin());
+            std::fill(block.begin() + this->pending.size(), block.end(), (unsigned char) padLength);
+
+            processBlocks(block.data(), block.data(), 1);
+            output.insert(output.end(), block.begin(), block.end());
+        }
+        else {
+            // The ciphertext must be a whole number of blocks
+            if (this->pending.size() != NUM_BYTES)
+                return false;
+
+            processBlocks(this->pending.data(), block.data(), 1);
+            std::size_t plaintextLength = 0;
+            if (!unpadded_length(block.data(), NUM_BYTES, plaintextLength))
+                return false;
+            output.insert(output.end(), block.begin(), block.begin() + plaintextLength);
+        }
+
+        this->pending.clear();
+        AES_STAT_ADD(STAT_BYTES_OUT, output.size() - outputStart);
+
+    } catch (std::exception &e) {
+        //Catch exception by lvalue or reference per ERR61-CPP
+        return false;
+    }
+    return true;
+}
+
+/**
+  Processes a complete message held in memory, writing straight into the output buffer
+  Must be used on a new stream instead of update() and finish()
+  Input and output may be the same buffer, which lets a memory mapping be processed in place
+  Guaranteed no exceptions by handling all exceptions per ERR51-CPP
+  @param input: the whole input
+  @param length: number of bytes of input
+  @param output: buffer with room for length + NUM_BYTES bytes
+  @param outputLength: set to the number of bytes written
+  @return True on success, false for a malformed input or invalid padding
+*/
+bool AESStream::processBuffer(const unsigned char *input, std::size_t length, unsigned char *output,
+                              std::size_t &outputLength) noexcept(true) {
+    try {
+        const std::size_t tailLength = holdBack(length);
+        const std::size_t bulkLength = length - tailLength;
+        AES_STAT_ADD(STAT_BYTES_IN, length);
+        AES_STAT_ADD(STAT_BYTES_OUT, bulkLength);
+
+        processBlocks(input, output, bulkLength / NUM_BYTES);
+
+        // The held back tail goes through the regular end of stream handling
+        this->pending.assign(input + bulkLength, input + length);
+        std::vector<unsigned char> tail;
+        if (!finish(tail))
+            return false;
+
+        std::copy(tail.begin(), tail.end(), output + bulkLength);
+        outputLength = bulkLength + tail.size();
+
+    } catch (std::exception &e) {
+        //Catch exception by lvalue or reference per ERR61-CPP
+        return false;
+    }
+    return true;
+}
+
+/**
+  Runs the mode's block kernel without any padding, continuing the stream's chaining value
+  Guaranteed no exceptions by handling all exceptions per ERR51-CPP
+  @param input: numBlocks * NUM_BYTES bytes of input
+  @param output: numBlocks * NUM_BYTES bytes of output, may be the same as input
+  @param numBlocks: number of blocks to process
+  @return True on success
+*/
+bool AESStream::transformBlocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks) noexcept(true) {
+    try {
+        processBlocks(input, output, numBlocks);
+    } catch (std::exception &e) {
+        //Catch exception by lvalue or reference per ERR61-CPP
+        return false;
+    }
+    return true;
+}
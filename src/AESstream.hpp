@@ -0,0 +1,49 @@
+/**
+  @file AESstream.hpp: Incremental encryption and decryption of data supplied in chunks
+*/
+#ifndef AES_STREAM_HPP
+#define AES_STREAM_HPP
+
+#include <vector>
+#include <array>
+#include <cstddef>
+#include "AESmodes.hpp"
+
+
+//AESStream class
+class AESStream {
+public:
+    AESStream(AESMode mode, bool encrypting, const std::vector<unsigned char> &key,
+              const std::vector<unsigned char> &iv);
+
+    AESStream(AESMode mode, bool encrypting, const std::vector<unsigned char> &key,
+              const std::vector<unsigned char> &expandedKey, const std::vector<unsigned char> &iv);
+
+    ~AESStream();
+
+    bool update(const unsigned char *input, std::size_t length, std::vector<unsigned char> &output) noexcept(true);
+
+    bool finish(std::vector<unsigned char> &output) noexcept(true);
+
+    bool processBuffer(const unsigned char *input, std::size_t length, unsigned char *output,
+                       std::size_t &outputLength) noexcept(true);
+
+    bool transformBlocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks) noexcept(true);
+
+    std::size_t holdBack(std::size_t available) const;
+
+private:
+    void processBlocks(const unsigned char *input, unsigned char *output, std::size_t numBlocks);
+
+    void stealCiphertext(std::vector<unsigned char> &output);
+
+    AESMode mode;
+    bool encrypting;
+    std::vector<unsigned char> key;
+    std::vector<unsigned char> expandedKey;
+    std::array<unsigned char, NUM_BYTES> chain;
+    std::vector<unsigned char> pending;
+};
+
+
+#endif //AES_STREAM_HPP
@@ -0,0 +1,381 @@
+/**
+  @file autotune.cpp: Per-host tuning of the sbox lookup, the streaming chunk size and the thread count
+  ./main autotune measures each sbox lookup on the block functions and the CBC kernels, then the pipelined
+  stream over a temporary file at several chunk sizes, then chunked CTR encryption on several thread counts.
+  The winners are saved to a configuration file that later runs load at startup without measuring again,
+  as long as it was written on the same host. Probe sizes follow the measured speed so a run takes seconds.
+  With --constant-time only lookups whose memory accesses do not depend on the data are considered.
+  Usage: ./main autotune [--constant-time] [--config FILE]
+*/
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include "autotune.hpp"
+#include "AESRand.hpp"
+#include "pipeline.hpp"
+
+// Least time spent on each measurement
+#define AUTOTUNE_MEASURE_SECONDS 0.2
+// Candidates this close to the best are treated as equal, and the smaller one is kept
+#define AUTOTUNE_TOLERANCE 0.05
+// Bounds on the amount of data each chunk size and thread count is measured on
+#define AUTOTUNE_MIN_PROBE (64 * 1024)
+#define AUTOTUNE_MAX_PROBE (64 * 1024 * 1024)
+
+// Streaming chunk sizes tried, smallest first
+static const std::size_t chunkCandidates[] = {16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024};
+
+// Sbox lookups and whether their memory accesses are independent of the data
+static const struct {
+    SboxBackend backend;
+    const char* name;
+    bool constantTime;
+} sboxBackends[] = {
+    {SBOX_TABLE, "table", false},
+    {SBOX_CONSTANT_TIME, "constant-time", true},
+};
+
+
+/**
+  Name of an sbox lookup in the configuration file
+  @param backend: the lookup
+  @return its name
+*/
+static const char* backendName(SboxBackend backend) {
+    for (const auto& entry : sboxBackends) {
+        if (entry.backend == backend)
+            return entry.name;
+    }
+    return "invalid";
+}
+
+/**
+  Path of the configuration file
+  @return AES_AUTOTUNE_CONFIG if set, otherwise .aes_autotune in the home directory, empty if neither is known
+*/
+std::string autotuneConfigPath() {
+    const char* path = std::getenv(AUTOTUNE_PATH_VARIABLE);
+    if (path != nullptr && *path != '\0')
+        return path;
+    const char* home = std::getenv("HOME");
+    if (home == nullptr || *home == '\0')
+        return "";
+    return std::string(home) + "/" + AUTOTUNE_FILE_NAME;
+}
+
+/**
+  Identifies this host, so a configuration copied from another machine is not used
+  @return host name, architecture, number of CPUs and CPU model
+*/
+std::string autotuneHost() {
+    std::ostringstream host;
+    struct utsname names;
+    if (uname(&names) == 0)
+        host << names.nodename << "/" << names.machine;
+    host << "/" << std::thread::hardware_concurrency();
+
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            const std::size_t colon = line.find(':');
+            if (colon != std::string::npos)
+                host << "/" << line.substr(line.find_first_not_of(" \t", colon + 1));
+            break;
+        }
+    }
+    return host.str();
+}
+
+/**
+  Reads a configuration file
+  @param path: the file
+  @param config: filled from the file
+  @return false if the file cannot be read or holds an invalid value
+*/
+bool loadAutotuneConfig(const std::string& path, AutotuneConfig& config) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        const std::size_t equals = line.find('=');
+        if (equals == std::string::npos)
+            return false;
+        const std::string name = line.substr(0, equals);
+        const std::string value = line.substr(equals + 1);
+
+        if (name == "host") {
+            config.host = value;
+        }
+        else if (name == "policy") {
+            if (value != "any" && value != "constant-time")
+                return false;
+            config.constantTime = value == "constant-time";
+        }
+        else if (name == "backend") {
+            config.backend = SBOX_INVALID;
+            for (const auto& entry : sboxBackends) {
+                if (value == entry.name)
+                    config.backend = entry.backend;
+            }
+            if (config.backend == SBOX_INVALID)
+                return false;
+        }
+        else if (name == "chunk_size") {
+            const long long size = std::atoll(value.c_str());
+            if (size < NUM_BYTES || size % NUM_BYTES != 0 || size > AUTOTUNE_MAX_PROBE)
+                return false;
+            config.chunkSize = (std::size_t) size;
+        }
+        else if (name == "threads") {
+            const long threads = std::atol(value.c_str());
+            if (threads < 1 || threads > 4096)
+                return false;
+            config.threads = (unsigned) threads;
+        }
+    }
+
+    // A constant time policy never loads a lookup that is not
+    for (const auto& entry : sboxBackends) {
+        if (entry.backend == config.backend && config.constantTime && !entry.constantTime)
+            return false;
+    }
+    return true;
+}
+
+/**
+  Writes a configuration file, replacing it atomically
+  @param path: the file
+  @param config: settings to save
+  @return false on an I/O error
+*/
+bool saveAutotuneConfig(const std::string& path, const AutotuneConfig& config) {
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        file << "# Written by ./main autotune, delete to measure again\n"
+             << "host=" << config.host << "\n"
+             << "policy=" << (config.constantTime ? "constant-time" : "any") << "\n"
+             << "backend=" << backendName(config.backend) << "\n"
+             << "chunk_size=" << config.chunkSize << "\n"
+             << "threads=" << config.threads << "\n";
+        if (!file.good())
+            return false;
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+/**
+  Applies the saved configuration, if there is one for this host
+  Called before the command line is read, so explicit options still win
+  @param options: file mode options whose defaults are tuned
+  @return none
+*/
+void applyAutotuneConfig(FileOptions& options) {
+    const std::string path = autotuneConfigPath();
+    AutotuneConfig config;
+    if (path.empty() || !loadAutotuneConfig(path, config) || config.host != autotuneHost())
+        return;
+    setSboxBackend(config.backend);
+    options.streamChunkSize = config.chunkSize;
+    options.threads = config.threads;
+}
+
+/**
+  Runs an operation repeatedly for at least AUTOTUNE_MEASURE_SECONDS
+  @param operation: callable processing bytesPerCall bytes
+  @param bytesPerCall: bytes processed by one call
+  @return bytes per second
+*/
+template <typename Operation>
+static double bytesPerSecond(Operation operation, std::size_t bytesPerCall) {
+    typedef std::chrono::steady_clock Clock;
+    const auto start = Clock::now();
+    std::size_t calls = 0;
+    double seconds = 0;
+    do {
+        operation();
+        calls++;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (seconds < AUTOTUNE_MEASURE_SECONDS);
+    return (double) calls * bytesPerCall / seconds;
+}
+
+/**
+  Prints one measurement
+  @param label: what was measured
+  @param rate: bytes per second
+  @return none
+*/
+static void printRate(const std::string& label, double rate) {
+    std::cout << std::left << std::setw(28) << label << std::fixed << std::setprecision(2)
+              << rate / (1024 * 1024) << " MiB/s\n";
+}
+
+/**
+  Command line entry point of the autotuner
+  @param argc: number of arguments, starting with the program and "autotune"
+  @param argv: the arguments
+  @return 0 on success, 2 on invalid parameters, 5 on an I/O error
+*/
+int runAutotune(int argc, char** argv) {
+    bool constantTime = false;
+    std::string path = autotuneConfigPath();
+    for (int i = 2; i < argc; i++) {
+        if (std::strcmp(argv[i], "--constant-time") == 0) {
+            constantTime = true;
+        }
+        else if (std::strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        }
+        else {
+            std::cerr << "Usage: ./main autotune [--constant-time] [--config FILE]\n";
+            return 2;
+        }
+    }
+    if (path.empty()) {
+        std::cerr << "No configuration file, set HOME or " << AUTOTUNE_PATH_VARIABLE << ".\n";
+        return 2;
+    }
+
+    AESRand& rand = AESRand::threadLocal();
+    const std::vector<unsigned char> key = rand.generateBytes(16);
+    const std::vector<unsigned char> iv = rand.generateBytes(NUM_BYTES);
+    std::vector<unsigned char> expandedKey(16 * (key.size() / 4 + 7));
+    keyExpansion(key, expandedKey, (unsigned char) key.size());
+
+    AutotuneConfig config;
+    config.host = autotuneHost();
+    config.constantTime = constantTime;
+
+    // Sbox lookup, on single blocks and on 64 block CBC runs in both directions
+    const std::size_t kernelBlocks = 64;
+    std::vector<unsigned char> data(kernelBlocks * NUM_BYTES, 0x5a);
+    double bestRate = 0;
+    for (const auto& entry : sboxBackends) {
+        if (constantTime && !entry.constantTime)
+            continue;
+        setSboxBackend(entry.backend);
+        std::array<unsigned char, NUM_BYTES> block{0};
+        std::array<unsigned char, NUM_BYTES> chain{0};
+        const double rate = bytesPerSecond([&]() {
+            encryptExpanded(block, block, expandedKey);
+            decryptExpanded(block, block, expandedKey);
+            encrypt_cbc_blocks(data.data(), data.data(), kernelBlocks, expandedKey, chain);
+            decrypt_cbc_blocks(data.data(), data.data(), kernelBlocks, expandedKey, chain);
+        }, 2 * (kernelBlocks + 1) * NUM_BYTES);
+        printRate(std::string("Sbox lookup ") + entry.name, rate);
+        if (rate > bestRate) {
+            bestRate = rate;
+            config.backend = entry.backend;
+        }
+    }
+    setSboxBackend(config.backend);
+
+    const std::size_t probeSize = std::min<std::size_t>(
+            std::max<std::size_t>((std::size_t) (bestRate * AUTOTUNE_MEASURE_SECONDS), AUTOTUNE_MIN_PROBE),
+            AUTOTUNE_MAX_PROBE) / NUM_BYTES * NUM_BYTES;
+    std::vector<unsigned char> probe = rand.generateBytes(probeSize);
+
+    // Streaming chunk size, through the pipeline from a temporary file to /dev/null
+    const char* tmpdir = std::getenv("TMPDIR");
+    std::string tempPath = std::string((tmpdir != nullptr && *tmpdir != '\0') ? tmpdir : "/tmp") + "/aes_autotune_XXXXXX";
+    std::vector<char> tempName(tempPath.begin(), tempPath.end());
+    tempName.push_back('\0');
+    const int tempFd = mkstemp(tempName.data());
+    const int nullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (tempFd < 0 || nullFd < 0 || write(tempFd, probe.data(), probe.size()) != (ssize_t) probe.size()) {
+        std::cerr << "Unable to create a temporary file for the chunk size probe.\n";
+        if (tempFd >= 0) {
+            close(tempFd);
+            unlink(tempName.data());
+        }
+        if (nullFd >= 0)
+            close(nullFd);
+        return 5;
+    }
+    unlink(tempName.data());
+
+    bestRate = 0;
+    int ioResult = 0;
+    for (std::size_t chunkSize : chunkCandidates) {
+        if (chunkSize > probeSize && chunkSize != chunkCandidates[0])
+            break;
+        const double rate = bytesPerSecond([&]() {
+            AESStream stream(MODE_CBC, true, key, expandedKey, iv);
+            lseek(tempFd, 0, SEEK_SET);
+            if (ioResult == 0)
+                ioResult = pipelineData(tempFd, nullFd, stream, chunkSize, PIPELINE_BUFFERS);
+        }, probeSize);
+        printRate("Chunk size " + std::to_string(chunkSize), rate);
+        if (rate > bestRate * (1 + AUTOTUNE_TOLERANCE)) {
+            bestRate = std::max(bestRate, rate);
+            config.chunkSize = chunkSize;
+        }
+    }
+    close(tempFd);
+    close(nullFd);
+    if (ioResult != 0) {
+        std::cerr << "The chunk size probe failed.\n";
+        return 5;
+    }
+
+    // Threads for containers and directories, each encrypting its own share of the probe with CTR
+    const unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<unsigned> threadCandidates;
+    for (unsigned threads = 1; threads < cores; threads *= 2) {
+        threadCandidates.push_back(threads);
+    }
+    threadCandidates.push_back(cores);
+
+    bestRate = 0;
+    config.threads = 1;
+    for (unsigned threads : threadCandidates) {
+        if (threadCandidates.size() == 1)
+            break;
+        const std::size_t shareBlocks = probeSize / NUM_BYTES / threads;
+        const double rate = bytesPerSecond([&]() {
+            std::vector<std::thread> workers;
+            for (unsigned t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    std::array<unsigned char, NUM_BYTES> counter{0};
+                    unsigned char* share = probe.data() + t * shareBlocks * NUM_BYTES;
+                    crypt_ctr_blocks(share, share, shareBlocks, expandedKey, counter);
+                });
+            }
+            for (std::thread& worker : workers) {
+                worker.join();
+            }
+        }, shareBlocks * threads * NUM_BYTES);
+        printRate("Threads " + std::to_string(threads), rate);
+        if (rate > bestRate * (1 + AUTOTUNE_TOLERANCE)) {
+            bestRate = std::max(bestRate, rate);
+            config.threads = threads;
+        }
+    }
+
+    std::cout << "Selected: sbox lookup " << backendName(config.backend) << ", chunk size " << config.chunkSize
+              << ", threads " << config.threads << (constantTime ? ", constant time only" : "") << "\n";
+    if (!saveAutotuneConfig(path, config)) {
+        std::cerr << "Unable to write " << path << "\n";
+        return 5;
+    }
+    std::cout << "Saved to " << path << "\n";
+    return 0;
+}
@@ -0,0 +1,32 @@
+/**
+  @file autotune.hpp: Per-host tuning of the sbox lookup, the streaming chunk size and the thread count
+*/
+#ifndef SRC_AUTOTUNE_HPP
+#define SRC_AUTOTUNE_HPP
+
+#include <string>
+#include <cstddef>
+#include "AESmath.hpp"
+#include "filemode.hpp"
+
+// Environment variable naming the configuration file, otherwise it is AUTOTUNE_FILE_NAME in the home directory
+#define AUTOTUNE_PATH_VARIABLE "AES_AUTOTUNE_CONFIG"
+#define AUTOTUNE_FILE_NAME ".aes_autotune"
+
+// Settings chosen by runAutotune()
+struct AutotuneConfig {
+    std::string host;
+    bool constantTime = false;
+    SboxBackend backend = SBOX_TABLE;
+    std::size_t chunkSize = FILE_CHUNK_SIZE;
+    unsigned threads = 0;
+};
+
+std::string autotuneConfigPath();
+std::string autotuneHost();
+bool loadAutotuneConfig(const std::string& path, AutotuneConfig& config);
+bool saveAutotuneConfig(const std::string& path, const AutotuneConfig& config);
+void applyAutotuneConfig(FileOptions& options);
+int runAutotune(int argc, char** argv);
+
+#endif
@@ -0,0 +1,147 @@
+/**
+  @file batch.cpp: Processing many records from one process
+  Each input line is one record:
+      MODE enc|dec KEY IV DATA
+  with the key, IV (or nonce for CTR) and data in hex without spaces, and "-" for an empty field,
+  such as the IV for ECB or empty data. Blank lines and lines starting with '#' are skipped.
+  Each record produces one output line with the result in hex, or "ERROR".
+  Key schedules come from the shared key cache, so records repeating a recent key skip key expansion.
+*/
+
+#include <iostream>
+#include <cstring>
+#include "batch.hpp"
+#include "AESstream.hpp"
+#include "AESKeyCache.hpp"
+#include "hexcodec.hpp"
+#include "interface.hpp"
+#include "AESTrace.hpp"
+
+
+/**
+    Take the next whitespace separated field from a line
+    @param line: line being parsed
+    @param pos: position to start from, moved past the field
+    @param start: set to the start of the field
+    @param length: set to the length of the field
+    @return false if there are no more fields
+ */
+static bool nextField(const std::string& line, std::size_t& pos, std::size_t& start, std::size_t& length) {
+    while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r'))
+        pos++;
+    if (pos >= line.size())
+        return false;
+
+    start = pos;
+    while (pos < line.size() && line[pos] != ' ' && line[pos] != '\t' && line[pos] != '\r')
+        pos++;
+    length = pos - start;
+    return true;
+}
+
+/**
+    Decode a hex field, "-" stands for no bytes
+    @param text: start of the field
+    @param length: length of the field
+    @param vec: vector the bytes are stored in
+    @return false if the field is not valid hex
+ */
+static bool decodeField(const char* text, std::size_t length, std::vector<unsigned char>& vec) {
+    vec.clear();
+    if (length == 1 && text[0] == '-')
+        return true;
+    return hexDecode(text, length, vec);
+}
+
+/**
+    Parse one record of batch input
+    @param line: input line
+    @param record: the parsed record
+    @return false if the line is malformed or a field has the wrong size
+ */
+bool parseBatchRecord(const std::string& line, BatchRecord& record) {
+    AESTrace::Span span("parse", "bytes", (std::int64_t) line.size());
+    std::size_t pos = 0;
+    std::size_t start[5];
+    std::size_t length[5];
+
+    for (int i = 0; i < 5; i++) {
+        if (!nextField(line, pos, start[i], length[i]))
+            return false;
+    }
+
+    std::string mode = line.substr(start[0], length[0]);
+    record.mode = getMode(mode.c_str());
+    if (record.mode == MODE_INVALID)
+        return false;
+
+    std::string function = line.substr(start[1], length[1]);
+    if (function == "enc" || function == "encrypt")
+        record.encrypting = true;
+    else if (function == "dec" || function == "decrypt")
+        record.encrypting = false;
+    else
+        return false;
+
+    if (!decodeField(line.data() + start[2], length[2], record.key) ||
+        !decodeField(line.data() + start[3], length[3], record.iv) ||
+        !decodeField(line.data() + start[4], length[4], record.data))
+        return false;
+
+    if (record.key.size() != 16 && record.key.size() != 24 && record.key.size() != 32)
+        return false;
+
+    const std::size_t ivSize = (record.mode == MODE_ECB) ? 0 : ((record.mode == MODE_CTR) ? NUM_BYTES / 2 : NUM_BYTES);
+    return record.iv.size() == ivSize;
+}
+
+/**
+    Read records from standard input and write one result line per record to standard output
+    @return 0 once the input is exhausted
+ */
+int runBatchMode() {
+    std::ios_base::sync_with_stdio(false);
+
+    std::string line;
+    std::string results;
+    BatchRecord record;
+    std::vector<unsigned char> output;
+    AESKeyCache& cache = AESKeyCache::shared();
+
+    while (std::getline(std::cin, line)) {
+        if (line.empty() || line[0] == '#' || line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        bool success = parseBatchRecord(line, record);
+
+        if (success) {
+            std::shared_ptr<const std::vector<unsigned char>> expandedKey = cache.get(record.key);
+
+            output.clear();
+            AESStream stream(record.mode, record.encrypting, record.key, *expandedKey, record.iv);
+            std::size_t outputLength = 0;
+            output.resize(record.data.size() + NUM_BYTES);
+            const unsigned char* input = record.data.empty() ? output.data() : record.data.data();
+            success = stream.processBuffer(input, record.data.size(), output.data(), outputLength);
+            output.resize(outputLength);
+        }
+
+        if (success)
+            hexEncode(output.data(), output.size(), false, results);
+        else
+            results += "ERROR";
+        results.push_back('\n');
+
+        // Answer promptly when the caller is waiting on each record
+        if (results.size() >= BATCH_FLUSH_SIZE || std::cin.rdbuf()->in_avail() <= 0) {
+            AESTrace::Span span("write", "bytes", (std::int64_t) results.size());
+            std::cout.write(results.data(), results.size());
+            std::cout.flush();
+            results.clear();
+        }
+    }
+
+    std::cout.write(results.data(), results.size());
+    std::cout.flush();
+    return 0;
+}
@@ -0,0 +1,26 @@
+/**
+  @file batch.hpp: Processing many records from one process
+*/
+#ifndef SRC_BATCH_HPP
+#define SRC_BATCH_HPP
+
+#include <string>
+#include <vector>
+#include "AESmodes.hpp"
+
+// Output is written once this much has been buffered, or sooner when no more input is waiting
+#define BATCH_FLUSH_SIZE (1 << 16)
+
+// One line of batch input
+struct BatchRecord {
+    AESMode mode;
+    bool encrypting;
+    std::vector<unsigned char> key;
+    std::vector<unsigned char> iv;
+    std::vector<unsigned char> data;
+};
+
+bool parseBatchRecord(const std::string& line, BatchRecord& record);
+int runBatchMode();
+
+#endif
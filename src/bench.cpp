@@ -0,0 +1,541 @@
+/**
+  @file bench.cpp: Throughput benchmark for the key schedule, the block functions and the mode kernels
+  Every operation is warmed up while its batch size is calibrated, then timed over repetitions of that batch.
+  Results are the median of the repetitions, written as JSON on stdout; progress goes to stderr.
+  Cycles are read from the time stamp counter on x86, which ticks at a constant rate that can differ from
+  the core clock under frequency scaling. Other targets report MB/s only.
+  With --counters the timed repetitions also read core cycles, instructions, L1D read misses and branch misses
+  through perf_event_open on Linux, giving IPC and misses per block. Counters the kernel or CPU refuses are
+  left out of the results, and the benchmark runs without any when none can be opened.
+  Usage: ./bench [--modes ecb,cbc,...] [--keys 128,192,256] [--min-size N] [--max-size N]
+                 [--min-time SECONDS] [--reps N] [--counters] [--out FILE]
+  Sizes take an optional K, M or G suffix and run in steps of four from the minimum, up to 1G.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <array>
+#include <string>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "encrypt.hpp"
+#include "decrypt.hpp"
+#include "AESstream.hpp"
+#include "interface.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BENCH_RDTSC 1
+#include <x86intrin.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#define BENCH_PERF 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+// Shortest time one timed batch should take
+#define BENCH_BATCH_SECONDS 0.01
+// Largest message size accepted
+#define BENCH_MAX_SIZE (1024UL * 1024 * 1024)
+// Upper bound on repetitions of a batch
+#define BENCH_MAX_REPS 1000
+
+// Keeps results alive so the optimiser cannot drop the work
+static volatile unsigned char benchSink;
+
+// Hardware counters read with --counters
+enum PerfCounter { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_BRANCH_MISSES, PERF_NUM_COUNTERS };
+
+struct Measurement {
+    double nsPerOp;
+    double cyclesPerOp;
+    std::uint64_t iterations;
+    unsigned repetitions;
+    // Hardware counts per iteration, negative where the counter is not available
+    double counters[PERF_NUM_COUNTERS];
+};
+
+
+//PerfCounters class
+//A perf_event_open group of the hardware counters, counting user space of this thread only
+class PerfCounters {
+public:
+    PerfCounters() {
+        for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+            fds[i] = -1;
+    }
+
+    ~PerfCounters() {
+#ifdef BENCH_PERF
+        for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+            if (fds[i] >= 0)
+                close(fds[i]);
+#endif
+    }
+
+    /**
+      Opens the counters, skipping any the kernel or CPU refuses
+      @return True if at least one counter was opened
+    */
+    bool open() {
+#ifdef BENCH_PERF
+        const std::uint32_t types[PERF_NUM_COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                                        PERF_TYPE_HARDWARE};
+        const std::uint64_t configs[PERF_NUM_COUNTERS] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_BRANCH_MISSES};
+        int leader = -1;
+        for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.disabled = (leader < 0) ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fds[i] < 0)
+                continue;
+            if (ioctl(fds[i], PERF_EVENT_IOC_ID, &ids[i]) != 0) {
+                close(fds[i]);
+                fds[i] = -1;
+                continue;
+            }
+            if (leader < 0)
+                leader = fds[i];
+        }
+        groupFd = leader;
+        return leader >= 0;
+#else
+        return false;
+#endif
+    }
+
+    bool available(int counter) const {
+        return fds[counter] >= 0;
+    }
+
+    /**
+      Zeroes and starts the group
+      @return none
+    */
+    void start() {
+#ifdef BENCH_PERF
+        ioctl(groupFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(groupFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    /**
+      Stops the group and reads it, scaling the counts up if the kernel multiplexed the counters
+      @param counts: the count of each counter, negative where it is not available
+      @return none
+    */
+    void stop(double counts[PERF_NUM_COUNTERS]) {
+        for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+            counts[i] = -1;
+#ifdef BENCH_PERF
+        ioctl(groupFd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        // nr, time_enabled, time_running, then a value and id per counter
+        std::uint64_t values[3 + 2 * PERF_NUM_COUNTERS];
+        const ssize_t length = read(groupFd, values, sizeof(values));
+        if (length < (ssize_t) (3 * sizeof(std::uint64_t)) || values[2] == 0)
+            return;
+        const double scale = (double) values[1] / values[2];
+        for (std::uint64_t n = 0; n < values[0] && n < PERF_NUM_COUNTERS; n++)
+            for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+                if (fds[i] >= 0 && ids[i] == values[4 + 2 * n])
+                    counts[i] = values[3 + 2 * n] * scale;
+#endif
+    }
+
+private:
+    int fds[PERF_NUM_COUNTERS];
+    std::uint64_t ids[PERF_NUM_COUNTERS];
+    int groupFd = -1;
+};
+
+/**
+  Reads the cycle counter
+  @return the time stamp counter, 0 where there is none
+*/
+static inline std::uint64_t readCycles() {
+#ifdef BENCH_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+  Times an operation, first doubling the batch until it runs for BENCH_BATCH_SECONDS, which also warms caches
+  and branch predictors, then repeating the batch until minSeconds have passed
+  @param operation: callable run once per iteration
+  @param minSeconds: least total time to spend on the timed repetitions
+  @param minReps: least number of timed repetitions
+  @param counters: hardware counters to read over the repetitions, or nullptr
+  @return median time and cycles per iteration, and the mean hardware counts per iteration
+*/
+template <typename Operation>
+static Measurement measure(Operation operation, double minSeconds, unsigned minReps, PerfCounters* counters) {
+    typedef std::chrono::steady_clock Clock;
+    std::uint64_t batch = 1;
+    double batchSeconds = 0;
+    for (;;) {
+        const auto start = Clock::now();
+        for (std::uint64_t i = 0; i < batch; i++)
+            operation();
+        batchSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (batchSeconds >= BENCH_BATCH_SECONDS || batch >= (1ULL << 40))
+            break;
+        batch *= 2;
+    }
+
+    unsigned repetitions = minReps;
+    if (batchSeconds > 0 && minSeconds / batchSeconds > repetitions)
+        repetitions = (unsigned) std::min(minSeconds / batchSeconds + 1, (double) BENCH_MAX_REPS);
+
+    std::vector<double> nanos;
+    std::vector<double> cycles;
+    if (counters != nullptr)
+        counters->start();
+    for (unsigned r = 0; r < repetitions; r++) {
+        const std::uint64_t startCycles = readCycles();
+        const auto start = Clock::now();
+        for (std::uint64_t i = 0; i < batch; i++)
+            operation();
+        const auto end = Clock::now();
+        const std::uint64_t endCycles = readCycles();
+        nanos.push_back(std::chrono::duration<double, std::nano>(end - start).count() / batch);
+        cycles.push_back((double) (endCycles - startCycles) / batch);
+    }
+    Measurement result;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+        result.counters[i] = -1;
+    if (counters != nullptr) {
+        // Clock reads between the repetitions are counted too, which is negligible next to a batch
+        counters->stop(result.counters);
+        for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+            if (result.counters[i] >= 0)
+                result.counters[i] /= (double) batch * repetitions;
+    }
+    std::sort(nanos.begin(), nanos.end());
+    std::sort(cycles.begin(), cycles.end());
+
+    result.nsPerOp = nanos[nanos.size() / 2];
+    result.cyclesPerOp = cycles[cycles.size() / 2];
+    result.iterations = batch;
+    result.repetitions = repetitions;
+    return result;
+}
+
+/**
+  Parses a size with an optional K, M or G suffix
+  @param text: the size
+  @param size: the parsed size in bytes
+  @return True if the size is valid and within BENCH_MAX_SIZE
+*/
+static bool parseSize(const char* text, std::size_t& size) {
+    char* end = nullptr;
+    const unsigned long long value = std::strtoull(text, &end, 10);
+    if (end == text)
+        return false;
+    unsigned long long scale = 1;
+    if (*end == 'K' || *end == 'k')
+        scale = 1024;
+    else if (*end == 'M' || *end == 'm')
+        scale = 1024 * 1024;
+    else if (*end == 'G' || *end == 'g')
+        scale = 1024 * 1024 * 1024;
+    if (scale != 1)
+        end++;
+    if (*end != '\0' || value == 0 || value > BENCH_MAX_SIZE / scale)
+        return false;
+    size = (std::size_t) (value * scale);
+    return true;
+}
+
+/**
+  Splits a comma separated list
+  @param text: the list
+  @return its items
+*/
+static std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+/**
+  Name of a mode for the results
+  @param mode: the mode
+  @return its lower case name
+*/
+static const char* modeName(AESMode mode) {
+    switch (mode) {
+        case MODE_ECB: return "ecb";
+        case MODE_CBC: return "cbc";
+        case MODE_CTS: return "cts";
+        case MODE_CFB: return "cfb";
+        case MODE_OFB: return "ofb";
+        case MODE_CTR: return "ctr";
+        default: return "invalid";
+    }
+}
+
+/**
+  Writes one result as a JSON object
+  @param json: destination
+  @param first: whether this is the first result, which has no leading comma
+  @param operation: name of the operation
+  @param fields: extra JSON fields, each followed by a comma
+  @param bytes: bytes processed per iteration, 0 for operations measured per call
+  @param measurement: the timing
+  @param cycleCounter: whether cycle counts are available
+  @return none
+*/
+static void writeResult(std::ostream& json, bool& first, const char* operation, const std::string& fields,
+                        std::size_t bytes, const Measurement& measurement, bool cycleCounter) {
+    json << (first ? "\n" : ",\n") << "    {\"operation\": \"" << operation << "\", " << fields
+         << "\"iterations\": " << measurement.iterations << ", \"repetitions\": " << measurement.repetitions
+         << ", \"ns_per_op\": " << measurement.nsPerOp;
+    if (cycleCounter)
+        json << ", \"cycles_per_op\": " << measurement.cyclesPerOp;
+    if (bytes > 0) {
+        json << ", \"bytes\": " << bytes << ", \"mb_per_s\": " << (bytes * 1000.0 / measurement.nsPerOp);
+        if (cycleCounter)
+            json << ", \"cycles_per_byte\": " << (measurement.cyclesPerOp / bytes);
+    }
+
+    // Hardware counts are per block for data and per call otherwise
+    const double units = (bytes > 0) ? (double) bytes / NUM_BYTES : 1.0;
+    const char* unit = (bytes > 0) ? "block" : "op";
+    const double* counts = measurement.counters;
+    if (counts[PERF_CYCLES] > 0 && counts[PERF_INSTRUCTIONS] >= 0)
+        json << ", \"ipc\": " << (counts[PERF_INSTRUCTIONS] / counts[PERF_CYCLES]);
+    if (counts[PERF_CYCLES] >= 0)
+        json << ", \"core_cycles_per_" << unit << "\": " << (counts[PERF_CYCLES] / units);
+    if (counts[PERF_INSTRUCTIONS] >= 0)
+        json << ", \"instructions_per_" << unit << "\": " << (counts[PERF_INSTRUCTIONS] / units);
+    if (counts[PERF_L1D_MISSES] >= 0)
+        json << ", \"l1d_misses_per_" << unit << "\": " << (counts[PERF_L1D_MISSES] / units);
+    if (counts[PERF_BRANCH_MISSES] >= 0)
+        json << ", \"branch_misses_per_" << unit << "\": " << (counts[PERF_BRANCH_MISSES] / units);
+    json << "}";
+    first = false;
+}
+
+int main(int argc, char** argv) {
+    std::vector<AESMode> modes = {MODE_ECB, MODE_CBC, MODE_CFB, MODE_OFB, MODE_CTR};
+    std::vector<unsigned> keyBits = {128, 192, 256};
+    std::size_t minSize = 16;
+    std::size_t maxSize = 1024 * 1024;
+    double minSeconds = 0.1;
+    unsigned minReps = 5;
+    std::string outPath;
+    bool useCounters = false;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string option = argv[i];
+        if (option == "--counters") {
+            useCounters = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing or invalid value for option.\n";
+            return 2;
+        }
+        const char* value = argv[++i];
+        bool valid = true;
+        if (option == "--modes") {
+            modes.clear();
+            for (const std::string& name : splitList(value)) {
+                const AESMode mode = getMode(name.c_str());
+                // CTS needs a partial final block, which the block kernels do not take
+                valid = valid && mode != MODE_INVALID && mode != MODE_CTS;
+                modes.push_back(mode);
+            }
+            valid = valid && !modes.empty();
+        } else if (option == "--keys") {
+            keyBits.clear();
+            for (const std::string& bits : splitList(value)) {
+                const int parsed = std::atoi(bits.c_str());
+                valid = valid && (parsed == 128 || parsed == 192 || parsed == 256);
+                keyBits.push_back((unsigned) parsed);
+            }
+            valid = valid && !keyBits.empty();
+        } else if (option == "--min-size") {
+            valid = parseSize(value, minSize) && minSize % NUM_BYTES == 0;
+        } else if (option == "--max-size") {
+            valid = parseSize(value, maxSize);
+        } else if (option == "--min-time") {
+            minSeconds = std::atof(value);
+            valid = minSeconds >= 0;
+        } else if (option == "--reps") {
+            minReps = (unsigned) std::atoi(value);
+            valid = minReps >= 1 && minReps <= BENCH_MAX_REPS;
+        } else if (option == "--out") {
+            outPath = value;
+        } else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 2;
+        }
+        if (!valid) {
+            std::cerr << "Missing or invalid value for option.\n";
+            return 2;
+        }
+    }
+    if (minSize > maxSize) {
+        std::cerr << "Minimum size is larger than the maximum size.\n";
+        return 2;
+    }
+
+#ifdef BENCH_RDTSC
+    const bool cycleCounter = true;
+#else
+    const bool cycleCounter = false;
+#endif
+
+    PerfCounters perfCounters;
+    PerfCounters* counters = nullptr;
+    if (useCounters) {
+        if (perfCounters.open())
+            counters = &perfCounters;
+        else
+            std::cerr << "Hardware counters are unavailable, continuing without them.\n";
+    }
+
+    std::mt19937 generator(std::random_device{}());
+    std::vector<unsigned char> message(maxSize);
+    for (unsigned char& byte : message) byte = (unsigned char) generator();
+
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3)
+         << "{\n  \"cycle_counter\": \"" << (cycleCounter ? "rdtsc" : "none") << "\",\n"
+         << "  \"perf_counters\": [";
+    const char* counterNames[PERF_NUM_COUNTERS] = {"cycles", "instructions", "l1d_read_misses", "branch_misses"};
+    bool firstCounter = true;
+    for (int i = 0; i < PERF_NUM_COUNTERS && counters != nullptr; i++) {
+        if (counters->available(i)) {
+            json << (firstCounter ? "\"" : ", \"") << counterNames[i] << "\"";
+            firstCounter = false;
+        }
+    }
+    json << "],\n"
+         << "  \"min_time\": " << minSeconds << ",\n  \"min_repetitions\": " << minReps << ",\n"
+         << "  \"results\": [";
+    bool first = true;
+
+    for (unsigned bits : keyBits) {
+        const unsigned char keySize = (unsigned char) (bits / 8);
+        std::vector<unsigned char> key(keySize);
+        for (unsigned char& byte : key) byte = (unsigned char) generator();
+        std::vector<unsigned char> expandedKey(NUM_BYTES * (keySize / 4 + 7));
+        const std::string keyField = "\"key_bits\": " + std::to_string(bits) + ", ";
+
+        std::cerr << "AES-" << bits << " key schedule and single blocks\n";
+        writeResult(json, first, "keyExpansion", keyField, 0, measure([&]() {
+            keyExpansion(key, expandedKey, keySize);
+            benchSink = expandedKey.back();
+        }, minSeconds, minReps, counters), cycleCounter);
+
+        // Reported per key, so it compares directly with keyExpansion
+        std::vector<std::vector<unsigned char>> batchKeys(KEY_EXPANSION_BATCH, key);
+        std::vector<std::vector<unsigned char>> batchExpansions;
+        for (std::size_t i = 0; i < batchKeys.size(); i++) batchKeys[i][0] ^= (unsigned char) i;
+        Measurement batch = measure([&]() {
+            keyExpansionBatch(batchKeys, batchExpansions, keySize);
+            benchSink = batchExpansions.back().back();
+        }, minSeconds, minReps, counters);
+        batch.nsPerOp /= KEY_EXPANSION_BATCH;
+        batch.cyclesPerOp /= KEY_EXPANSION_BATCH;
+        for (double& count : batch.counters) {
+            if (count >= 0)
+                count /= KEY_EXPANSION_BATCH;
+        }
+        writeResult(json, first, "keyExpansionBatch", keyField + "\"batch\": " + std::to_string(KEY_EXPANSION_BATCH) + ", ",
+                    0, batch, cycleCounter);
+
+        std::array<unsigned char, NUM_BYTES> block;
+        std::array<unsigned char, NUM_BYTES> result;
+        std::copy(message.begin(), message.begin() + NUM_BYTES, block.begin());
+        // encrypt() and decrypt() expand the key on every call, the Expanded versions take the schedule
+        writeResult(json, first, "encrypt", keyField, NUM_BYTES, measure([&]() {
+            encrypt(block, result, key);
+            block[0] ^= result[0];
+        }, minSeconds, minReps, counters), cycleCounter);
+        writeResult(json, first, "decrypt", keyField, NUM_BYTES, measure([&]() {
+            decrypt(block, result, key);
+            block[0] ^= result[0];
+        }, minSeconds, minReps, counters), cycleCounter);
+        writeResult(json, first, "encryptExpanded", keyField, NUM_BYTES, measure([&]() {
+            encryptExpanded(block, result, expandedKey);
+            block[0] ^= result[0];
+        }, minSeconds, minReps, counters), cycleCounter);
+        writeResult(json, first, "decryptExpanded", keyField, NUM_BYTES, measure([&]() {
+            decryptExpanded(block, result, expandedKey);
+            block[0] ^= result[0];
+        }, minSeconds, minReps, counters), cycleCounter);
+        benchSink = block[0];
+
+        for (AESMode mode : modes) {
+            const std::vector<unsigned char> iv(NUM_BYTES, 0x5a);
+            for (int direction = 0; direction < 2; direction++) {
+                const bool encrypting = direction == 0;
+                AESStream stream(mode, encrypting, key, expandedKey, iv);
+                std::vector<unsigned char> output(maxSize);
+                std::cerr << "AES-" << bits << " " << modeName(mode) << (encrypting ? " encrypt" : " decrypt") << "\n";
+
+                for (std::size_t size = minSize; size <= maxSize; size *= 4) {
+                    bool ok = true;
+                    const Measurement measurement = measure([&]() {
+                        ok = stream.transformBlocks(message.data(), output.data(), size / NUM_BYTES) && ok;
+                        benchSink = output[0];
+                    }, minSeconds, minReps, counters);
+                    if (!ok) {
+                        std::cerr << "Error: the " << modeName(mode) << " kernel failed.\n";
+                        return 3;
+                    }
+                    const std::string fields = keyField + "\"mode\": \"" + modeName(mode) + "\", \"direction\": \"" +
+                                               (encrypting ? "encrypt" : "decrypt") + "\", ";
+                    writeResult(json, first, "mode", fields, size, measurement, cycleCounter);
+                    if (size > maxSize / 4)
+                        break;
+                }
+            }
+        }
+    }
+    json << "\n  ]\n}\n";
+
+    if (outPath.empty()) {
+        std::cout << json.str();
+        return 0;
+    }
+    std::ofstream out(outPath);
+    out << json.str();
+    if (!out.good()) {
+        std::cerr << "Error: could not write " << outPath << "\n";
+        return 5;
+    }
+    return 0;
+}
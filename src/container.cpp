@@ -0,0 +1,738 @@
+/**
+  @file container.cpp: Chunked container file format
+  A container records everything needed to decrypt it except the key, and splits the data into
+  fixed-size chunks that are encrypted independently, so chunks can be processed on all cores and
+  any chunk can be decrypted without touching the others.
+
+  Layout, all integers big-endian:
+    Header, 64 bytes
+      0   "AESC"
+      4   version
+      5   mode, an AESMode value other than MODE_CTS
+      6   key size in bytes
+      7   flags, CONTAINER_FLAG_TAGS
+      8   chunk size, a multiple of 16, no larger than the padded length with a single chunk
+      12  reserved, zero
+      16  plaintext length
+      24  number of chunks, always length / chunk size + 1
+      32  base IV, or the nonce followed by zeros for CTR
+      48  header tag, zero without tags
+    Chunks, from offset 64
+      Every chunk holds chunk size bytes of plaintext except the last, which holds the remainder
+      with PKCS#7 padding, so no chunk is longer than the chunk size.
+    Index, one 32 byte entry per chunk after the last chunk
+      0   offset of the chunk
+      8   stored length of the chunk
+      12  reserved, zero
+      16  chunk tag, zero without tags
+
+  Chunk i of CBC, CFB and OFB starts from the IV E(K, base IV XOR i), i in the last 8 bytes.
+  CTR chunks continue the counter of the previous chunk, so the data is the same as plain CTR.
+  Tags are AES-CMAC over the first 48 header bytes, the 8 byte chunk number and the stored chunk,
+  with a tag key derived from the key by the SP 800-108 counter mode KDF using CMAC.
+*/
+
+#include <thread>
+#include <atomic>
+#include <new>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "container.hpp"
+#include "AESStats.hpp"
+#include "AESTrace.hpp"
+
+static const unsigned char CONTAINER_MAGIC[4] = {'A', 'E', 'S', 'C'};
+
+
+/**
+  Store an integer big-endian
+  @param dest: first byte to write
+  @param value: value to store
+  @param numBytes: number of bytes to write
+  @return none
+*/
+static void storeBigEndian(unsigned char* dest, std::uint64_t value, int numBytes) {
+    for (int i = numBytes - 1; i >= 0; i--) {
+        dest[i] = (unsigned char) value;
+        value >>= 8;
+    }
+}
+
+/**
+  Load a big-endian integer
+  @param src: first byte to read
+  @param numBytes: number of bytes to read
+  @return the value
+*/
+static std::uint64_t loadBigEndian(const unsigned char* src, int numBytes) {
+    std::uint64_t value = 0;
+    for (int i = 0; i < numBytes; i++) {
+        value = (value << 8) | src[i];
+    }
+    return value;
+}
+
+/**
+  Read exactly length bytes at an offset
+  @return false on an error or a short file
+*/
+static bool preadFull(int fd, unsigned char* buffer, std::size_t length, std::uint64_t offset) {
+    AES_STAT_TIMER(timer, STAT_NS_READ);
+    AESTrace::Span span("read", "bytes", (std::int64_t) length);
+    std::size_t done = 0;
+    while (done < length) {
+        ssize_t count = pread(fd, buffer + done, length - done, (off_t) (offset + done));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        done += (std::size_t) count;
+    }
+    return true;
+}
+
+/**
+  Write exactly length bytes at an offset
+  @return false on an error
+*/
+static bool pwriteFull(int fd, const unsigned char* buffer, std::size_t length, std::uint64_t offset) {
+    AES_STAT_TIMER(timer, STAT_NS_WRITE);
+    AESTrace::Span span("write", "bytes", (std::int64_t) length);
+    std::size_t done = 0;
+    while (done < length) {
+        ssize_t count = pwrite(fd, buffer + done, length - done, (off_t) (offset + done));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        done += (std::size_t) count;
+    }
+    return true;
+}
+
+
+//Cmac class, AES-CMAC (SP 800-38B) computed incrementally
+class Cmac {
+public:
+    /**
+      Cmac constructor
+      @param expandedKey: key schedule of the MAC key
+    */
+    explicit Cmac(const std::vector<unsigned char>& expandedKey) : expandedKey(expandedKey), state(), buffer() {
+        std::array<unsigned char, NUM_BYTES> zero = {};
+        std::array<unsigned char, NUM_BYTES> l;
+        encryptExpanded(zero, l, expandedKey);
+        doubleBlock(l, this->subkey1);
+        doubleBlock(this->subkey1, this->subkey2);
+    }
+
+    /**
+      Add data to the message
+      @param data: bytes to add
+      @param length: number of bytes
+      @return none
+    */
+    void update(const unsigned char* data, std::size_t length) {
+        for (std::size_t i = 0; i < length; i++) {
+            // The last block is handled by finish(), so a full buffer is only processed once more data arrives
+            if (this->used == NUM_BYTES) {
+                this->processBuffer();
+            }
+            this->buffer[this->used++] = data[i];
+        }
+    }
+
+    /**
+      Finish the message
+      @param tag: set to the CMAC tag
+      @return none
+    */
+    void finish(std::array<unsigned char, NUM_BYTES>& tag) {
+        const std::array<unsigned char, NUM_BYTES>& subkey = (this->used == NUM_BYTES) ? this->subkey1 : this->subkey2;
+        if (this->used < NUM_BYTES) {
+            this->buffer[this->used] = 0x80;
+            std::fill(this->buffer.begin() + this->used + 1, this->buffer.end(), 0);
+        }
+        for (std::size_t i = 0; i < NUM_BYTES; i++) {
+            this->state[i] ^= this->buffer[i] ^ subkey[i];
+        }
+        encryptExpanded(this->state, tag, this->expandedKey);
+    }
+
+private:
+    /**
+      Multiply a block by x in GF(2^128)
+      @return none
+    */
+    static void doubleBlock(const std::array<unsigned char, NUM_BYTES>& input, std::array<unsigned char, NUM_BYTES>& output) {
+        const unsigned char carry = input[0] >> 7;
+        for (std::size_t i = 0; i < NUM_BYTES - 1; i++) {
+            output[i] = (unsigned char) ((input[i] << 1) | (input[i + 1] >> 7));
+        }
+        output[NUM_BYTES - 1] = (unsigned char) ((input[NUM_BYTES - 1] << 1) ^ (carry * 0x87));
+    }
+
+    void processBuffer() {
+        for (std::size_t i = 0; i < NUM_BYTES; i++) {
+            this->state[i] ^= this->buffer[i];
+        }
+        encryptExpanded(this->state, this->state, this->expandedKey);
+        this->used = 0;
+    }
+
+    const std::vector<unsigned char>& expandedKey;
+    std::array<unsigned char, NUM_BYTES> subkey1;
+    std::array<unsigned char, NUM_BYTES> subkey2;
+    std::array<unsigned char, NUM_BYTES> state;
+    std::array<unsigned char, NUM_BYTES> buffer;
+    std::size_t used = 0;
+};
+
+
+/**
+  ContainerKeys constructor
+  Expands the key, and derives and expands the tag key when tags are needed
+  @param key: key of the containers
+  @param tagged: true if the tag key is needed
+*/
+ContainerKeys::ContainerKeys(const std::vector<unsigned char>& key, bool tagged)
+        : keySize(key.size()), expanded(16 * (key.size() / 4 + 7), 0), tagExpanded() {
+    keyExpansion(key, this->expanded, (unsigned char) key.size());
+    if (!tagged)
+        return;
+
+    // SP 800-108 counter mode: CMAC(K, [i] || label || 0x00 || [bits]) for i = 1, 2
+    static const char label[] = "AES container tag key";
+    std::vector<unsigned char> tagKey;
+    for (std::uint32_t i = 1; tagKey.size() < key.size(); i++) {
+        unsigned char counter[4];
+        unsigned char bits[4];
+        storeBigEndian(counter, i, 4);
+        storeBigEndian(bits, key.size() * 8, 4);
+
+        Cmac cmac(this->expanded);
+        cmac.update(counter, sizeof(counter));
+        cmac.update((const unsigned char*) label, sizeof(label));
+        cmac.update(bits, sizeof(bits));
+        std::array<unsigned char, NUM_BYTES> block;
+        cmac.finish(block);
+        tagKey.insert(tagKey.end(), block.begin(), block.end());
+    }
+    tagKey.resize(key.size());
+
+    this->tagExpanded.assign(this->expanded.size(), 0);
+    keyExpansion(tagKey, this->tagExpanded, (unsigned char) tagKey.size());
+    std::fill(tagKey.begin(), tagKey.end(), 0);
+}
+
+/**
+  ContainerKeys destructor
+  Wipes the key schedules
+*/
+ContainerKeys::~ContainerKeys() {
+    std::fill(this->expanded.begin(), this->expanded.end(), 0);
+    std::fill(this->tagExpanded.begin(), this->tagExpanded.end(), 0);
+}
+
+/**
+  Stored length of a chunk
+  @return chunk size for every chunk but the last, the padded remainder for the last
+*/
+static std::size_t storedLength(const ContainerHeader& header, std::uint64_t chunk) {
+    if (chunk + 1 < header.numChunks)
+        return header.chunkSize;
+    const std::size_t remainder = (std::size_t) (header.length - chunk * header.chunkSize);
+    return ((remainder / NUM_BYTES) + 1) * NUM_BYTES;
+}
+
+/**
+  Offset of the index, directly after the last chunk
+*/
+static std::uint64_t indexOffset(const ContainerHeader& header) {
+    return CONTAINER_HEADER_SIZE + (header.numChunks - 1) * header.chunkSize + storedLength(header, header.numChunks - 1);
+}
+
+/**
+  Encode the header
+  @param header: header fields
+  @param keys: key schedules, the tag key is used when the header is tagged
+  @param bytes: set to the encoded header
+  @return none
+*/
+static void encodeHeader(const ContainerHeader& header, const ContainerKeys& keys,
+                         std::array<unsigned char, CONTAINER_HEADER_SIZE>& bytes) {
+    bytes.fill(0);
+    std::memcpy(bytes.data(), CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+    bytes[4] = CONTAINER_VERSION;
+    bytes[5] = (unsigned char) header.mode;
+    bytes[6] = (unsigned char) header.keySize;
+    bytes[7] = header.tagged ? CONTAINER_FLAG_TAGS : 0;
+    storeBigEndian(&bytes[8], header.chunkSize, 4);
+    storeBigEndian(&bytes[16], header.length, 8);
+    storeBigEndian(&bytes[24], header.numChunks, 8);
+    std::copy(header.iv.begin(), header.iv.end(), bytes.begin() + 32);
+
+    if (header.tagged) {
+        std::array<unsigned char, NUM_BYTES> tag;
+        Cmac cmac(keys.tagExpanded);
+        cmac.update(bytes.data(), 48);
+        cmac.finish(tag);
+        std::copy(tag.begin(), tag.end(), bytes.begin() + 48);
+    }
+}
+
+/**
+  Tag of one stored chunk
+  @param headerBytes: encoded header
+  @param keys: key schedules
+  @param chunk: chunk number
+  @param data: stored chunk
+  @param length: stored length
+  @param tag: set to the tag
+  @return none
+*/
+static void chunkTag(const std::array<unsigned char, CONTAINER_HEADER_SIZE>& headerBytes, const ContainerKeys& keys,
+                     std::uint64_t chunk, const unsigned char* data, std::size_t length,
+                     std::array<unsigned char, NUM_BYTES>& tag) {
+    unsigned char number[8];
+    storeBigEndian(number, chunk, 8);
+
+    Cmac cmac(keys.tagExpanded);
+    cmac.update(headerBytes.data(), 48);
+    cmac.update(number, sizeof(number));
+    cmac.update(data, length);
+    cmac.finish(tag);
+}
+
+/**
+  Encrypt or decrypt one chunk in place with its derived IV or counter
+  @param header: header fields
+  @param keys: key schedules
+  @param encrypting: true to encrypt, false to decrypt
+  @param chunk: chunk number
+  @param data: chunk to transform
+  @param length: length of the chunk, a multiple of 16
+  @return none
+*/
+static void cryptChunk(const ContainerHeader& header, const ContainerKeys& keys, bool encrypting,
+                       std::uint64_t chunk, unsigned char* data, std::size_t length) {
+    const std::size_t numBlocks = length / NUM_BYTES;
+    std::array<unsigned char, NUM_BYTES> chain = header.iv;
+    AESTrace::Span span(encrypting ? "encrypt chunk" : "decrypt chunk", "chunk", (std::int64_t) chunk);
+    AES_STAT_TIMER(timer, STAT_NS_CIPHER);
+    AES_STAT_ADD(AESStats::blocks(header.mode, encrypting), numBlocks);
+
+    if (header.mode == MODE_CTR) {
+        // The nonce is followed by a zero counter, which every chunk advances past the blocks before it
+        storeBigEndian(&chain[NUM_BYTES / 2], chunk * (header.chunkSize / NUM_BYTES), NUM_BYTES / 2);
+    }
+    else if (header.mode != MODE_ECB) {
+        for (std::size_t i = 0; i < 8; i++) {
+            chain[NUM_BYTES - 1 - i] ^= (unsigned char) (chunk >> (8 * i));
+        }
+        encryptExpanded(chain, chain, keys.expanded);
+    }
+
+    switch (header.mode) {
+        case MODE_ECB:
+            if (encrypting)
+                encrypt_ecb_blocks(data, data, numBlocks, keys.expanded);
+            else
+                decrypt_ecb_blocks(data, data, numBlocks, keys.expanded);
+            break;
+        case MODE_CBC:
+            if (encrypting)
+                encrypt_cbc_blocks(data, data, numBlocks, keys.expanded, chain);
+            else
+                decrypt_cbc_blocks(data, data, numBlocks, keys.expanded, chain);
+            break;
+        case MODE_CFB:
+            if (encrypting)
+                encrypt_cfb_blocks(data, data, numBlocks, keys.expanded, chain);
+            else
+                decrypt_cfb_blocks(data, data, numBlocks, keys.expanded, chain);
+            break;
+        case MODE_OFB:
+            crypt_ofb_blocks(data, data, numBlocks, keys.expanded, chain);
+            break;
+        case MODE_CTR:
+            crypt_ctr_blocks(data, data, numBlocks, keys.expanded, chain);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+  Run a job for every chunk on a number of threads, each thread taking the next unclaimed chunk
+  @param numThreads: number of threads, 0 for one per core
+  @param numChunks: number of chunks
+  @param bufferSize: size of the buffer given to each job
+  @param job: called with the chunk number and the thread's buffer, returns 0 or an error code
+  @return 0, 5 if a buffer cannot be allocated, or the first error code returned by a job
+*/
+template <typename Job>
+static int forEachChunk(unsigned numThreads, std::uint64_t numChunks, std::size_t bufferSize, Job job) {
+    if (numThreads == 0)
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    numThreads = (unsigned) std::min<std::uint64_t>(numThreads, numChunks);
+
+    std::atomic<std::uint64_t> next(0);
+    std::atomic<int> result(0);
+    auto worker = [&]() {
+        AESTrace::nameThread("chunk worker");
+        std::vector<unsigned char> buffer;
+        try {
+            buffer.resize(bufferSize);
+        }
+        catch (const std::bad_alloc&) {
+            int expected = 0;
+            result.compare_exchange_strong(expected, 5);
+            return;
+        }
+        while (result == 0) {
+            const std::uint64_t chunk = next++;
+            if (chunk >= numChunks)
+                break;
+            int code = job(chunk, buffer);
+            if (code != 0) {
+                int expected = 0;
+                result.compare_exchange_strong(expected, code);
+            }
+        }
+        std::fill(buffer.begin(), buffer.end(), 0);
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < numThreads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return result;
+}
+
+/**
+  Start encrypting a regular file into a container
+  Sizes the output, after which the chunks can be processed in any order on any thread
+  @param inFd: regular file to encrypt
+  @param outFd: regular file the container is written to
+  @param mode: mode of operation, any but MODE_CTS
+  @param iv: base IV, or the 8 byte nonce for CTR, ignored for ECB
+  @param chunkSize: plaintext bytes per chunk, a non-zero multiple of 16
+  @param tagged: true to store a tag for the header and every chunk, keys must then have the tag key
+  @param keys: key schedules
+  @param task: set up for processContainerChunk()
+  @return 0 on success, 3 on invalid parameters, 5 on an I/O error
+*/
+int beginEncryptContainer(int inFd, int outFd, AESMode mode, const std::vector<unsigned char>& iv, std::size_t chunkSize,
+                          bool tagged, const ContainerKeys& keys, ContainerTask& task) {
+    if (mode == MODE_CTS || mode == MODE_INVALID || chunkSize == 0 || chunkSize % NUM_BYTES != 0 ||
+        chunkSize > CONTAINER_MAX_CHUNK_SIZE || (tagged && keys.tagExpanded.empty()))
+        return 3;
+
+    struct stat info;
+    if (fstat(inFd, &info) != 0 || !S_ISREG(info.st_mode))
+        return 5;
+
+    ContainerHeader& header = task.header;
+    header.mode = mode;
+    header.keySize = keys.keySize;
+    header.tagged = tagged;
+    header.length = (std::uint64_t) info.st_size;
+    // A single chunk is stored at its padded length, so the header never asks for more than the data
+    if (header.length < chunkSize)
+        chunkSize = (std::size_t) (header.length / NUM_BYTES + 1) * NUM_BYTES;
+    header.chunkSize = (std::uint32_t) chunkSize;
+    header.numChunks = header.length / chunkSize + 1;
+    header.iv.fill(0);
+    if (mode != MODE_ECB)
+        std::copy(iv.begin(), iv.begin() + std::min(iv.size(), (std::size_t) NUM_BYTES), header.iv.begin());
+
+    task.inFd = inFd;
+    task.outFd = outFd;
+    task.encrypting = true;
+    encodeHeader(header, keys, task.headerBytes);
+    task.tags.assign(tagged ? header.numChunks : 0, std::array<unsigned char, NUM_BYTES>());
+
+    if (ftruncate(outFd, (off_t) (indexOffset(header) + header.numChunks * CONTAINER_INDEX_ENTRY_SIZE)) != 0)
+        return 5;
+    return 0;
+}
+
+/**
+  Start decrypting a container into a regular file
+  @param inFd: container file
+  @param outFd: regular file the plaintext is written to
+  @param keys: key schedules, with the tag key if the container may be tagged
+  @param requireTags: true to reject a container without tags
+  @param task: set up for processContainerChunk()
+  @return 0 on success, 3 if the header is invalid, untagged when tags are required or fails its tag, 5 on an I/O error
+*/
+int beginDecryptContainer(int inFd, int outFd, const ContainerKeys& keys, bool requireTags, ContainerTask& task) {
+    int result = readContainerHeader(inFd, keys, requireTags, task.header);
+    if (result != 0)
+        return result;
+
+    task.inFd = inFd;
+    task.outFd = outFd;
+    task.encrypting = false;
+    encodeHeader(task.header, keys, task.headerBytes);
+    task.tags.clear();
+
+    if (ftruncate(outFd, (off_t) task.header.length) != 0)
+        return 5;
+    return 0;
+}
+
+/**
+  Read, check and decrypt one chunk
+  @param fd: container file
+  @param header: header fields from readContainerHeader()
+  @param headerBytes: encoded header
+  @param keys: key schedules
+  @param chunk: chunk number
+  @param buffer: buffer of at least the stored length of the chunk, set to the plaintext
+  @param length: set to the plaintext length of the chunk
+  @return 0 on success, 3 if the chunk fails its tag or padding, 5 on an I/O error
+*/
+static int readChunk(int fd, const ContainerHeader& header, const std::array<unsigned char, CONTAINER_HEADER_SIZE>& headerBytes,
+                     const ContainerKeys& keys, std::uint64_t chunk, unsigned char* buffer, std::size_t& length) {
+    const std::size_t stored = storedLength(header, chunk);
+    const std::uint64_t offset = CONTAINER_HEADER_SIZE + chunk * header.chunkSize;
+
+    unsigned char entry[CONTAINER_INDEX_ENTRY_SIZE];
+    if (!preadFull(fd, entry, sizeof(entry), indexOffset(header) + chunk * CONTAINER_INDEX_ENTRY_SIZE) ||
+        !preadFull(fd, buffer, stored, offset))
+        return 5;
+    if (loadBigEndian(entry, 8) != offset || loadBigEndian(entry + 8, 4) != stored)
+        return 3;
+
+    // Tags are checked before anything is decrypted
+    if (header.tagged) {
+        std::array<unsigned char, NUM_BYTES> tag;
+        chunkTag(headerBytes, keys, chunk, buffer, stored, tag);
+        unsigned char difference = 0;
+        for (std::size_t i = 0; i < NUM_BYTES; i++) {
+            difference |= tag[i] ^ entry[16 + i];
+        }
+        if (difference != 0)
+            return 3;
+    }
+
+    cryptChunk(header, keys, false, chunk, buffer, stored);
+
+    length = stored;
+    if (chunk + 1 == header.numChunks) {
+        length = (std::size_t) (header.length - chunk * header.chunkSize);
+        // Every padding byte is compared before deciding, like unpadded_length(), so the time does not depend
+        // on where the padding first differs
+        const unsigned char pad = (unsigned char) (stored - length);
+        unsigned char difference = 0;
+        for (std::size_t i = length; i < stored; i++) {
+            difference |= buffer[i] ^ pad;
+        }
+        if (difference != 0)
+            return 3;
+    }
+    return 0;
+}
+
+/**
+  Encrypt or decrypt one chunk of a container, safe to call for different chunks of a task at once
+  @param task: task from beginEncryptContainer() or beginDecryptContainer()
+  @param keys: key schedules the task was started with
+  @param chunk: chunk number
+  @param buffer: buffer of at least the stored length of the chunk
+  @return 0 on success, 3 if the chunk fails its tag or padding, 5 on an I/O error
+*/
+int processContainerChunk(ContainerTask& task, const ContainerKeys& keys, std::uint64_t chunk,
+                          std::vector<unsigned char>& buffer) {
+    const ContainerHeader& header = task.header;
+    const std::uint64_t offset = chunk * header.chunkSize;
+
+    if (!task.encrypting) {
+        std::size_t length;
+        int result = readChunk(task.inFd, header, task.headerBytes, keys, chunk, buffer.data(), length);
+        if (result != 0)
+            return result;
+        return pwriteFull(task.outFd, buffer.data(), length, offset) ? 0 : 5;
+    }
+
+    const std::size_t length = (std::size_t) std::min<std::uint64_t>(header.chunkSize, header.length - offset);
+    const std::size_t stored = storedLength(header, chunk);
+    if (!preadFull(task.inFd, buffer.data(), length, offset))
+        return 5;
+
+    // PKCS#7 padding on the last chunk only
+    std::fill(buffer.begin() + length, buffer.begin() + stored, (unsigned char) (stored - length));
+
+    cryptChunk(header, keys, true, chunk, buffer.data(), stored);
+    if (header.tagged)
+        chunkTag(task.headerBytes, keys, chunk, buffer.data(), stored, task.tags[chunk]);
+    return pwriteFull(task.outFd, buffer.data(), stored, CONTAINER_HEADER_SIZE + offset) ? 0 : 5;
+}
+
+/**
+  Complete a container once every chunk has been processed
+  Encryption writes the index and then the header, so an interrupted container never has a valid header
+  @param task: task whose chunks are all done
+  @return 0 on success, 5 on an I/O error
+*/
+int finishContainer(ContainerTask& task) {
+    if (!task.encrypting)
+        return 0;
+
+    const ContainerHeader& header = task.header;
+    std::vector<unsigned char> entries(header.numChunks * CONTAINER_INDEX_ENTRY_SIZE, 0);
+    for (std::uint64_t chunk = 0; chunk < header.numChunks; chunk++) {
+        unsigned char* entry = &entries[chunk * CONTAINER_INDEX_ENTRY_SIZE];
+        storeBigEndian(entry, CONTAINER_HEADER_SIZE + chunk * header.chunkSize, 8);
+        storeBigEndian(entry + 8, storedLength(header, chunk), 4);
+        if (header.tagged)
+            std::copy(task.tags[chunk].begin(), task.tags[chunk].end(), entry + 16);
+    }
+
+    if (!pwriteFull(task.outFd, entries.data(), entries.size(), indexOffset(header)) ||
+        !pwriteFull(task.outFd, task.headerBytes.data(), task.headerBytes.size(), 0))
+        return 5;
+    return 0;
+}
+
+/**
+  Encrypt a regular file into a container
+  @param inFd: regular file to encrypt
+  @param outFd: regular file the container is written to
+  @param mode: mode of operation, any but MODE_CTS
+  @param key: key to use
+  @param iv: base IV, or the 8 byte nonce for CTR, ignored for ECB
+  @param chunkSize: plaintext bytes per chunk, a non-zero multiple of 16
+  @param tagged: true to store a tag for the header and every chunk
+  @param numThreads: number of threads, 0 for one per core
+  @return 0 on success, 3 on invalid parameters, 5 on an I/O error
+*/
+int encryptContainer(int inFd, int outFd, AESMode mode, const std::vector<unsigned char>& key,
+                     const std::vector<unsigned char>& iv, std::size_t chunkSize, bool tagged, unsigned numThreads) {
+    ContainerKeys keys(key, tagged);
+    ContainerTask task;
+    int result = beginEncryptContainer(inFd, outFd, mode, iv, chunkSize, tagged, keys, task);
+    if (result != 0)
+        return result;
+
+    result = forEachChunk(numThreads, task.header.numChunks, storedLength(task.header, 0),
+                          [&](std::uint64_t chunk, std::vector<unsigned char>& buffer) {
+        return processContainerChunk(task, keys, chunk, buffer);
+    });
+    return result != 0 ? result : finishContainer(task);
+}
+
+/**
+  Read and check a container header
+  @param fd: container file
+  @param keys: key schedules, with the tag key to check a tagged header
+  @param requireTags: true to reject a header without tags
+  @param header: set to the header fields
+  @return 0 on success, 3 if the header is invalid, does not match the key size, is untagged when tags are
+          required or fails its tag, 5 on an I/O error
+*/
+int readContainerHeader(int fd, const ContainerKeys& keys, bool requireTags, ContainerHeader& header) {
+    AESTrace::Span span("parse header");
+    std::array<unsigned char, CONTAINER_HEADER_SIZE> bytes;
+    struct stat info;
+    if (!preadFull(fd, bytes.data(), bytes.size(), 0) || fstat(fd, &info) != 0)
+        return 5;
+
+    if (std::memcmp(bytes.data(), CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) != 0 || bytes[4] != CONTAINER_VERSION)
+        return 3;
+
+    ContainerHeader parsed;
+    parsed.mode = (AESMode) bytes[5];
+    parsed.keySize = bytes[6];
+    parsed.tagged = (bytes[7] & CONTAINER_FLAG_TAGS) != 0;
+    parsed.chunkSize = (std::uint32_t) loadBigEndian(&bytes[8], 4);
+    parsed.length = loadBigEndian(&bytes[16], 8);
+    parsed.numChunks = loadBigEndian(&bytes[24], 8);
+    std::copy(bytes.begin() + 32, bytes.begin() + 48, parsed.iv.begin());
+
+    if (parsed.mode >= MODE_INVALID || parsed.mode == MODE_CTS || parsed.keySize != keys.keySize ||
+        (bytes[7] & ~CONTAINER_FLAG_TAGS) != 0 || loadBigEndian(&bytes[12], 4) != 0 ||
+        parsed.chunkSize == 0 || parsed.chunkSize % NUM_BYTES != 0 || parsed.chunkSize > CONTAINER_MAX_CHUNK_SIZE ||
+        parsed.numChunks != parsed.length / parsed.chunkSize + 1 ||
+        (parsed.numChunks == 1 && parsed.chunkSize > storedLength(parsed, 0)) || (parsed.tagged && keys.tagExpanded.empty()))
+        return 3;
+
+    // The flag byte is not authenticated itself, so clearing it would strip every tag
+    if (requireTags && !parsed.tagged)
+        return 3;
+
+    // The file must be exactly as long as the header describes
+    const std::uint64_t expected = indexOffset(parsed) + parsed.numChunks * CONTAINER_INDEX_ENTRY_SIZE;
+    if ((std::uint64_t) info.st_size != expected)
+        return 3;
+
+    if (parsed.tagged) {
+        std::array<unsigned char, CONTAINER_HEADER_SIZE> check;
+        encodeHeader(parsed, keys, check);
+
+        unsigned char difference = 0;
+        for (std::size_t i = 48; i < CONTAINER_HEADER_SIZE; i++) {
+            difference |= check[i] ^ bytes[i];
+        }
+        if (difference != 0)
+            return 3;
+    }
+
+    header = parsed;
+    return 0;
+}
+
+/**
+  Decrypt a container into a regular file
+  @param inFd: container file
+  @param outFd: regular file the plaintext is written to
+  @param key: key of the container
+  @param requireTags: true to reject a container without tags
+  @param numThreads: number of threads, 0 for one per core
+  @return 0 on success, 3 if the container is invalid, untagged when tags are required or fails a tag, 5 on an I/O error
+*/
+int decryptContainer(int inFd, int outFd, const std::vector<unsigned char>& key, bool requireTags, unsigned numThreads) {
+    ContainerKeys keys(key, true);
+    ContainerTask task;
+    int result = beginDecryptContainer(inFd, outFd, keys, requireTags, task);
+    if (result != 0)
+        return result;
+
+    return forEachChunk(numThreads, task.header.numChunks, storedLength(task.header, 0),
+                        [&](std::uint64_t chunk, std::vector<unsigned char>& buffer) {
+        return processContainerChunk(task, keys, chunk, buffer);
+    });
+}
+
+/**
+  Decrypt a single chunk without touching the others
+  @param fd: container file
+  @param header: header fields from readContainerHeader()
+  @param keys: key schedules, with the tag key if the container is tagged
+  @param chunk: chunk number
+  @param output: set to the plaintext of the chunk
+  @return 0 on success, 3 if the chunk does not exist or fails its tag or padding, 5 on an I/O error
+*/
+int decryptContainerChunk(int fd, const ContainerHeader& header, const ContainerKeys& keys,
+                          std::uint64_t chunk, std::vector<unsigned char>& output) {
+    if (chunk >= header.numChunks)
+        return 3;
+
+    std::array<unsigned char, CONTAINER_HEADER_SIZE> headerBytes;
+    encodeHeader(header, keys, headerBytes);
+
+    output.assign(storedLength(header, chunk), 0);
+    std::size_t length;
+    int result = readChunk(fd, header, headerBytes, keys, chunk, output.data(), length);
+    output.resize(result == 0 ? length : 0);
+    return result;
+}
@@ -0,0 +1,78 @@
+/**
+  @file container.hpp: Chunked container file format
+*/
+#ifndef SRC_CONTAINER_HPP
+#define SRC_CONTAINER_HPP
+
+#include <vector>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "AESmodes.hpp"
+
+#define CONTAINER_VERSION 1
+#define CONTAINER_HEADER_SIZE 64
+#define CONTAINER_INDEX_ENTRY_SIZE 32
+#define CONTAINER_TAG_SIZE 16
+// Header flag set when every chunk carries a tag
+#define CONTAINER_FLAG_TAGS 0x01
+// Largest chunk size accepted when reading a container
+#define CONTAINER_MAX_CHUNK_SIZE (1u << 30)
+
+// Fields of a container header
+struct ContainerHeader {
+    AESMode mode = MODE_INVALID;
+    std::size_t keySize = 0;
+    bool tagged = false;
+    std::uint32_t chunkSize = 0;
+    std::uint64_t length = 0;
+    std::uint64_t numChunks = 0;
+    std::array<unsigned char, NUM_BYTES> iv = {};
+};
+
+// Key schedules shared by every container using the same key, wiped when destroyed
+struct ContainerKeys {
+    std::size_t keySize;
+    std::vector<unsigned char> expanded;
+    std::vector<unsigned char> tagExpanded;
+
+    ContainerKeys(const std::vector<unsigned char>& key, bool tagged);
+
+    ContainerKeys(const ContainerKeys&) = delete;
+
+    ContainerKeys& operator=(const ContainerKeys&) = delete;
+
+    ~ContainerKeys();
+};
+
+// One container being encrypted or decrypted, whose chunks may be processed on any thread
+struct ContainerTask {
+    int inFd = -1;
+    int outFd = -1;
+    bool encrypting = true;
+    ContainerHeader header;
+    std::array<unsigned char, CONTAINER_HEADER_SIZE> headerBytes = {};
+    std::vector<std::array<unsigned char, NUM_BYTES>> tags;
+};
+
+int beginEncryptContainer(int inFd, int outFd, AESMode mode, const std::vector<unsigned char>& iv, std::size_t chunkSize,
+                          bool tagged, const ContainerKeys& keys, ContainerTask& task);
+
+int beginDecryptContainer(int inFd, int outFd, const ContainerKeys& keys, bool requireTags, ContainerTask& task);
+
+int processContainerChunk(ContainerTask& task, const ContainerKeys& keys, std::uint64_t chunk,
+                          std::vector<unsigned char>& buffer);
+
+int finishContainer(ContainerTask& task);
+
+int encryptContainer(int inFd, int outFd, AESMode mode, const std::vector<unsigned char>& key,
+                     const std::vector<unsigned char>& iv, std::size_t chunkSize, bool tagged, unsigned numThreads);
+
+int decryptContainer(int inFd, int outFd, const std::vector<unsigned char>& key, bool requireTags, unsigned numThreads);
+
+int readContainerHeader(int fd, const ContainerKeys& keys, bool requireTags, ContainerHeader& header);
+
+int decryptContainerChunk(int fd, const ContainerHeader& header, const ContainerKeys& keys,
+                          std::uint64_t chunk, std::vector<unsigned char>& output);
+
+#endif
@@ -0,0 +1,524 @@
+/**
+  @file daemon.cpp: Encryption daemon on a Unix domain socket
+  Clients register keys once and then refer to them by ID, so the key schedules stay expanded and
+  every request skips process startup, random number setup and key expansion.
+  A key can only be used or unregistered on the connection that registered it, and is dropped when
+  that connection closes.
+  Each connection is served by its own thread. The framing is described in daemonclient.cpp.
+  A connection can also hand over shared memory rings, see ring.cpp, each served by its own thread
+  that encrypts the producer's data in place.
+  The socket is created readable and writable by the owner only.
+*/
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include <chrono>
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "daemon.hpp"
+#include "daemonclient.hpp"
+#include "ring.hpp"
+#include "AESstream.hpp"
+#include "AESTrace.hpp"
+
+// How often the accept loop checks for a shutdown signal, in milliseconds
+#define DAEMON_POLL_INTERVAL 250
+// Sleep between polls of an idle ring in polling mode, in microseconds
+#define RING_IDLE_SLEEP 50
+// Largest ring accepted
+#define RING_MAX_ENTRIES (1u << 16)
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+
+// A registered key with its schedule, wiped when the last request using it completes
+struct DaemonKey {
+    std::vector<unsigned char> key;
+    std::vector<unsigned char> expandedKey;
+
+    ~DaemonKey() {
+        std::fill(this->key.begin(), this->key.end(), 0);
+        std::fill(this->expandedKey.begin(), this->expandedKey.end(), 0);
+    }
+};
+
+struct Connection;
+
+// A registered key and the connection that owns it
+struct RegisteredKey {
+    const Connection* owner;
+    std::shared_ptr<const DaemonKey> key;
+};
+
+// Keys registered by all clients
+struct KeyRegistry {
+    std::mutex mutex;
+    std::unordered_map<std::uint32_t, RegisteredKey> keys;
+    std::uint32_t nextId = 1;
+};
+
+// A shared memory ring handed over by a client, with the positions checked when it was attached
+struct RingAttachment {
+    int memFd;
+    int submitFd;
+    int completeFd;
+    unsigned char* region = nullptr;
+    std::size_t regionSize = 0;
+    RingHeader* header = nullptr;
+    std::uint32_t entries = 0;
+    RingDescriptor* sq = nullptr;
+    RingCompletion* cq = nullptr;
+    unsigned char* data = nullptr;
+    std::uint64_t dataSize = 0;
+    const Connection* owner = nullptr;
+    std::atomic<bool> stop;
+    std::thread thread;
+};
+
+// A client connection and the thread serving it
+struct Connection {
+    int fd;
+    std::thread thread;
+    std::atomic<bool> done;
+    // IDs of the keys registered on the connection, only used by its thread
+    std::vector<std::uint32_t> keyIds;
+};
+
+
+/**
+  Signal handler for SIGINT and SIGTERM
+  @param signal: signal number
+  @return none
+*/
+static void requestStop(int signal) {
+    (void) signal;
+    stopRequested = 1;
+}
+
+/**
+  Encrypt or decrypt with a registered key
+  @param registry: registered keys
+  @param owner: connection the request came from
+  @param keyId: ID of the key, registered on the owner
+  @param mode: mode of operation as sent by the client
+  @param encrypting: true to encrypt, false to decrypt
+  @param iv: IV or nonce, ivSize bytes
+  @param ivSize: 0 for ECB, 8 for CTR, 16 otherwise
+  @param input: input data
+  @param length: length of the input
+  @param output: room for length + NUM_BYTES bytes, may be the same as input
+  @param outputLength: set to the length of the output
+  @return a DaemonStatus, DAEMON_UNKNOWN_KEY for a key of another connection
+*/
+static unsigned char runCipher(KeyRegistry& registry, const Connection* owner, std::uint32_t keyId, unsigned mode, bool encrypting,
+                               const unsigned char* iv, std::size_t ivSize, const unsigned char* input, std::size_t length,
+                               unsigned char* output, std::size_t& outputLength) {
+    if (mode >= MODE_INVALID)
+        return DAEMON_BAD_REQUEST;
+    const std::size_t expectedIv = (mode == MODE_ECB) ? 0 : (mode == MODE_CTR) ? NUM_BYTES / 2 : NUM_BYTES;
+    if (ivSize != expectedIv)
+        return DAEMON_BAD_REQUEST;
+
+    std::shared_ptr<const DaemonKey> entry;
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        auto found = registry.keys.find(keyId);
+        if (found == registry.keys.end() || found->second.owner != owner)
+            return DAEMON_UNKNOWN_KEY;
+        entry = found->second.key;
+    }
+
+    AESStream stream((AESMode) mode, encrypting, entry->key, entry->expandedKey, std::vector<unsigned char>(iv, iv + ivSize));
+    return stream.processBuffer(input, length, output, outputLength) ? DAEMON_OK : DAEMON_CIPHER_ERROR;
+}
+
+/**
+  Build a response frame
+  @param request: request frame the response answers
+  @param status: a DaemonStatus
+  @param start: time the request was received
+  @param payload: response data
+  @param response: set to the response frame, with 4 bytes reserved for its length
+  @return none
+*/
+static void buildResponse(const std::vector<unsigned char>& request, unsigned char status,
+                          std::chrono::steady_clock::time_point start, const std::vector<unsigned char>& payload,
+                          std::vector<unsigned char>& response) {
+    const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    response.assign(4, 0);
+    // The request ID is echoed, zero if the request was too short to have one
+    response.insert(response.end(), request.begin() + std::min<std::size_t>(request.size(), 1),
+                    request.begin() + std::min<std::size_t>(request.size(), 5));
+    response.resize(8, 0);
+    response.push_back(status);
+    putUint32(response, (std::uint32_t) std::min<long long>(micros, UINT32_MAX));
+    response.insert(response.end(), payload.begin(), payload.end());
+}
+
+/**
+  Answer one request
+  @param registry: registered keys
+  @param connection: connection the request came from
+  @param request: request frame without its length
+  @param response: set to the response frame, with 4 bytes reserved for its length
+  @return none
+*/
+static void handleRequest(KeyRegistry& registry, Connection& connection, const std::vector<unsigned char>& request,
+                          std::vector<unsigned char>& response) {
+    AESTrace::Span span("request", "bytes", (std::int64_t) request.size());
+    const auto start = std::chrono::steady_clock::now();
+    unsigned char status = DAEMON_BAD_REQUEST;
+    std::vector<unsigned char> payload;
+
+    if (request.size() >= 5) {
+        const unsigned char op = request[0];
+        const unsigned char* body = request.data() + 5;
+        const std::size_t bodySize = request.size() - 5;
+
+        if (op == DAEMON_REGISTER && (bodySize == 16 || bodySize == 24 || bodySize == 32)) {
+            std::shared_ptr<DaemonKey> entry(new DaemonKey());
+            entry->key.assign(body, body + bodySize);
+            entry->expandedKey.assign(16 * (bodySize / 4 + 7), 0);
+            keyExpansion(entry->key, entry->expandedKey, (unsigned char) bodySize);
+
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            const std::uint32_t id = registry.nextId++;
+            registry.keys[id] = RegisteredKey{&connection, entry};
+            connection.keyIds.push_back(id);
+            putUint32(payload, id);
+            status = DAEMON_OK;
+        }
+        else if (op == DAEMON_UNREGISTER && bodySize == 4) {
+            const std::uint32_t id = getUint32(body);
+            auto owned = std::find(connection.keyIds.begin(), connection.keyIds.end(), id);
+            status = DAEMON_UNKNOWN_KEY;
+            if (owned != connection.keyIds.end()) {
+                connection.keyIds.erase(owned);
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                registry.keys.erase(id);
+                status = DAEMON_OK;
+            }
+        }
+        else if ((op == DAEMON_ENCRYPT || op == DAEMON_DECRYPT) && bodySize >= 6 && bodySize >= 6u + body[5]) {
+            const std::size_t ivSize = body[5];
+            const unsigned char* data = body + 6 + ivSize;
+            const std::size_t dataSize = bodySize - 6 - ivSize;
+
+            payload.resize(dataSize + NUM_BYTES);
+            std::size_t outputLength = 0;
+            status = runCipher(registry, &connection, getUint32(body), body[4], op == DAEMON_ENCRYPT, body + 6, ivSize, data, dataSize,
+                               payload.data(), outputLength);
+            payload.resize(status == DAEMON_OK ? outputLength : 0);
+        }
+    }
+
+    buildResponse(request, status, start, payload, response);
+}
+
+/**
+  Serve a shared memory ring until its producer closes it or the connection ends
+  Queue positions and sizes were checked when the ring was attached and are never read from the region again
+  @param registry: registered keys
+  @param ring: the attached ring
+  @return none
+*/
+static void serveRing(KeyRegistry& registry, RingAttachment& ring) {
+    RingHeader* header = ring.header;
+    const std::uint32_t mask = ring.entries - 1;
+    const bool useEventfd = ring.submitFd >= 0;
+    AESTrace::nameThread("ring");
+
+    for (unsigned spins = 0; !ring.stop && header->closed.load(std::memory_order_acquire) == 0;) {
+        const std::uint32_t head = header->sqHead.load(std::memory_order_relaxed);
+        if (head == header->sqTail.load(std::memory_order_acquire)) {
+            if (!useEventfd) {
+                if (++spins >= RING_SPIN_LIMIT)
+                    std::this_thread::sleep_for(std::chrono::microseconds(RING_IDLE_SLEEP));
+                continue;
+            }
+
+            // Announce the sleep, then check again so a submission posted in between is not missed
+            header->engineSleeping.store(1, std::memory_order_seq_cst);
+            if (header->sqTail.load(std::memory_order_seq_cst) == head) {
+                struct pollfd waiting = {ring.submitFd, POLLIN, 0};
+                poll(&waiting, 1, DAEMON_POLL_INTERVAL);
+                eventfd_t value;
+                eventfd_read(ring.submitFd, &value);
+            }
+            header->engineSleeping.store(0, std::memory_order_relaxed);
+            continue;
+        }
+        spins = 0;
+
+        // Copy the descriptor first, the producer can change the shared copy at any time
+        const auto start = std::chrono::steady_clock::now();
+        const RingDescriptor descriptor = ring.sq[head & mask];
+        header->sqHead.store(head + 1, std::memory_order_release);
+
+        RingCompletion completion;
+        std::memset(&completion, 0, sizeof(completion));
+        completion.userData = descriptor.userData;
+        completion.status = DAEMON_BAD_REQUEST;
+
+        const std::uint64_t needed = (std::uint64_t) descriptor.length + (descriptor.encrypting ? NUM_BYTES : 0);
+        if (descriptor.offset <= ring.dataSize && descriptor.capacity <= ring.dataSize - descriptor.offset &&
+            needed <= descriptor.capacity && descriptor.ivLength <= sizeof(descriptor.iv)) {
+            unsigned char* data = ring.data + descriptor.offset;
+            std::size_t outputLength = 0;
+            completion.status = runCipher(registry, ring.owner, descriptor.keyId, descriptor.mode, descriptor.encrypting != 0,
+                                          descriptor.iv, descriptor.ivLength, data, descriptor.length, data, outputLength);
+            if (completion.status == DAEMON_OK)
+                completion.length = (std::uint32_t) outputLength;
+        }
+        const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        completion.micros = (std::uint32_t) std::min<long long>(micros, UINT32_MAX);
+
+        // The producer never has more requests in flight than entries, so the completion queue has room
+        const std::uint32_t tail = header->cqTail.load(std::memory_order_relaxed);
+        ring.cq[tail & mask] = completion;
+        header->cqTail.store(tail + 1, std::memory_order_seq_cst);
+        if (useEventfd && header->producerSleeping.load(std::memory_order_seq_cst) != 0)
+            eventfd_write(ring.completeFd, 1);
+    }
+}
+
+/**
+  Stop serving a ring and release it
+  @param ring: the attached ring
+  @return none
+*/
+static void detachRing(RingAttachment& ring) {
+    ring.stop = true;
+    if (ring.submitFd >= 0)
+        eventfd_write(ring.submitFd, 1);
+    if (ring.thread.joinable())
+        ring.thread.join();
+    if (ring.region != nullptr)
+        munmap(ring.region, ring.regionSize);
+    for (int fd : {ring.memFd, ring.submitFd, ring.completeFd}) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+/**
+  Check and map a ring handed over by a client and start serving it
+  @param registry: registered keys
+  @param connection: connection the ring was handed over on, whose keys it can use
+  @param fds: the ring's memfd, then its submission and completion eventfds if it uses them, owned from here on
+  @param rings: rings of the connection, the new ring is added
+  @return a DaemonStatus
+*/
+static unsigned char attachRing(KeyRegistry& registry, const Connection& connection, std::vector<int>& fds,
+                                std::list<std::unique_ptr<RingAttachment>>& rings) {
+    std::unique_ptr<RingAttachment> ring(new RingAttachment());
+    ring->owner = &connection;
+    ring->memFd = fds.empty() ? -1 : fds[0];
+    ring->submitFd = (fds.size() == 3) ? fds[1] : -1;
+    ring->completeFd = (fds.size() == 3) ? fds[2] : -1;
+    ring->stop = false;
+    if (fds.size() != 1 && fds.size() != 3) {
+        for (int fd : fds) {
+            close(fd);
+        }
+        return DAEMON_BAD_REQUEST;
+    }
+
+    // The region must not be able to shrink under the mapping
+    struct stat info;
+    const int seals = fcntl(ring->memFd, F_GET_SEALS);
+    if (fstat(ring->memFd, &info) != 0 || seals < 0 || (seals & F_SEAL_SHRINK) == 0 ||
+        (std::uint64_t) info.st_size < RING_HEADER_SIZE) {
+        detachRing(*ring);
+        return DAEMON_BAD_REQUEST;
+    }
+
+    ring->regionSize = (std::size_t) info.st_size;
+    void* map = mmap(nullptr, ring->regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memFd, 0);
+    if (map == MAP_FAILED) {
+        detachRing(*ring);
+        return DAEMON_BAD_REQUEST;
+    }
+    ring->region = (unsigned char*) map;
+    ring->header = (RingHeader*) map;
+
+    const RingHeader& header = *ring->header;
+    const std::uint64_t size = ring->regionSize;
+    const std::uint64_t entries = header.entries;
+    const std::uint64_t sqOffset = header.sqOffset;
+    const std::uint64_t cqOffset = header.cqOffset;
+    const std::uint64_t dataOffset = header.dataOffset;
+    const std::uint64_t dataSize = header.dataSize;
+    const bool valid = header.magic == RING_MAGIC && header.version == RING_VERSION && entries > 0 &&
+                       entries <= RING_MAX_ENTRIES && (entries & (entries - 1)) == 0 &&
+                       ((header.flags & RING_FLAG_EVENTFD) != 0) == (fds.size() == 3) &&
+                       sqOffset >= RING_HEADER_SIZE && sqOffset % alignof(RingDescriptor) == 0 &&
+                       sqOffset <= size && entries * sizeof(RingDescriptor) <= size - sqOffset &&
+                       cqOffset >= RING_HEADER_SIZE && cqOffset % alignof(RingCompletion) == 0 &&
+                       cqOffset <= size && entries * sizeof(RingCompletion) <= size - cqOffset &&
+                       dataOffset >= RING_HEADER_SIZE && dataOffset <= size && dataSize <= size - dataOffset;
+    if (!valid) {
+        detachRing(*ring);
+        return DAEMON_BAD_REQUEST;
+    }
+
+    ring->entries = (std::uint32_t) entries;
+    ring->sq = (RingDescriptor*) (ring->region + sqOffset);
+    ring->cq = (RingCompletion*) (ring->region + cqOffset);
+    ring->data = ring->region + dataOffset;
+    ring->dataSize = dataSize;
+
+    RingAttachment& started = *ring;
+    ring->thread = std::thread(serveRing, std::ref(registry), std::ref(started));
+    rings.push_back(std::move(ring));
+    return DAEMON_OK;
+}
+
+/**
+  Serve one connection until the client closes it, then drop its keys
+  @param registry: registered keys
+  @param connection: the connection, marked done on return
+  @return none
+*/
+static void serveConnection(KeyRegistry& registry, Connection& connection) {
+    AESTrace::nameThread("connection");
+    std::vector<unsigned char> request;
+    std::vector<unsigned char> response;
+    std::vector<int> fds;
+    std::list<std::unique_ptr<RingAttachment>> rings;
+
+    while (readFrame(connection.fd, request, &fds)) {
+        if (request.size() >= 5 && request[0] == DAEMON_ATTACH_RING) {
+            const auto start = std::chrono::steady_clock::now();
+            const unsigned char status = attachRing(registry, connection, fds, rings);
+            buildResponse(request, status, start, std::vector<unsigned char>(), response);
+        }
+        else {
+            for (int fd : fds) {
+                close(fd);
+            }
+            handleRequest(registry, connection, request, response);
+        }
+        if (!writeFrame(connection.fd, response))
+            break;
+    }
+
+    for (std::unique_ptr<RingAttachment>& ring : rings) {
+        detachRing(*ring);
+    }
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (std::uint32_t id : connection.keyIds) {
+            registry.keys.erase(id);
+        }
+    }
+    connection.keyIds.clear();
+    std::fill(request.begin(), request.end(), 0);
+    std::fill(response.begin(), response.end(), 0);
+    connection.done = true;
+}
+
+/**
+  Join and close connections whose clients have gone
+  @param connections: open connections
+  @param all: true to shut down and join every connection
+  @return none
+*/
+static void reapConnections(std::list<std::unique_ptr<Connection>>& connections, bool all) {
+    for (auto it = connections.begin(); it != connections.end();) {
+        Connection& connection = **it;
+        if (all && !connection.done)
+            shutdown(connection.fd, SHUT_RDWR);
+        if (all || connection.done) {
+            connection.thread.join();
+            close(connection.fd);
+            it = connections.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+/**
+  Run the daemon until SIGINT or SIGTERM
+  @param socketPath: path of the socket to create, replaced if it is stale
+  @return exit code, 0 on a clean shutdown, 5 if the socket cannot be created
+*/
+int runDaemon(const char* socketPath) {
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (std::strlen(socketPath) >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path is too long.\n";
+        return 2;
+    }
+    std::strcpy(address.sun_path, socketPath);
+
+    // Only replace a socket nobody is listening on
+    DaemonClient probe;
+    if (probe.connect(socketPath)) {
+        std::cerr << "A daemon is already listening on " << socketPath << "\n";
+        return 5;
+    }
+    unlink(socketPath);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const mode_t oldMask = umask(0077);
+    const bool bound = listener >= 0 && bind(listener, (struct sockaddr*) &address, sizeof(address)) == 0;
+    umask(oldMask);
+    if (!bound || listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "Unable to listen on " << socketPath << "\n";
+        if (listener >= 0)
+            close(listener);
+        return 5;
+    }
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cerr << "Listening on " << socketPath << std::endl;
+
+    KeyRegistry registry;
+    std::list<std::unique_ptr<Connection>> connections;
+    while (!stopRequested) {
+        struct pollfd waiting = {listener, POLLIN, 0};
+        if (poll(&waiting, 1, DAEMON_POLL_INTERVAL) > 0) {
+            int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0) {
+                std::unique_ptr<Connection> connection(new Connection());
+                connection->fd = client;
+                connection->done = false;
+                Connection& started = *connection;
+                connection->thread = std::thread(serveConnection, std::ref(registry), std::ref(started));
+                connections.push_back(std::move(connection));
+            }
+        }
+        reapConnections(connections, false);
+    }
+
+    close(listener);
+    unlink(socketPath);
+    reapConnections(connections, true);
+    std::cerr << "Stopped" << std::endl;
+    return 0;
+}
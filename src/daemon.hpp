@@ -0,0 +1,21 @@
+/**
+  @file daemon.hpp: Encryption daemon on a Unix domain socket
+*/
+#ifndef SRC_DAEMON_HPP
+#define SRC_DAEMON_HPP
+
+// Largest frame accepted in either direction, excluding its 4 byte length
+#define DAEMON_MAX_FRAME ((1 << 24) + 64)
+
+// Most file descriptors passed with one frame
+#define DAEMON_MAX_FDS 4
+
+// Request operations
+enum DaemonOp { DAEMON_REGISTER = 1, DAEMON_UNREGISTER = 2, DAEMON_ENCRYPT = 3, DAEMON_DECRYPT = 4, DAEMON_ATTACH_RING = 5 };
+
+// Response status
+enum DaemonStatus { DAEMON_OK = 0, DAEMON_BAD_REQUEST = 1, DAEMON_UNKNOWN_KEY = 2, DAEMON_CIPHER_ERROR = 3 };
+
+int runDaemon(const char* socketPath);
+
+#endif
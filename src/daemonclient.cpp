@@ -0,0 +1,346 @@
+/**
+  @file daemonclient.cpp: Client library for the encryption daemon
+  Every frame is a 4 byte big-endian length followed by that many bytes.
+  A request is: operation (1 byte), request ID (4), then for the operation
+    DAEMON_REGISTER     the key
+    DAEMON_UNREGISTER   key ID (4)
+    DAEMON_ENCRYPT and DAEMON_DECRYPT
+                        key ID (4), mode (1), IV length (1), IV or nonce, data
+  A response is: request ID (4), status (1), time spent by the daemon in microseconds (4), then
+  the key ID (4) for DAEMON_REGISTER or the output for DAEMON_ENCRYPT and DAEMON_DECRYPT.
+  Responses on a connection come back in request order.
+*/
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "daemonclient.hpp"
+
+// Status reported for a failure talking to the daemon
+#define CLIENT_TRANSPORT_ERROR -1
+
+
+/**
+  Read exactly length bytes
+  @return false on an error or end of file
+*/
+static bool readExact(int fd, unsigned char* buffer, std::size_t length) {
+    std::size_t done = 0;
+    while (done < length) {
+        ssize_t count = read(fd, buffer + done, length - done);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        done += (std::size_t) count;
+    }
+    return true;
+}
+
+/**
+  Append a big-endian 32 bit value to a frame
+  @param frame: frame to append to
+  @param value: value to append
+  @return none
+*/
+void putUint32(std::vector<unsigned char>& frame, std::uint32_t value) {
+    frame.push_back((unsigned char) (value >> 24));
+    frame.push_back((unsigned char) (value >> 16));
+    frame.push_back((unsigned char) (value >> 8));
+    frame.push_back((unsigned char) value);
+}
+
+/**
+  Read a big-endian 32 bit value
+  @param bytes: first of 4 bytes
+  @return the value
+*/
+std::uint32_t getUint32(const unsigned char* bytes) {
+    return ((std::uint32_t) bytes[0] << 24) | ((std::uint32_t) bytes[1] << 16) | ((std::uint32_t) bytes[2] << 8) | bytes[3];
+}
+
+/**
+  Read one frame
+  @param fd: socket to read from
+  @param frame: set to the frame without its length
+  @param fds: if not null, set to the file descriptors sent with the frame, up to DAEMON_MAX_FDS
+  @return false on an error, end of file or a frame over DAEMON_MAX_FRAME
+*/
+bool readFrame(int fd, std::vector<unsigned char>& frame, std::vector<int>* fds) {
+    unsigned char length[4];
+    std::size_t received = 0;
+
+    if (fds != nullptr) {
+        fds->clear();
+        union {
+            struct cmsghdr align;
+            char buffer[CMSG_SPACE(DAEMON_MAX_FDS * sizeof(int))];
+        } control;
+        struct iovec vector = {length, sizeof(length)};
+        struct msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+
+        ssize_t count;
+        do {
+            count = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+        } while (count < 0 && errno == EINTR);
+        if (count <= 0)
+            return false;
+        received = (std::size_t) count;
+
+        for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+                continue;
+            const std::size_t numFds = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (std::size_t i = 0; i < numFds; i++) {
+                int passed;
+                std::memcpy(&passed, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                fds->push_back(passed);
+            }
+        }
+    }
+
+    if (!readExact(fd, length + received, sizeof(length) - received))
+        return false;
+
+    const std::uint32_t size = getUint32(length);
+    if (size > DAEMON_MAX_FRAME)
+        return false;
+    frame.resize(size);
+    return readExact(fd, frame.data(), size);
+}
+
+/**
+  Write one frame
+  @param fd: socket to write to
+  @param frame: frame starting with 4 bytes reserved for its length, which are filled in
+  @param fds: if not null, file descriptors to send with the frame
+  @return false on an error
+*/
+bool writeFrame(int fd, std::vector<unsigned char>& frame, const std::vector<int>* fds) {
+    const std::uint32_t size = (std::uint32_t) (frame.size() - 4);
+    frame[0] = (unsigned char) (size >> 24);
+    frame[1] = (unsigned char) (size >> 16);
+    frame[2] = (unsigned char) (size >> 8);
+    frame[3] = (unsigned char) size;
+
+    std::size_t done = 0;
+    if (fds != nullptr && !fds->empty()) {
+        if (fds->size() > DAEMON_MAX_FDS)
+            return false;
+        union {
+            struct cmsghdr align;
+            char buffer[CMSG_SPACE(DAEMON_MAX_FDS * sizeof(int))];
+        } control;
+        std::memset(&control, 0, sizeof(control));
+        struct iovec vector = {frame.data(), frame.size()};
+        struct msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = CMSG_SPACE(fds->size() * sizeof(int));
+
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(fds->size() * sizeof(int));
+        std::memcpy(CMSG_DATA(header), fds->data(), fds->size() * sizeof(int));
+
+        ssize_t count;
+        do {
+            count = sendmsg(fd, &message, MSG_NOSIGNAL);
+        } while (count < 0 && errno == EINTR);
+        if (count <= 0)
+            return false;
+        done = (std::size_t) count;
+    }
+
+    while (done < frame.size()) {
+        ssize_t count = send(fd, frame.data() + done, frame.size() - done, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        done += (std::size_t) count;
+    }
+    return true;
+}
+
+
+/**
+  DaemonClient constructor
+*/
+DaemonClient::DaemonClient() : fd(-1), nextRequest(1), status(DAEMON_OK) {
+}
+
+/**
+  DaemonClient destructor
+*/
+DaemonClient::~DaemonClient() {
+    this->disconnect();
+}
+
+/**
+  Connect to a daemon
+  @param socketPath: path of the daemon's socket
+  @return false if the daemon cannot be reached
+*/
+bool DaemonClient::connect(const char* socketPath) {
+    this->disconnect();
+
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (std::strlen(socketPath) >= sizeof(address.sun_path))
+        return false;
+    std::strcpy(address.sun_path, socketPath);
+
+    this->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->fd < 0)
+        return false;
+    if (::connect(this->fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+        this->disconnect();
+        return false;
+    }
+    return true;
+}
+
+/**
+  Close the connection, registered keys stay registered
+  @return none
+*/
+void DaemonClient::disconnect() {
+    if (this->fd >= 0)
+        close(this->fd);
+    this->fd = -1;
+}
+
+/**
+  Send a request and wait for its response
+  @param op: operation
+  @param payload: request after the operation and request ID
+  @param result: set to the response after the status and time
+  @param micros: set to the daemon's time if not null
+  @param fds: if not null, file descriptors to send with the request
+  @return true if the daemon answered DAEMON_OK
+*/
+bool DaemonClient::call(DaemonOp op, const std::vector<unsigned char>& payload, std::vector<unsigned char>& result,
+                        std::uint32_t* micros, const std::vector<int>* fds) {
+    this->status = CLIENT_TRANSPORT_ERROR;
+    if (this->fd < 0)
+        return false;
+
+    const std::uint32_t id = this->nextRequest++;
+    this->request.assign(4, 0);
+    this->request.push_back((unsigned char) op);
+    putUint32(this->request, id);
+    this->request.insert(this->request.end(), payload.begin(), payload.end());
+
+    if (!writeFrame(this->fd, this->request, fds) || !readFrame(this->fd, this->response) ||
+        this->response.size() < 9 || getUint32(this->response.data()) != id)
+        return false;
+
+    this->status = this->response[4];
+    if (micros != nullptr)
+        *micros = getUint32(&this->response[5]);
+    result.assign(this->response.begin() + 9, this->response.end());
+    return this->status == DAEMON_OK;
+}
+
+/**
+  Register a key whose schedule the daemon keeps expanded
+  @param key: 16, 24 or 32 byte key
+  @param keyId: set to the ID to use in requests
+  @return false on failure
+*/
+bool DaemonClient::registerKey(const std::vector<unsigned char>& key, std::uint32_t& keyId) {
+    std::vector<unsigned char> result;
+    if (!this->call(DAEMON_REGISTER, key, result, nullptr) || result.size() != 4)
+        return false;
+    keyId = getUint32(result.data());
+    return true;
+}
+
+/**
+  Remove a registered key, the daemon wipes its schedule
+  @param keyId: ID from registerKey()
+  @return false on failure
+*/
+bool DaemonClient::unregisterKey(std::uint32_t keyId) {
+    std::vector<unsigned char> payload;
+    std::vector<unsigned char> result;
+    putUint32(payload, keyId);
+    return this->call(DAEMON_UNREGISTER, payload, result, nullptr);
+}
+
+/**
+  Hand a shared memory ring to the daemon, used by SharedRing::attach()
+  @param fds: the ring's memfd, followed by its submission and completion eventfds if it uses them
+  @return false on failure
+*/
+bool DaemonClient::attachRing(const std::vector<int>& fds) {
+    std::vector<unsigned char> payload;
+    std::vector<unsigned char> result;
+    return this->call(DAEMON_ATTACH_RING, payload, result, nullptr, &fds);
+}
+
+/**
+  Encrypt or decrypt through the daemon
+  @return false on failure
+*/
+bool DaemonClient::crypt(DaemonOp op, std::uint32_t keyId, AESMode mode, const std::vector<unsigned char>& iv,
+                         const std::vector<unsigned char>& input, std::vector<unsigned char>& output, std::uint32_t* micros) {
+    std::vector<unsigned char> payload;
+    payload.reserve(6 + iv.size() + input.size());
+    putUint32(payload, keyId);
+    payload.push_back((unsigned char) mode);
+    payload.push_back((unsigned char) iv.size());
+    payload.insert(payload.end(), iv.begin(), iv.end());
+    payload.insert(payload.end(), input.begin(), input.end());
+    return this->call(op, payload, output, micros);
+}
+
+/**
+  Encrypt with a registered key
+  @param keyId: ID from registerKey()
+  @param mode: mode of operation
+  @param iv: IV, the 8 byte nonce for CTR, empty for ECB
+  @param input: plaintext
+  @param output: set to the ciphertext
+  @param micros: set to the daemon's time in microseconds if not null
+  @return false on failure, lastStatus() tells why
+*/
+bool DaemonClient::encrypt(std::uint32_t keyId, AESMode mode, const std::vector<unsigned char>& iv,
+                           const std::vector<unsigned char>& input, std::vector<unsigned char>& output, std::uint32_t* micros) {
+    return this->crypt(DAEMON_ENCRYPT, keyId, mode, iv, input, output, micros);
+}
+
+/**
+  Decrypt with a registered key
+  @param keyId: ID from registerKey()
+  @param mode: mode of operation
+  @param iv: IV, the 8 byte nonce for CTR, empty for ECB
+  @param input: ciphertext
+  @param output: set to the plaintext
+  @param micros: set to the daemon's time in microseconds if not null
+  @return false on failure, lastStatus() tells why
+*/
+bool DaemonClient::decrypt(std::uint32_t keyId, AESMode mode, const std::vector<unsigned char>& iv,
+                           const std::vector<unsigned char>& input, std::vector<unsigned char>& output, std::uint32_t* micros) {
+    return this->crypt(DAEMON_DECRYPT, keyId, mode, iv, input, output, micros);
+}
+
+/**
+  Status of the last request
+  @return a DaemonStatus, or -1 if the daemon could not be reached
+*/
+int DaemonClient::lastStatus() const {
+    return this->status;
+}
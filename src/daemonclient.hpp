@@ -0,0 +1,64 @@
+/**
+  @file daemonclient.hpp: Client library for the encryption daemon
+*/
+#ifndef SRC_DAEMONCLIENT_HPP
+#define SRC_DAEMONCLIENT_HPP
+
+#include <vector>
+#include <cstdint>
+#include "AESmodes.hpp"
+#include "daemon.hpp"
+
+bool readFrame(int fd, std::vector<unsigned char>& frame, std::vector<int>* fds = nullptr);
+
+bool writeFrame(int fd, std::vector<unsigned char>& frame, const std::vector<int>* fds = nullptr);
+
+void putUint32(std::vector<unsigned char>& frame, std::uint32_t value);
+
+std::uint32_t getUint32(const unsigned char* bytes);
+
+
+//DaemonClient class, one connection to the daemon, not shared between threads
+class DaemonClient {
+public:
+    DaemonClient();
+
+    DaemonClient(const DaemonClient&) = delete;
+
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    ~DaemonClient();
+
+    bool connect(const char* socketPath);
+
+    void disconnect();
+
+    bool registerKey(const std::vector<unsigned char>& key, std::uint32_t& keyId);
+
+    bool unregisterKey(std::uint32_t keyId);
+
+    bool encrypt(std::uint32_t keyId, AESMode mode, const std::vector<unsigned char>& iv,
+                 const std::vector<unsigned char>& input, std::vector<unsigned char>& output, std::uint32_t* micros = nullptr);
+
+    bool decrypt(std::uint32_t keyId, AESMode mode, const std::vector<unsigned char>& iv,
+                 const std::vector<unsigned char>& input, std::vector<unsigned char>& output, std::uint32_t* micros = nullptr);
+
+    bool attachRing(const std::vector<int>& fds);
+
+    int lastStatus() const;
+
+private:
+    bool call(DaemonOp op, const std::vector<unsigned char>& payload, std::vector<unsigned char>& result,
+              std::uint32_t* micros, const std::vector<int>* fds = nullptr);
+
+    bool crypt(DaemonOp op, std::uint32_t keyId, AESMode mode, const std::vector<unsigned char>& iv,
+               const std::vector<unsigned char>& input, std::vector<unsigned char>& output, std::uint32_t* micros);
+
+    int fd;
+    std::uint32_t nextRequest;
+    int status;
+    std::vector<unsigned char> request;
+    std::vector<unsigned char> response;
+};
+
+#endif
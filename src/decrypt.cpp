@@ -84,34 +84,47 @@ void invMixColumns(std::array<unsigned char, NUM_BYTES>& state) {
   @return none
 */
 void decrypt(std::array<unsigned char, 16> input, std::array<unsigned char, 16>& output, const std::vector<unsigned char>& key) {
+  // Expand key
+  const std::size_t keysize = key.size();
+  const std::size_t numRounds = keysize/4 + 6;
+  std::vector<unsigned char> expandedKey(16 * (numRounds + 1));
+	keyExpansion(key, expandedKey, keysize);
+
+  decryptExpanded(input, output, expandedKey);
+}
+
+/**
+  Inverse cipher using a key that has already been expanded with keyExpansion()
+  @param input: array of hex values representing output of cipher
+  @param output: array of hex values that is copied to from final state
+  @param expandedKey: key schedule of 16 * (Nr + 1) bytes
+  @return none
+*/
+void decryptExpanded(const std::array<unsigned char, 16>& input, std::array<unsigned char, 16>& output, const std::vector<unsigned char>& expandedKey) {
   // Create the state array from input
   std::array<unsigned char, NUM_BYTES> state;
   for (std::size_t i = 0; i < NUM_BYTES; i++) {
     state[i] = input[i]; 
   }
 
-  // Expand key
-  const std::size_t keysize = key.size();
-  const std::size_t numRounds = keysize/4 + 6;
-  std::vector<unsigned char> expandedKey;
-  expandedKey.reserve(16 * (numRounds + 1)); 
-	keyExpansion(key, expandedKey, keysize);
+  const std::size_t numRounds = expandedKey.size()/16 - 1;
+  const unsigned char* roundKeys = expandedKey.data();
 
   // Initial round
-  addRoundKey(state, &(expandedKey[numRounds*NUM_BYTES]));
+  addRoundKey(state, &(roundKeys[numRounds*NUM_BYTES]));
 
   // Rounds
   for (std::size_t round = numRounds-1; round > 0; round--){
     invShiftRows(state);
     invSubBytes(state);
-    addRoundKey(state, &(expandedKey[round*NUM_BYTES]));
+    addRoundKey(state, &(roundKeys[round*NUM_BYTES]));
     invMixColumns(state);
   }
 
   // Final round
   invShiftRows(state);
   invSubBytes(state);
-  addRoundKey(state, &(expandedKey[0]));
+  addRoundKey(state, &(roundKeys[0]));
 
   // Set output to state
   for (std::size_t i = 0; i < NUM_BYTES; i++) {
@@ -10,6 +10,7 @@
 
 
 void decrypt(std::array<unsigned char, 16> input, std::array<unsigned char, 16>& output, const std::vector<unsigned char>& key);
+void decryptExpanded(const std::array<unsigned char, 16>& input, std::array<unsigned char, 16>& output, const std::vector<unsigned char>& expandedKey);
 void invSubBytes(std::array<unsigned char, NUM_BYTES>& state);
 void invShiftRows(std::array<unsigned char, NUM_BYTES>& state);
 void invMixColumns(std::array<unsigned char, NUM_BYTES>& state);
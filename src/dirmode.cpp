@@ -0,0 +1,337 @@
+/**
+  @file dirmode.cpp: Parallel directory encryption
+  Every regular file under the input directory is encrypted into a container of the same name under
+  the output directory, or decrypted back. Small files are scheduled whole and large files chunk by
+  chunk onto a work-stealing pool, so all cores stay busy whatever the mix of file sizes.
+  All files share one key schedule, and each encrypted file gets its own random IV or nonce.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "dirmode.hpp"
+#include "container.hpp"
+#include "AESRand.hpp"
+#include "AESTrace.hpp"
+
+
+// One file being encrypted or decrypted
+struct FileJob {
+    std::string outPath;
+    ContainerTask task;
+    std::atomic<std::uint64_t> remaining;
+    std::atomic<int> result;
+};
+
+// A range of chunks of one file
+struct WorkItem {
+    std::shared_ptr<FileJob> job;
+    std::uint64_t first;
+    std::uint64_t last;
+};
+
+
+//WorkStealingPool class, one queue per worker, owners take the newest item and thieves the oldest
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned numWorkers) : queues(numWorkers), queued(0), closed(false), next(0) {
+        for (std::unique_ptr<Queue>& queue : this->queues) {
+            queue.reset(new Queue());
+        }
+    }
+
+    /**
+      Add an item, spreading items over the queues in turn
+      @param item: item to add
+      @return none
+    */
+    void submit(WorkItem item) {
+        Queue& queue = *this->queues[this->next++ % this->queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.items.push_back(std::move(item));
+        }
+        {
+            std::lock_guard<std::mutex> lock(this->idleMutex);
+            this->queued++;
+        }
+        this->idle.notify_one();
+    }
+
+    /**
+      No more items will be submitted
+      @return none
+    */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(this->idleMutex);
+            this->closed = true;
+        }
+        this->idle.notify_all();
+    }
+
+    /**
+      Take an item from the worker's own queue, or steal one from another
+      @param worker: number of the calling worker
+      @param item: set to the item taken
+      @return false once the pool is closed and empty
+    */
+    bool take(std::size_t worker, WorkItem& item) {
+        while (true) {
+            for (std::size_t i = 0; i < this->queues.size(); i++) {
+                Queue& queue = *this->queues[(worker + i) % this->queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.items.empty())
+                    continue;
+
+                if (i == 0) {
+                    item = std::move(queue.items.back());
+                    queue.items.pop_back();
+                }
+                else {
+                    item = std::move(queue.items.front());
+                    queue.items.pop_front();
+                }
+                std::lock_guard<std::mutex> idleLock(this->idleMutex);
+                this->queued--;
+                return true;
+            }
+
+            std::unique_lock<std::mutex> lock(this->idleMutex);
+            this->idle.wait(lock, [this]() { return this->queued > 0 || this->closed; });
+            if (this->queued == 0)
+                return false;
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<WorkItem> items;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::mutex idleMutex;
+    std::condition_variable idle;
+    std::size_t queued;
+    bool closed;
+    std::atomic<std::size_t> next;
+};
+
+
+/**
+  Encrypt or decrypt every regular file under a directory into the same tree under another directory
+  Other file types, including symbolic links, are skipped
+  @param inDir: directory to read
+  @param outDir: directory to write, created if needed
+  @param mode: mode of operation, checked against each container when decrypting
+  @param encrypting: true to encrypt, false to decrypt
+  @param key: key to use
+  @param chunkSize: container chunk size when encrypting
+  @param tagged: true to tag the containers when encrypting, and to reject containers without tags when decrypting
+  @param numThreads: number of worker threads, 0 for one per core
+  @return 0 on success, otherwise the exit code of the first failure, 3 for a cipher error and 5 for an I/O error
+*/
+int runDirectoryMode(const char* inDir, const char* outDir, AESMode mode, bool encrypting,
+                     const std::vector<unsigned char>& key, std::size_t chunkSize, bool tagged, unsigned numThreads) {
+    if (numThreads == 0)
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    const ContainerKeys keys(key, tagged || !encrypting);
+    const std::size_t ivSize = (mode == MODE_CTR) ? NUM_BYTES / 2 : NUM_BYTES;
+    AESRand& rand = AESRand::threadLocal();
+    WorkStealingPool pool(numThreads);
+
+    std::mutex stateMutex;
+    std::condition_variable fileClosed;
+    std::size_t openFiles = 0;
+    std::uint64_t numFiles = 0;
+    std::uint64_t numBytes = 0;
+    int firstError = 0;
+
+    // Record the outcome of a file and release it, the output is removed if it failed
+    auto finishFile = [&](FileJob& job, int result) {
+        if (result == 0)
+            result = finishContainer(job.task);
+        close(job.task.inFd);
+        if (close(job.task.outFd) != 0 && result == 0)
+            result = 5;
+        if (result != 0)
+            unlink(job.outPath.c_str());
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            openFiles--;
+            if (result == 0) {
+                numFiles++;
+                numBytes += job.task.header.length;
+            }
+            else {
+                std::cerr << (encrypting ? "Encryption Error: " : "Decryption Error: ") << job.outPath << std::endl;
+                if (firstError == 0)
+                    firstError = result;
+            }
+        }
+        fileClosed.notify_one();
+    };
+
+    auto worker = [&](std::size_t index) {
+        AESTrace::nameThread("worker");
+        std::vector<unsigned char> buffer;
+        WorkItem item;
+        while (pool.take(index, item)) {
+            FileJob& job = *item.job;
+            if (buffer.size() < job.task.header.chunkSize)
+                buffer.resize(job.task.header.chunkSize);
+
+            for (std::uint64_t chunk = item.first; chunk < item.last && job.result == 0; chunk++) {
+                int code = processContainerChunk(job.task, keys, chunk, buffer);
+                if (code != 0) {
+                    int expected = 0;
+                    job.result.compare_exchange_strong(expected, code);
+                }
+            }
+
+            const std::uint64_t count = item.last - item.first;
+            if (job.remaining.fetch_sub(count) == count)
+                finishFile(job, job.result);
+            item.job.reset();
+        }
+        std::fill(buffer.begin(), buffer.end(), 0);
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < numThreads; i++) {
+        workers.emplace_back(worker, i);
+    }
+
+    // Walk the tree without recursion, paths are relative to both directories
+    std::vector<std::string> pending(1, "");
+    mkdir(outDir, 0700);
+    // An output directory inside the input directory is skipped, otherwise the walk would follow its own output
+    struct stat outInfo;
+    const bool haveOutInfo = stat(outDir, &outInfo) == 0;
+    while (!pending.empty()) {
+        const std::string relative = pending.back();
+        pending.pop_back();
+
+        const std::string inPath = std::string(inDir) + "/" + relative;
+        DIR* dir = opendir(inPath.c_str());
+        if (dir == nullptr) {
+            std::cerr << "Unable to open directory " << inPath << "\n";
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (firstError == 0)
+                firstError = 5;
+            continue;
+        }
+
+        while (struct dirent* entry = readdir(dir)) {
+            const std::string name = entry->d_name;
+            if (name == "." || name == "..")
+                continue;
+
+            const std::string childRelative = relative.empty() ? name : relative + "/" + name;
+            const std::string childIn = std::string(inDir) + "/" + childRelative;
+            const std::string childOut = std::string(outDir) + "/" + childRelative;
+            struct stat info;
+            if (lstat(childIn.c_str(), &info) != 0)
+                continue;
+            if (haveOutInfo && info.st_dev == outInfo.st_dev && info.st_ino == outInfo.st_ino)
+                continue;
+
+            if (S_ISDIR(info.st_mode)) {
+                if (mkdir(childOut.c_str(), 0700) != 0 && errno != EEXIST) {
+                    std::cerr << "Unable to create directory " << childOut << "\n";
+                    std::lock_guard<std::mutex> lock(stateMutex);
+                    if (firstError == 0)
+                        firstError = 5;
+                    continue;
+                }
+                pending.push_back(childRelative);
+                continue;
+            }
+            if (!S_ISREG(info.st_mode))
+                continue;
+
+            // Bound the number of open files, workers release them as files complete
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                fileClosed.wait(lock, [&]() { return openFiles < DIR_MAX_OPEN; });
+                openFiles++;
+            }
+
+            std::shared_ptr<FileJob> job(new FileJob());
+            job->outPath = childOut;
+            job->result = 0;
+            const int inFd = open(childIn.c_str(), O_RDONLY | O_CLOEXEC);
+            const int outFd = (inFd < 0) ? -1 : open(childOut.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            job->task.inFd = inFd;
+            job->task.outFd = outFd;
+
+            int result = 5;
+            if (outFd >= 0) {
+                if (encrypting) {
+                    const std::vector<unsigned char> iv = rand.generateBytes((unsigned int) ivSize);
+                    result = beginEncryptContainer(inFd, outFd, mode, iv, chunkSize, tagged, keys, job->task);
+                }
+                else {
+                    result = beginDecryptContainer(inFd, outFd, keys, tagged, job->task);
+                    if (result == 0 && job->task.header.mode != mode)
+                        result = 3;
+                }
+            }
+            if (result != 0) {
+                if (outFd < 0) {
+                    std::cerr << "Unable to open " << (inFd < 0 ? "input file " + childIn : "output file " + childOut) << "\n";
+                    // Nothing to finish or remove, only the open file count to release
+                    if (inFd >= 0)
+                        close(inFd);
+                    std::lock_guard<std::mutex> lock(stateMutex);
+                    openFiles--;
+                    if (firstError == 0)
+                        firstError = 5;
+                    continue;
+                }
+                finishFile(*job, result);
+                continue;
+            }
+
+            const std::uint64_t numChunks = job->task.header.numChunks;
+            job->remaining = numChunks;
+            if (numChunks <= DIR_BATCH_CHUNKS) {
+                pool.submit(WorkItem{job, 0, numChunks});
+            }
+            else {
+                for (std::uint64_t chunk = 0; chunk < numChunks; chunk++) {
+                    pool.submit(WorkItem{job, chunk, chunk + 1});
+                }
+            }
+        }
+        closedir(dir);
+    }
+
+    pool.close();
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Files: " << numFiles << ", bytes: " << numBytes << ", seconds: " << std::fixed << std::setprecision(3)
+              << seconds << ", throughput: " << std::setprecision(2)
+              << (seconds > 0 ? numBytes / seconds / (1024 * 1024) : 0.0) << " MiB/s" << std::endl;
+    return firstError;
+}
@@ -0,0 +1,18 @@
+/**
+  @file dirmode.hpp: Parallel directory encryption
+*/
+#ifndef SRC_DIRMODE_HPP
+#define SRC_DIRMODE_HPP
+
+#include <vector>
+#include "AESmodes.hpp"
+
+// Files of up to this many chunks are processed as one work item, larger files as one item per chunk
+#define DIR_BATCH_CHUNKS 4
+// Most files open at once while walking a tree
+#define DIR_MAX_OPEN 256
+
+int runDirectoryMode(const char* inDir, const char* outDir, AESMode mode, bool encrypting,
+                     const std::vector<unsigned char>& key, std::size_t chunkSize, bool tagged, unsigned numThreads);
+
+#endif
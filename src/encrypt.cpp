@@ -84,34 +84,48 @@ void mixColumns(std::array<unsigned char, NUM_BYTES>& state) {
   @return none
 */
 void encrypt(std::array<unsigned char, 16>& input, std::array<unsigned char, 16>& output, const std::vector<unsigned char>& key) {
+  // Expand key
+  const std::size_t keysize = key.size();
+  const std::size_t numRounds = keysize/4 + 6;
+  std::vector<unsigned char> expandedKey(16 * (numRounds + 1));
+	keyExpansion(key, expandedKey, keysize);
+
+	encryptExpanded(input, output, expandedKey);
+}
+
+/**
+  Cipher using a key that has already been expanded with keyExpansion()
+  Lets callers that encrypt many blocks under one key skip the key schedule
+  @param input: array of hex values representing the input bytes
+  @param output: array of hex values that is copied to from final state
+  @param expandedKey: key schedule of 16 * (Nr + 1) bytes
+  @return none
+*/
+void encryptExpanded(const std::array<unsigned char, 16>& input, std::array<unsigned char, 16>& output, const std::vector<unsigned char>& expandedKey) {
   // Create the state array from input
   std::array<unsigned char, NUM_BYTES> state;
 	for (std::size_t i = 0; i < NUM_BYTES; i++) {
 		state[i] = input[i]; 
 	}
 
-  // Expand key
-  const std::size_t keysize = key.size();
-  const std::size_t numRounds = keysize/4 + 6;
-  std::vector<unsigned char> expandedKey;
-  expandedKey.reserve(16 * (numRounds + 1)); 
-	keyExpansion(key, expandedKey, keysize);
+  const std::size_t numRounds = expandedKey.size()/16 - 1;
+  const unsigned char* roundKeys = expandedKey.data();
 
 	// Intial Round
-	addRoundKey(state, &(expandedKey[0]));
+	addRoundKey(state, &(roundKeys[0]));
 
 	for (std::size_t i = 0; i < numRounds-1; i++) {
 		subBytes(state);
 		shiftRows(state);
 		mixColumns(state);
 		//The key index is supposed to be 4*roundNum but since the key is bytes, it is 4*4*roundNum
-		addRoundKey(state, &(expandedKey[16*(i+1)]));
+		addRoundKey(state, &(roundKeys[16*(i+1)]));
 	}
 
 	// Final Round - No MixedColumns
 	subBytes(state);
 	shiftRows(state);
-	addRoundKey(state, &(expandedKey[16*numRounds]));
+	addRoundKey(state, &(roundKeys[16*numRounds]));
 
 	for (std::size_t i = 0; i < NUM_BYTES; i++) {
 		output[i] = state[i]; 
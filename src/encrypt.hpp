@@ -8,6 +8,7 @@
 #include <array>
 
 void encrypt(std::array<unsigned char, 16>& input, std::array<unsigned char, 16>& output, const std::vector<unsigned char>& key); 
+void encryptExpanded(const std::array<unsigned char, 16>& input, std::array<unsigned char, 16>& output, const std::vector<unsigned char>& expandedKey);
 void subBytes(std::array<unsigned char, NUM_BYTES>& state);
 void shiftRows(std::array<unsigned char, NUM_BYTES>& state);
 void mixColumns(std::array<unsigned char, NUM_BYTES>& state);
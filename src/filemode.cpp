@@ -0,0 +1,654 @@
+/**
+  @file filemode.cpp: Binary file and stream encryption for the command line
+  Data is read and written as raw bytes in FILE_CHUNK_SIZE chunks and streamed through AESStream,
+  so the ciphertext is the same as the hex interface produces for the same key and IV.
+  By default the chunks go through the pipeline, which overlaps reading and writing with the cipher.
+  With --container the data is written in the chunked container format instead, see container.cpp.
+  --in-dir and --out-dir encrypt a whole tree into containers, see dirmode.cpp.
+  Prompts and the generated key, IV or nonce go to standard error because standard output may carry data.
+*/
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "filemode.hpp"
+#include "AESRand.hpp"
+#include "dirmode.hpp"
+#include "AESstream.hpp"
+#include "interface.hpp"
+#include "AESStats.hpp"
+#include "AESTrace.hpp"
+
+
+/**
+    Remove the binary data options from the command line
+    Recognised options: --in FILE, --out FILE, --binary, --mmap, --in-place, --sync, --buffers N,
+        --container, --tags, --chunk-size N, --threads N, --chunk I,
+        --in-dir DIR, --out-dir DIR, --key HEX, --iv HEX, --nonce HEX
+    @param argc: argument count, reduced by the number of options removed
+    @param argv: argument vector, compacted to the remaining positional arguments
+    @param options: the options found
+    @return false if an option is missing its value or the value is invalid
+ */
+bool extractFileOptions(int& argc, char** argv, FileOptions& options) {
+    int kept = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(argv[i], "--in") == 0) {
+            if (!hasValue)
+                return false;
+            options.inPath = argv[++i];
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--out") == 0) {
+            if (!hasValue)
+                return false;
+            options.outPath = argv[++i];
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--in-dir") == 0) {
+            if (!hasValue)
+                return false;
+            options.inDir = argv[++i];
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--out-dir") == 0) {
+            if (!hasValue)
+                return false;
+            options.outDir = argv[++i];
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--binary") == 0) {
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--mmap") == 0) {
+            options.mapped = true;
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--in-place") == 0) {
+            options.inPlace = true;
+            options.mapped = true;
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--sync") == 0) {
+            options.pipelined = false;
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--buffers") == 0) {
+            if (!hasValue)
+                return false;
+            long buffers = std::strtol(argv[++i], nullptr, 10);
+            if (buffers < 2)
+                return false;
+            options.buffers = (std::size_t) buffers;
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--container") == 0) {
+            options.container = true;
+            options.enabled = true;
+        }
+        else if (std::strcmp(argv[i], "--tags") == 0) {
+            options.tagged = true;
+        }
+        else if (std::strcmp(argv[i], "--chunk-size") == 0) {
+            if (!hasValue)
+                return false;
+            long long size = std::strtoll(argv[++i], nullptr, 10);
+            if (size <= 0 || size % NUM_BYTES != 0 || size > CONTAINER_MAX_CHUNK_SIZE)
+                return false;
+            options.chunkSize = (std::size_t) size;
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0) {
+            if (!hasValue)
+                return false;
+            long threads = std::strtol(argv[++i], nullptr, 10);
+            if (threads < 1)
+                return false;
+            options.threads = (unsigned) threads;
+        }
+        else if (std::strcmp(argv[i], "--chunk") == 0) {
+            if (!hasValue)
+                return false;
+            options.chunk = std::strtoll(argv[++i], nullptr, 10);
+            if (options.chunk < 0)
+                return false;
+        }
+        else if (std::strcmp(argv[i], "--key") == 0) {
+            if (!hasValue)
+                return false;
+            options.keyHex = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--iv") == 0 || std::strcmp(argv[i], "--nonce") == 0) {
+            if (!hasValue)
+                return false;
+            options.ivHex = argv[++i];
+        }
+        else {
+            argv[kept++] = argv[i];
+        }
+    }
+
+    argc = kept;
+    return true;
+}
+
+/**
+    Get a hex value from its command line option, or prompt for it when standard input is not carrying data
+    @param hex: value given on the command line, empty if none
+    @param prompt: prompt to show
+    @param stdinIsData: true if the input data is read from standard input
+    @param vec: vector the bytes are stored in
+    @return 0 on success, 1 if the value is needed but standard input carries the data, 2 if it is not valid hex
+ */
+static int readHexValue(const std::string& hex, const char* prompt, bool stdinIsData, std::vector<unsigned char>& vec) {
+    if (!hex.empty())
+        return hexToVector(hex, vec) ? 0 : 2;
+
+    if (stdinIsData)
+        return 1;
+
+    std::cerr << prompt;
+    return inputToVector(vec) ? 0 : 2;
+}
+
+/**
+    Check whether --out names the input, which opening the output with O_TRUNC would destroy
+    The paths are compared by device and inode before anything is opened, so links and other names for the
+    same file are caught too. Standard input counts when no --in is given.
+    @param options: binary data options
+    @return true if the output is an existing file that is also the input
+ */
+static bool outputIsInput(const FileOptions& options) {
+    if (options.outPath == nullptr)
+        return false;
+
+    struct stat outInfo;
+    struct stat inInfo;
+    if (stat(options.outPath, &outInfo) != 0)
+        return false;
+    if ((options.inPath != nullptr) ? stat(options.inPath, &inInfo) != 0 : fstat(STDIN_FILENO, &inInfo) != 0)
+        return false;
+    return outInfo.st_dev == inInfo.st_dev && outInfo.st_ino == inInfo.st_ino;
+}
+
+/**
+    Write a whole buffer to a file descriptor
+    @param fd: file descriptor to write to
+    @param data: bytes to write
+    @return false on a write error
+ */
+static bool writeAll(int fd, const std::vector<unsigned char>& data) {
+    AES_STAT_TIMER(timer, STAT_NS_WRITE);
+    AESTrace::Span span("write", "bytes", (std::int64_t) data.size());
+    std::size_t written = 0;
+    while (written < data.size()) {
+        ssize_t count = write(fd, data.data() + written, data.size() - written);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        written += (std::size_t) count;
+    }
+    return true;
+}
+
+/**
+    Stream the input through the cipher into the output
+    @param inFd: file descriptor to read from
+    @param outFd: file descriptor to write to
+    @param stream: cipher stream for the chosen mode and direction
+    @param chunkSize: number of bytes read at a time
+    @return 0 on success, 3 on a cipher error, 5 on an I/O error
+ */
+static int streamData(int inFd, int outFd, AESStream& stream, std::size_t chunkSize) {
+    std::vector<unsigned char> chunk(chunkSize);
+    std::vector<unsigned char> output;
+    output.reserve(chunkSize + 2 * NUM_BYTES);
+
+    while (true) {
+        ssize_t count;
+        {
+            AES_STAT_TIMER(timer, STAT_NS_READ);
+            AESTrace::Span span("read");
+            count = read(inFd, chunk.data(), chunk.size());
+        }
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return 5;
+        }
+        if (count == 0)
+            break;
+
+        output.clear();
+        if (!stream.update(chunk.data(), (std::size_t) count, output))
+            return 3;
+        if (!writeAll(outFd, output))
+            return 5;
+    }
+
+    output.clear();
+    if (!stream.finish(output))
+        return 3;
+    if (!writeAll(outFd, output))
+        return 5;
+
+    return 0;
+}
+
+/**
+    Report generated values so the data can be decrypted later
+    @param encrypting: true when encrypting, nothing is reported for decryption
+    @param randomKey: true if the key was generated
+    @param mode: mode of operation
+    @param options: binary data options, an IV or nonce given there is not repeated
+    @param key: key used
+    @param iv: IV or nonce used
+    @return none
+ */
+static void reportGenerated(bool encrypting, bool randomKey, AESMode mode, const FileOptions& options,
+                            std::vector<unsigned char>& key, std::vector<unsigned char>& iv) {
+    if (!encrypting)
+        return;
+
+    if (randomKey) {
+        std::cerr << "KEY: ";
+        printVector(key, std::cerr);
+    }
+    if (mode != MODE_ECB && options.ivHex.empty()) {
+        std::cerr << ((mode == MODE_CTR) ? "NONCE: " : "IV: ");
+        printVector(iv, std::cerr);
+    }
+}
+
+/**
+    Map the input file and a pre-sized output file and run the cipher directly between the mappings
+    With inPlace the input file is mapped writable and is also the output, it grows to the padded length
+    when encrypting and is truncated to the plaintext length after decrypting
+    @param options: binary data options, inPath is required and outPath unless working in place
+    @param mode: mode of operation
+    @param encrypting: true to encrypt, false to decrypt
+    @param key: key to use
+    @param iv: IV or nonce to use
+    @return 0 on success, 3 on a cipher error, 5 on an I/O error
+ */
+static int mapData(const FileOptions& options, AESMode mode, bool encrypting,
+                   const std::vector<unsigned char>& key, const std::vector<unsigned char>& iv) {
+    const bool inPlace = options.inPlace;
+    int inFd = open(options.inPath, (inPlace ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (inFd < 0)
+        return 5;
+
+    struct stat info;
+    if (fstat(inFd, &info) != 0) {
+        close(inFd);
+        return 5;
+    }
+    const std::size_t inputSize = (std::size_t) info.st_size;
+
+    // Encryption output is exact: padded to the next block, or the same length with ciphertext stealing
+    std::size_t mappedOutputSize = inputSize;
+    if (encrypting && mode != MODE_CTS)
+        mappedOutputSize = ((inputSize / NUM_BYTES) + 1) * NUM_BYTES;
+
+    int outFd = inFd;
+    if (!inPlace) {
+        outFd = open(options.outPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (outFd < 0) {
+            close(inFd);
+            return 5;
+        }
+    }
+
+    if (mappedOutputSize > inputSize || !inPlace) {
+        if (ftruncate(outFd, (off_t) mappedOutputSize) != 0) {
+            close(inFd);
+            if (!inPlace)
+                close(outFd);
+            return 5;
+        }
+    }
+
+    int result = 0;
+    unsigned char* input = nullptr;
+    unsigned char* output = nullptr;
+
+    if (inPlace) {
+        if (mappedOutputSize > 0) {
+            void* map = mmap(nullptr, mappedOutputSize, PROT_READ | PROT_WRITE, MAP_SHARED, inFd, 0);
+            if (map == MAP_FAILED)
+                result = 5;
+            else
+                input = output = (unsigned char*) map;
+        }
+    }
+    else {
+        if (inputSize > 0) {
+            void* map = mmap(nullptr, inputSize, PROT_READ, MAP_PRIVATE, inFd, 0);
+            if (map == MAP_FAILED)
+                result = 5;
+            else
+                input = (unsigned char*) map;
+        }
+        if (result == 0 && mappedOutputSize > 0) {
+            void* map = mmap(nullptr, mappedOutputSize, PROT_READ | PROT_WRITE, MAP_SHARED, outFd, 0);
+            if (map == MAP_FAILED)
+                result = 5;
+            else
+                output = (unsigned char*) map;
+        }
+    }
+
+    std::size_t outputLength = 0;
+    if (result == 0) {
+        // Both mappings are walked front to back exactly once
+        if (input != nullptr)
+            madvise(input, inPlace ? mappedOutputSize : inputSize, MADV_SEQUENTIAL);
+        if (output != nullptr && output != input)
+            madvise(output, mappedOutputSize, MADV_SEQUENTIAL);
+
+        // An empty input still produces a padding block, which needs somewhere to be written
+        std::vector<unsigned char> empty(NUM_BYTES, 0);
+        unsigned char* out = (output != nullptr) ? output : empty.data();
+        const unsigned char* in = (input != nullptr) ? input : empty.data();
+
+        AESStream stream(mode, encrypting, key, iv);
+        if (!stream.processBuffer(in, inputSize, out, outputLength)) {
+            result = 3;
+
+            // Encrypting again with the same IV undoes a failed in place decryption. Only the blocks in front of
+            // the held back tail were written, the tail itself is decrypted into a separate buffer
+            const std::size_t writtenBlocks = (inputSize - stream.holdBack(inputSize)) / NUM_BYTES;
+            if (inPlace && writtenBlocks > 0) {
+                AESStream restore(mode, true, key, iv);
+                restore.transformBlocks(output, output, writtenBlocks);
+            }
+        }
+    }
+
+    if (input != nullptr)
+        munmap(input, inPlace ? mappedOutputSize : inputSize);
+    if (output != nullptr && output != input)
+        munmap(output, mappedOutputSize);
+
+    // Trim the output to the plaintext length once the padding has been removed
+    if (result == 0 && outputLength != mappedOutputSize && ftruncate(outFd, (off_t) outputLength) != 0)
+        result = 5;
+
+    close(inFd);
+    if (!inPlace && close(outFd) != 0 && result == 0)
+        result = 5;
+
+    return result;
+}
+
+/**
+    Encrypt a file into a container, or decrypt a whole container or one of its chunks
+    @param options: binary data options, inPath is required and outPath unless a single chunk is decrypted
+    @param mode: mode of operation, checked against the container when decrypting
+    @param encrypting: true to encrypt, false to decrypt
+    @param key: key to use
+    @param iv: base IV or nonce to use when encrypting
+    @return 0 on success, 2 on a parameter error, 3 on a cipher error, 5 on an I/O error
+ */
+static int containerData(const FileOptions& options, AESMode mode, bool encrypting,
+                         const std::vector<unsigned char>& key, const std::vector<unsigned char>& iv) {
+    const bool singleChunk = options.chunk >= 0;
+    if (options.inPath == nullptr || (options.outPath == nullptr && !(singleChunk && !encrypting))) {
+        std::cerr << "--container needs --in and --out files, --out is optional with --chunk.\n";
+        return 2;
+    }
+    if (mode == MODE_CTS || options.mapped || (singleChunk && encrypting)) {
+        std::cerr << "--container does not support CTS, --mmap or --chunk when encrypting.\n";
+        return 2;
+    }
+
+    int inFd = open(options.inPath, O_RDONLY | O_CLOEXEC);
+    if (inFd < 0) {
+        std::cerr << "Unable to open input file " << options.inPath << "\n";
+        return 5;
+    }
+    int outFd = STDOUT_FILENO;
+    if (options.outPath != nullptr) {
+        outFd = open(options.outPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (outFd < 0) {
+            std::cerr << "Unable to open output file " << options.outPath << "\n";
+            close(inFd);
+            return 5;
+        }
+    }
+
+    int result;
+    if (encrypting) {
+        result = encryptContainer(inFd, outFd, mode, key, iv, options.chunkSize, options.tagged, options.threads);
+    }
+    else {
+        ContainerKeys keys(key, true);
+        ContainerHeader header;
+        result = readContainerHeader(inFd, keys, options.tagged, header);
+        if (result == 0 && header.mode != mode) {
+            std::cerr << "The container was not encrypted with this mode.\n";
+            result = 3;
+        }
+        else if (result == 0 && singleChunk) {
+            std::vector<unsigned char> output;
+            result = decryptContainerChunk(inFd, header, keys, (std::uint64_t) options.chunk, output);
+            if (result == 0 && !writeAll(outFd, output))
+                result = 5;
+        }
+        else if (result == 0) {
+            result = decryptContainer(inFd, outFd, key, options.tagged, options.threads);
+        }
+    }
+
+    close(inFd);
+    if (outFd != STDOUT_FILENO && close(outFd) != 0 && result == 0)
+        result = 5;
+    return result;
+}
+
+/**
+    Encrypt or decrypt raw binary data between files or standard input and output
+    Takes the same positional arguments as the hex interface
+    @param argc: number of positional arguments
+    @param argv: positional arguments
+    @param options: binary data options from the command line
+    @return exit code, 0 on success
+ */
+int runFileMode(int argc, char** argv, FileOptions& options) {
+    AESRand& rand = AESRand::threadLocal();
+    std::vector<unsigned char> key;
+    std::vector<unsigned char> iv;
+
+    if (argc < 4) {
+        std::cerr << "Invalid number of arguments.\n";
+        return 2;
+    }
+
+    bool encrypting;
+    if (std::strcmp(argv[1], "encrypt") == 0 || std::strcmp(argv[1], "enc") == 0)
+        encrypting = true;
+    else if (std::strcmp(argv[1], "decrypt") == 0 || std::strcmp(argv[1], "dec") == 0)
+        encrypting = false;
+    else {
+        std::cerr << "Invalid function.\n";
+        return 2;
+    }
+
+    const AESMode mode = getMode(argv[2]);
+    if (mode == MODE_INVALID) {
+        std::cerr << "Invalid mode.\n";
+        return 2;
+    }
+
+    // Encryption takes the key flag before the key size, decryption only the key size
+    char* keyType = encrypting ? argv[3] : nullptr;
+    int keyByteSize = -1;
+    if (encrypting && argc > 4)
+        keyByteSize = getKeySizeInBytes(argv[4]);
+    else if (!encrypting)
+        keyByteSize = getKeySizeInBytes(argv[3]);
+
+    if (keyByteSize == -1) {
+        std::cerr << "Invalid parameter for key size.\n";
+        return 2;
+    }
+
+    const bool stdinIsData = options.inPath == nullptr;
+    const std::size_t ivSize = (mode == MODE_CTR) ? NUM_BYTES / 2 : NUM_BYTES;
+    const int ivArg = encrypting ? 5 : 4;
+    const bool userIv = !options.ivHex.empty() || !encrypting ||
+                        (argc > ivArg && (std::strcmp(argv[ivArg], "-iv") == 0 || std::strcmp(argv[ivArg], "-nonce") == 0));
+    bool randomKey = false;
+
+    // Key
+    if (encrypting && std::strcmp(keyType, "-r") == 0) {
+        key = rand.generateBytes(keyByteSize);
+        randomKey = true;
+    }
+    else if (!encrypting || std::strcmp(keyType, "-k") == 0) {
+        const int status = readHexValue(options.keyHex, "Enter key: ", stdinIsData, key);
+        if (status == 2) {
+            std::cerr << "Invalid hexadecimal input.\n";
+            return 2;
+        }
+        if (status != 0) {
+            std::cerr << "The key must be given with --key when data is read from standard input.\n";
+            return 2;
+        }
+        if (key.size() != (std::size_t) keyByteSize) {
+            std::cerr << "Invalid number of bytes entered for key.\n";
+            return 2;
+        }
+    }
+    else {
+        std::cerr << "Invalid flag entered for key\n";
+        return 2;
+    }
+
+    // Directories, each file gets its own IV or nonce
+    if (options.inDir != nullptr || options.outDir != nullptr) {
+        if (options.inDir == nullptr || options.outDir == nullptr || mode == MODE_CTS) {
+            std::cerr << "--in-dir needs --out-dir, and CTS is not supported for directories.\n";
+            return 2;
+        }
+        int result = runDirectoryMode(options.inDir, options.outDir, mode, encrypting, key, options.chunkSize,
+                                      options.tagged, options.threads);
+        if (result == 0 && randomKey) {
+            std::cerr << "KEY: ";
+            printVector(key, std::cerr);
+        }
+        return result;
+    }
+
+    // IV or nonce, a container records its own
+    if (mode != MODE_ECB && (encrypting || !options.container)) {
+        if (userIv) {
+            const char* prompt = (mode == MODE_CTR) ? "Enter nonce: " : "Enter IV: ";
+            const int status = readHexValue(options.ivHex, prompt, stdinIsData, iv);
+            if (status == 2) {
+                std::cerr << "Invalid hexadecimal input.\n";
+                return 2;
+            }
+            if (status != 0) {
+                std::cerr << "The IV or nonce must be given with --iv or --nonce when data is read from standard input.\n";
+                return 2;
+            }
+            if (iv.size() != ivSize) {
+                std::cerr << "Invalid number of bytes entered for IV or nonce.\n";
+                return 2;
+            }
+        }
+        else {
+            iv = rand.generateBytes(ivSize);
+        }
+    }
+
+    // The output is truncated when it is opened, which would destroy the input before it is read
+    if (outputIsInput(options)) {
+        std::cerr << "The output file is the input file, use --mmap --in-place to process a file in place.\n";
+        return 2;
+    }
+
+    if (options.container) {
+        int result = containerData(options, mode, encrypting, key, iv);
+        if (result != 0) {
+            std::cerr << (result == 5 ? "I/O Error" : (encrypting ? "Encryption Error" : "Decryption Error")) << std::endl;
+            if (options.outPath != nullptr)
+                unlink(options.outPath);
+            return result;
+        }
+        reportGenerated(encrypting, randomKey, mode, options, key, iv);
+        return 0;
+    }
+
+    // Memory mapped files
+    if (options.mapped) {
+        if (options.inPath == nullptr || (options.outPath == nullptr) != options.inPlace) {
+            std::cerr << "--mmap needs --in and --out files, --in-place needs --in only.\n";
+            return 2;
+        }
+        if (options.inPlace && mode != MODE_CTR && mode != MODE_OFB) {
+            std::cerr << "--in-place is only supported for CTR and OFB.\n";
+            return 2;
+        }
+        int result = mapData(options, mode, encrypting, key, iv);
+
+        if (result != 0) {
+            std::cerr << (result == 5 ? "I/O Error" : (encrypting ? "Encryption Error" : "Decryption Error")) << std::endl;
+            if (!options.inPlace)
+                unlink(options.outPath);
+            return result;
+        }
+        reportGenerated(encrypting, randomKey, mode, options, key, iv);
+        return 0;
+    }
+
+    // Open the input and output
+    int inFd = STDIN_FILENO;
+    int outFd = STDOUT_FILENO;
+    if (options.inPath != nullptr) {
+        inFd = open(options.inPath, O_RDONLY | O_CLOEXEC);
+        if (inFd < 0) {
+            std::cerr << "Unable to open input file " << options.inPath << "\n";
+            return 5;
+        }
+    }
+    if (options.outPath != nullptr) {
+        outFd = open(options.outPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (outFd < 0) {
+            std::cerr << "Unable to open output file " << options.outPath << "\n";
+            if (inFd != STDIN_FILENO)
+                close(inFd);
+            return 5;
+        }
+    }
+
+    AESStream stream(mode, encrypting, key, iv);
+    int result = options.pipelined ? pipelineData(inFd, outFd, stream, options.streamChunkSize, options.buffers)
+                                   : streamData(inFd, outFd, stream, options.streamChunkSize);
+
+    if (inFd != STDIN_FILENO)
+        close(inFd);
+    if (outFd != STDOUT_FILENO && close(outFd) != 0 && result == 0)
+        result = 5;
+
+    if (result != 0) {
+        std::cerr << (result == 5 ? "I/O Error" : (encrypting ? "Encryption Error" : "Decryption Error")) << std::endl;
+        // Do not leave partial or unauthenticated output behind
+        if (options.outPath != nullptr)
+            unlink(options.outPath);
+        return result;
+    }
+
+    reportGenerated(encrypting, randomKey, mode, options, key, iv);
+    return 0;
+}
@@ -0,0 +1,42 @@
+/**
+  @file filemode.hpp: Binary file and stream encryption for the command line
+*/
+#ifndef SRC_FILEMODE_HPP
+#define SRC_FILEMODE_HPP
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include "pipeline.hpp"
+#include "container.hpp"
+
+// Size of each chunk read from the input
+#ifndef FILE_CHUNK_SIZE
+#define FILE_CHUNK_SIZE (1 << 20)
+#endif
+
+// Options for the binary data path, taken out of the command line before the positional arguments are read
+struct FileOptions {
+    bool enabled = false;
+    const char* inPath = nullptr;
+    const char* outPath = nullptr;
+    std::string keyHex;
+    std::string ivHex;
+    bool mapped = false;
+    bool inPlace = false;
+    bool pipelined = true;
+    std::size_t buffers = PIPELINE_BUFFERS;
+    std::size_t streamChunkSize = FILE_CHUNK_SIZE;
+    bool container = false;
+    bool tagged = false;
+    std::size_t chunkSize = FILE_CHUNK_SIZE;
+    unsigned threads = 0;
+    long long chunk = -1;
+    const char* inDir = nullptr;
+    const char* outDir = nullptr;
+};
+
+bool extractFileOptions(int& argc, char** argv, FileOptions& options);
+int runFileMode(int argc, char** argv, FileOptions& options);
+
+#endif
@@ -0,0 +1,596 @@
+/**
+  @file fuzz.cpp: Differential fuzzer for the modes of operation
+  Every input is decoded into a mode, key, IV and message, and encrypted with a reference built here from
+  single-block encrypt() and decrypt() only. Each implementation must produce the same ciphertext, decrypt
+  it back to the message, and agree with the reference on tampered ciphertexts, including which ones
+  are rejected for bad padding. The implementations are the vector functions of AESmodes, AESStream on a
+  whole buffer, and AESStream fed in random pieces, each run with every sbox lookup.
+  Each input also checks keyExpansionBatch() against keyExpansion(), and CTR inputs check AESCtrStream
+  records against encrypt_ctr() and concurrent reservations for overlap.
+  Built with AES_LIBFUZZER this is a libFuzzer target (LLVMFuzzerTestOneInput). Otherwise main() is a
+  standalone driver that generates random inputs, times each implementation and can compare the
+  throughput against a stored baseline.
+  Usage: ./fuzz [--iterations N] [--seed N] [--max-length N] [--baseline FILE] [--threshold FRACTION]
+                [--save-baseline FILE]
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <array>
+#include <string>
+#include <map>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include "AESmodes.hpp"
+#include "AESstream.hpp"
+#include "AESCtrStream.hpp"
+
+// Bytes at the start of every input before the key, IV and message
+#define FUZZ_HEADER_BYTES 4
+// Largest message length the standalone driver generates by default
+#define FUZZ_MAX_LENGTH 256
+// Allowed throughput drop against the baseline before the run fails
+#define FUZZ_THRESHOLD 0.2
+// Threads and reservations per thread in the concurrent AESCtrStream check
+#define FUZZ_CTR_THREADS 4
+#define FUZZ_CTR_RESERVATIONS 64
+
+// One input decoded from fuzzer bytes
+struct FuzzCase {
+    AESMode mode;
+    bool corrupt;
+    unsigned char flip;
+    unsigned splitSeed;
+    std::vector<unsigned char> key;
+    std::vector<unsigned char> iv;
+    std::vector<unsigned char> message;
+};
+
+// One implementation of the modes under test
+struct Implementation {
+    const char* name;
+    bool (*encrypt)(const FuzzCase& test, const std::vector<unsigned char>& input, std::vector<unsigned char>& output);
+    bool (*decrypt)(const FuzzCase& test, const std::vector<unsigned char>& input, std::vector<unsigned char>& output);
+};
+
+// Bytes processed and time taken by each implementation and sbox lookup, for the throughput report
+static std::map<std::string, std::pair<double, double>> throughput;
+
+
+/**
+  Reference encryption of one message from single-block encrypt()
+  PKCS#7 padding for every mode except CTS, which is CBC-CS3. CTR counts the last 8 bytes big-endian.
+  @return the ciphertext
+*/
+static std::vector<unsigned char> referenceEncrypt(const FuzzCase& test) {
+    std::vector<unsigned char> plaintext = test.message;
+    const std::size_t lastLength = (plaintext.size() - 1) % NUM_BYTES + 1;
+    if (test.mode == MODE_CTS)
+        plaintext.resize((plaintext.size() + NUM_BYTES - 1) / NUM_BYTES * NUM_BYTES, 0);
+    else
+        plaintext.resize(plaintext.size() / NUM_BYTES * NUM_BYTES + NUM_BYTES,
+                         (unsigned char) (NUM_BYTES - plaintext.size() % NUM_BYTES));
+
+    std::vector<unsigned char> ciphertext(plaintext.size());
+    std::array<unsigned char, NUM_BYTES> chain{0};
+    std::copy(test.iv.begin(), test.iv.end(), chain.begin());
+    std::array<unsigned char, NUM_BYTES> block;
+    std::array<unsigned char, NUM_BYTES> output;
+
+    for (std::size_t offset = 0; offset < plaintext.size(); offset += NUM_BYTES) {
+        for (std::size_t j = 0; j < NUM_BYTES; j++) block[j] = plaintext[offset + j];
+        switch (test.mode) {
+            case MODE_ECB:
+                encrypt(block, output, test.key);
+                break;
+            case MODE_CBC:
+            case MODE_CTS:
+                for (std::size_t j = 0; j < NUM_BYTES; j++) block[j] ^= chain[j];
+                encrypt(block, output, test.key);
+                chain = output;
+                break;
+            case MODE_CFB:
+                encrypt(chain, output, test.key);
+                for (std::size_t j = 0; j < NUM_BYTES; j++) output[j] ^= block[j];
+                chain = output;
+                break;
+            case MODE_OFB:
+                encrypt(chain, chain, test.key);
+                for (std::size_t j = 0; j < NUM_BYTES; j++) output[j] = block[j] ^ chain[j];
+                break;
+            default:
+                encrypt(chain, output, test.key);
+                for (std::size_t j = 0; j < NUM_BYTES; j++) output[j] ^= block[j];
+                for (int j = NUM_BYTES - 1; j >= NUM_BYTES / 2 && ++chain[j] == 0; j--) {}
+                break;
+        }
+        std::copy(output.begin(), output.end(), ciphertext.begin() + offset);
+    }
+
+    // CS3 swaps the last two blocks and truncates the one that moves last
+    if (test.mode == MODE_CTS && ciphertext.size() > NUM_BYTES) {
+        const std::size_t last = ciphertext.size() - NUM_BYTES;
+        std::vector<unsigned char> penultimate(ciphertext.end() - 2 * NUM_BYTES, ciphertext.end() - NUM_BYTES);
+        std::copy(ciphertext.begin() + last, ciphertext.end(), ciphertext.begin() + last - NUM_BYTES);
+        std::copy(penultimate.begin(), penultimate.end(), ciphertext.begin() + last);
+        ciphertext.resize(last + lastLength);
+    }
+    return ciphertext;
+}
+
+/**
+  Reference decryption from single-block encrypt() and decrypt()
+  @param test: mode, key and IV
+  @param ciphertext: at least one block, a whole number of blocks except for CTS
+  @param plaintext: set to the message
+  @return false for invalid padding
+*/
+static bool referenceDecrypt(const FuzzCase& test, const std::vector<unsigned char>& ciphertext,
+                             std::vector<unsigned char>& plaintext) {
+    std::vector<unsigned char> input = ciphertext;
+    const std::size_t length = input.size();
+    const std::size_t lastLength = (length - 1) % NUM_BYTES + 1;
+    std::array<unsigned char, NUM_BYTES> block;
+    std::array<unsigned char, NUM_BYTES> output;
+
+    // Undo the CS3 swap: decrypting the block that moved to the penultimate position gives the stolen bytes
+    if (test.mode == MODE_CTS && length > NUM_BYTES) {
+        const std::size_t penultimate = (length - 1) / NUM_BYTES * NUM_BYTES - NUM_BYTES;
+        for (std::size_t j = 0; j < NUM_BYTES; j++) block[j] = input[penultimate + j];
+        decrypt(block, output, test.key);
+        std::vector<unsigned char> full(input.begin(), input.begin() + penultimate);
+        full.insert(full.end(), input.begin() + penultimate + NUM_BYTES, input.end());
+        full.insert(full.end(), output.begin() + lastLength, output.end());
+        full.insert(full.end(), input.begin() + penultimate, input.begin() + penultimate + NUM_BYTES);
+        input = full;
+    }
+
+    plaintext.assign(input.size(), 0);
+    std::array<unsigned char, NUM_BYTES> chain{0};
+    std::copy(test.iv.begin(), test.iv.end(), chain.begin());
+    for (std::size_t offset = 0; offset < input.size(); offset += NUM_BYTES) {
+        for (std::size_t j = 0; j < NUM_BYTES; j++) block[j] = input[offset + j];
+        switch (test.mode) {
+            case MODE_ECB:
+                decrypt(block, output, test.key);
+                break;
+            case MODE_CBC:
+            case MODE_CTS:
+                decrypt(block, output, test.key);
+                for (std::size_t j = 0; j < NUM_BYTES; j++) output[j] ^= chain[j];
+                chain = block;
+                break;
+            case MODE_CFB:
+                encrypt(chain, output, test.key);
+                for (std::size_t j = 0; j < NUM_BYTES; j++) output[j] ^= block[j];
+                chain = block;
+                break;
+            case MODE_OFB:
+                encrypt(chain, chain, test.key);
+                for (std::size_t j = 0; j < NUM_BYTES; j++) output[j] = block[j] ^ chain[j];
+                break;
+            default:
+                encrypt(chain, output, test.key);
+                for (std::size_t j = 0; j < NUM_BYTES; j++) output[j] ^= block[j];
+                for (int j = NUM_BYTES - 1; j >= NUM_BYTES / 2 && ++chain[j] == 0; j--) {}
+                break;
+        }
+        std::copy(output.begin(), output.end(), plaintext.begin() + offset);
+    }
+
+    if (test.mode == MODE_CTS) {
+        plaintext.resize(length);
+        return true;
+    }
+    const unsigned char pad = plaintext.back();
+    if (pad == 0 || pad > NUM_BYTES)
+        return false;
+    for (std::size_t j = 0; j < pad; j++) {
+        if (plaintext[plaintext.size() - 1 - j] != pad)
+            return false;
+    }
+    plaintext.resize(plaintext.size() - pad);
+    return true;
+}
+
+/**
+  The nonce of a CTR case as the mode functions take it
+*/
+static std::array<unsigned char, NUM_BYTES / 2> nonceOf(const FuzzCase& test) {
+    std::array<unsigned char, NUM_BYTES / 2> nonce;
+    std::copy(test.iv.begin(), test.iv.begin() + NUM_BYTES / 2, nonce.begin());
+    return nonce;
+}
+
+/**
+  Vector encryption functions of AESmodes
+*/
+static bool modeEncrypt(const FuzzCase& test, const std::vector<unsigned char>& input, std::vector<unsigned char>& output) {
+    switch (test.mode) {
+        case MODE_ECB: return encrypt_ecb(input, output, test.key);
+        case MODE_CBC: return encrypt_cbc(input, output, test.key, test.iv);
+        case MODE_CTS: return encrypt_cbc_cs3(input, output, test.key, test.iv);
+        case MODE_CFB: return encrypt_cfb(input, output, test.key, test.iv);
+        case MODE_OFB: return encrypt_ofb(input, output, test.key, test.iv);
+        default: return encrypt_ctr(input, output, test.key, nonceOf(test));
+    }
+}
+
+/**
+  Vector decryption functions of AESmodes
+*/
+static bool modeDecrypt(const FuzzCase& test, const std::vector<unsigned char>& input, std::vector<unsigned char>& output) {
+    switch (test.mode) {
+        case MODE_ECB: return decrypt_ecb(input, output, test.key);
+        case MODE_CBC: return decrypt_cbc(input, output, test.key, test.iv);
+        case MODE_CTS: return decrypt_cbc_cs3(input, output, test.key, test.iv);
+        case MODE_CFB: return decrypt_cfb(input, output, test.key, test.iv);
+        case MODE_OFB: return decrypt_ofb(input, output, test.key, test.iv);
+        default: return decrypt_ctr(input, output, test.key, nonceOf(test));
+    }
+}
+
+/**
+  AESStream::processBuffer() on the whole input
+*/
+static bool bufferCrypt(const FuzzCase& test, bool encrypting, const std::vector<unsigned char>& input,
+                        std::vector<unsigned char>& output) {
+    AESStream stream(test.mode, encrypting, test.key, test.iv);
+    output.resize(input.size() + NUM_BYTES);
+    std::size_t outputLength = 0;
+    const unsigned char* in = input.empty() ? output.data() : input.data();
+    if (!stream.processBuffer(in, input.size(), output.data(), outputLength))
+        return false;
+    output.resize(outputLength);
+    return true;
+}
+
+static bool bufferEncrypt(const FuzzCase& test, const std::vector<unsigned char>& input, std::vector<unsigned char>& output) {
+    return bufferCrypt(test, true, input, output);
+}
+
+static bool bufferDecrypt(const FuzzCase& test, const std::vector<unsigned char>& input, std::vector<unsigned char>& output) {
+    return bufferCrypt(test, false, input, output);
+}
+
+/**
+  AESStream::update() on pieces of random length, then finish()
+*/
+static bool pieceCrypt(const FuzzCase& test, bool encrypting, const std::vector<unsigned char>& input,
+                       std::vector<unsigned char>& output) {
+    AESStream stream(test.mode, encrypting, test.key, test.iv);
+    std::minstd_rand pieces(test.splitSeed + 1);
+    std::size_t offset = 0;
+    while (offset < input.size()) {
+        const std::size_t piece = std::min<std::size_t>(pieces() % (3 * NUM_BYTES), input.size() - offset);
+        if (!stream.update(input.data() + offset, piece, output))
+            return false;
+        offset += piece;
+    }
+    return stream.finish(output);
+}
+
+static bool pieceEncrypt(const FuzzCase& test, const std::vector<unsigned char>& input, std::vector<unsigned char>& output) {
+    return pieceCrypt(test, true, input, output);
+}
+
+static bool pieceDecrypt(const FuzzCase& test, const std::vector<unsigned char>& input, std::vector<unsigned char>& output) {
+    return pieceCrypt(test, false, input, output);
+}
+
+static const Implementation implementations[] = {
+    {"modes", modeEncrypt, modeDecrypt},
+    {"stream", bufferEncrypt, bufferDecrypt},
+    {"pieces", pieceEncrypt, pieceDecrypt},
+};
+
+static const struct {
+    SboxBackend backend;
+    const char* name;
+} sboxLookups[] = {
+    {SBOX_TABLE, "table"},
+    {SBOX_CONSTANT_TIME, "constant-time"},
+};
+
+/**
+  Reports a disagreement and stops, which libFuzzer records as a crash
+*/
+static void mismatch(const FuzzCase& test, const std::string& what) {
+    std::cerr << "Mismatch: " << what << ", mode " << test.mode << ", key bytes " << test.key.size()
+              << ", message bytes " << test.message.size() << "\n";
+    std::abort();
+}
+
+/**
+  Decodes fuzzer bytes: mode, key size, flags and piece seed, then the key, the IV and the message
+  @return false if there are too few bytes
+*/
+static bool decodeCase(const std::uint8_t* data, std::size_t size, FuzzCase& test) {
+    if (size < FUZZ_HEADER_BYTES)
+        return false;
+    test.mode = (AESMode) (data[0] % MODE_INVALID);
+    const std::size_t keySize = 16 + 8 * (data[1] % 3);
+    test.corrupt = (data[2] & 1) != 0;
+    test.flip = (unsigned char) ((data[2] >> 1) + 1);
+    test.splitSeed = data[3];
+    const std::size_t ivSize = (test.mode == MODE_ECB) ? 0 : (test.mode == MODE_CTR) ? NUM_BYTES / 2 : NUM_BYTES;
+    if (size < FUZZ_HEADER_BYTES + keySize + ivSize)
+        return false;
+
+    const std::uint8_t* cursor = data + FUZZ_HEADER_BYTES;
+    test.key.assign(cursor, cursor + keySize);
+    test.iv.assign(cursor + keySize, cursor + keySize + ivSize);
+    test.message.assign(cursor + keySize + ivSize, data + size);
+    return true;
+}
+
+// Batch sizes for the key schedule check, around the KEY_EXPANSION_BATCH keys expanded in lockstep
+static const std::size_t keyBatchCounts[] = {1, 5, KEY_EXPANSION_BATCH, KEY_EXPANSION_BATCH + 1, 40};
+
+/**
+  Checks keyExpansionBatch() against keyExpansion() on each of a batch of keys derived from the case key
+*/
+static void checkKeyBatch(const FuzzCase& test, const std::string& label) {
+    const std::size_t count = keyBatchCounts[test.splitSeed % (sizeof(keyBatchCounts) / sizeof(keyBatchCounts[0]))];
+    const unsigned char keySize = (unsigned char) test.key.size();
+    std::vector<std::vector<unsigned char>> keys(count, test.key);
+    for (std::size_t i = 0; i < count; i++) {
+        keys[i][i % keySize] ^= (unsigned char) (i + 1);
+    }
+
+    std::vector<std::vector<unsigned char>> expansions;
+    keyExpansionBatch(keys, expansions, keySize);
+    if (expansions.size() != count)
+        mismatch(test, label + " key expansion batch size");
+    std::vector<unsigned char> expected(16 * (keySize / 4 + 7), 0);
+    for (std::size_t i = 0; i < count; i++) {
+        keyExpansion(keys[i], expected, keySize);
+        if (expansions[i] != expected)
+            mismatch(test, label + " key expansion batch");
+    }
+}
+
+/**
+  Checks AESCtrStream on a CTR case: records appended one after another, each a whole number of blocks
+  except the last, give the ciphertext of encrypt_ctr() without its padding, and decrypt back from their
+  block numbers.
+  Then several threads reserve at once, and the ranges they get must not overlap.
+*/
+static void checkCtrStream(const FuzzCase& test) {
+    std::vector<unsigned char> expected;
+    if (!encrypt_ctr(test.message, expected, test.key, nonceOf(test)) || expected.size() < test.message.size())
+        mismatch(test, "ctr-stream encrypt_ctr");
+    expected.resize(test.message.size());
+
+    AESCtrStream stream(test.key, nonceOf(test));
+    std::minstd_rand pieces(test.splitSeed + 1);
+    std::vector<unsigned char> output(test.message.size());
+    std::vector<unsigned char> decrypted(test.message.size());
+    std::size_t offset = 0;
+    while (offset < test.message.size()) {
+        const std::size_t piece = std::min<std::size_t>(NUM_BYTES * (pieces() % 4) + NUM_BYTES, test.message.size() - offset);
+        std::uint64_t firstBlock;
+        if (!stream.append(test.message.data() + offset, output.data() + offset, piece, firstBlock) ||
+            firstBlock != offset / NUM_BYTES)
+            mismatch(test, "ctr-stream append");
+        if (!stream.crypt(firstBlock, output.data() + offset, decrypted.data() + offset, piece))
+            mismatch(test, "ctr-stream crypt");
+        offset += piece;
+    }
+    if (output != expected || decrypted != test.message ||
+        stream.nextBlock() != (test.message.size() + NUM_BYTES - 1) / NUM_BYTES)
+        mismatch(test, "ctr-stream append against encrypt_ctr");
+
+    // Each reservation is recorded as its first and one past its last block
+    AESCtrStream shared(test.key, nonceOf(test));
+    std::vector<std::vector<std::pair<std::uint64_t, std::uint64_t>>> ranges(FUZZ_CTR_THREADS);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < FUZZ_CTR_THREADS; t++) {
+        threads.emplace_back([&, t]() {
+            std::minstd_rand lengths(test.splitSeed + 1 + (unsigned) t);
+            for (std::size_t i = 0; i < FUZZ_CTR_RESERVATIONS; i++) {
+                const std::size_t length = lengths() % (4 * NUM_BYTES);
+                std::uint64_t firstBlock;
+                if (!shared.reserve(length, firstBlock))
+                    firstBlock = UINT64_MAX;
+                ranges[t].emplace_back(firstBlock, firstBlock + (length + NUM_BYTES - 1) / NUM_BYTES);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> all;
+    for (const auto& thread : ranges) {
+        all.insert(all.end(), thread.begin(), thread.end());
+    }
+    std::sort(all.begin(), all.end());
+    std::uint64_t end = 0;
+    for (const auto& range : all) {
+        if (range.first == UINT64_MAX || range.first < end)
+            mismatch(test, "ctr-stream overlapping reservations");
+        end = std::max(end, range.second);
+    }
+    if (end != shared.nextBlock())
+        mismatch(test, "ctr-stream reservations against nextBlock");
+}
+
+/**
+  Checks every implementation and sbox lookup against the reference on one input
+  With corrupt set, a byte in the last two blocks of the ciphertext is flipped first, which in CBC and the
+  stream modes changes the padding in a controlled way, to compare the handling of bad padding
+  @return 0, as libFuzzer expects
+*/
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size) {
+    FuzzCase test;
+    if (!decodeCase(data, size, test))
+        return 0;
+    if (test.mode == MODE_CTS && test.message.size() < NUM_BYTES)
+        return 0;
+
+    // The mode functions report failures on standard output
+    std::streambuf* savedOutput = std::cout.rdbuf(nullptr);
+
+    setSboxBackend(SBOX_TABLE);
+    std::vector<unsigned char> expected;
+    bool expectedValid = true;
+    std::vector<unsigned char> ciphertext = referenceEncrypt(test);
+    if (test.corrupt) {
+        const std::size_t span = std::min<std::size_t>(ciphertext.size(), 2 * NUM_BYTES);
+        ciphertext[ciphertext.size() - 1 - test.splitSeed % span] ^= test.flip;
+        expectedValid = referenceDecrypt(test, ciphertext, expected);
+    }
+
+    for (const auto& lookup : sboxLookups) {
+        setSboxBackend(lookup.backend);
+        for (const Implementation& implementation : implementations) {
+            const std::string label = std::string(implementation.name) + "/" + lookup.name;
+            const auto start = std::chrono::steady_clock::now();
+            std::vector<unsigned char> output;
+
+            if (test.corrupt) {
+                const bool valid = implementation.decrypt(test, ciphertext, output);
+                if (valid != expectedValid || (valid && output != expected))
+                    mismatch(test, label + " decryption of tampered ciphertext");
+            }
+            else {
+                if (!implementation.encrypt(test, test.message, output) || output != ciphertext)
+                    mismatch(test, label + " encryption");
+                output.clear();
+                if (!implementation.decrypt(test, ciphertext, output) || output != test.message)
+                    mismatch(test, label + " decryption");
+            }
+
+            std::pair<double, double>& total = throughput[label];
+            total.first += (double) (test.corrupt ? ciphertext.size() : 2 * test.message.size());
+            total.second += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        checkKeyBatch(test, std::string("key-batch/") + lookup.name);
+        if (test.mode == MODE_CTR && !test.corrupt)
+            checkCtrStream(test);
+    }
+    setSboxBackend(SBOX_TABLE);
+    std::cout.rdbuf(savedOutput);
+    return 0;
+}
+
+#ifndef AES_LIBFUZZER
+
+/**
+  Reads a baseline written by --save-baseline
+  @param path: the file, one "label MiB/s" pair per line
+  @param baseline: filled with the rates
+  @return false if the file cannot be read
+*/
+static bool loadBaseline(const std::string& path, std::map<std::string, double>& baseline) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+    std::string label;
+    double rate;
+    while (file >> label >> rate) {
+        baseline[label] = rate;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    unsigned long iterations = 2000;
+    unsigned long seed = std::random_device{}();
+    std::size_t maxLength = FUZZ_MAX_LENGTH;
+    double threshold = FUZZ_THRESHOLD;
+    std::string baselinePath;
+    std::string savePath;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string option = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing or invalid value for option.\n";
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (option == "--iterations")
+            iterations = std::strtoul(value, nullptr, 10);
+        else if (option == "--seed")
+            seed = std::strtoul(value, nullptr, 10);
+        else if (option == "--max-length")
+            maxLength = (std::size_t) std::strtoul(value, nullptr, 10);
+        else if (option == "--threshold")
+            threshold = std::atof(value);
+        else if (option == "--baseline")
+            baselinePath = value;
+        else if (option == "--save-baseline")
+            savePath = value;
+        else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 2;
+        }
+    }
+    if (threshold <= 0 || threshold >= 1) {
+        std::cerr << "Missing or invalid value for option.\n";
+        return 2;
+    }
+
+    // Inputs are laid out as the libFuzzer target expects them, so a failing seed can be replayed either way
+    std::mt19937 generator((std::mt19937::result_type) seed);
+    std::vector<std::uint8_t> input;
+    for (unsigned long i = 0; i < iterations; i++) {
+        const std::size_t length = FUZZ_HEADER_BYTES + 32 + NUM_BYTES + generator() % (maxLength + 1);
+        input.resize(length);
+        for (std::uint8_t& byte : input) byte = (std::uint8_t) generator();
+        // Small flips of the last byte of a block often turn the padding into another valid one
+        if ((input[2] & 1) != 0 && generator() % 2 == 0)
+            input[2] = (std::uint8_t) (1 | (generator() % 4) << 1);
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    std::cout << "Seed " << seed << ": " << iterations << " inputs, all implementations agree with the reference\n";
+
+    std::map<std::string, double> rates;
+    for (const auto& entry : throughput) {
+        rates[entry.first] = entry.second.second > 0 ? entry.second.first / entry.second.second / (1024 * 1024) : 0;
+        std::cout << std::left << std::setw(24) << entry.first << std::fixed << std::setprecision(3)
+                  << rates[entry.first] << " MiB/s\n";
+    }
+
+    if (!savePath.empty()) {
+        std::ofstream file(savePath, std::ios::trunc);
+        for (const auto& entry : rates) {
+            file << entry.first << " " << entry.second << "\n";
+        }
+        if (!file.good()) {
+            std::cerr << "Error: could not write " << savePath << "\n";
+            return 5;
+        }
+    }
+
+    if (!baselinePath.empty()) {
+        std::map<std::string, double> baseline;
+        if (!loadBaseline(baselinePath, baseline)) {
+            std::cerr << "Error: could not read " << baselinePath << "\n";
+            return 5;
+        }
+        bool regressed = false;
+        for (const auto& entry : baseline) {
+            const auto found = rates.find(entry.first);
+            if (found != rates.end() && found->second < entry.second * (1 - threshold)) {
+                std::cerr << "Regression: " << entry.first << " at " << found->second << " MiB/s against a baseline of "
+                          << entry.second << " MiB/s\n";
+                regressed = true;
+            }
+        }
+        if (regressed)
+            return 1;
+    }
+    return 0;
+}
+
+#endif
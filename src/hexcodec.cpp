@@ -0,0 +1,296 @@
+/**
+  @file hexcodec.cpp: Conversion between bytes and hex text
+  On x86 the bulk of the work is vectorised, AVX2 and SSSE3 are picked at run time and SSE2 is the baseline.
+  Every other target uses the scalar code, which also handles the ends of the input and any invalid characters.
+*/
+#include <cstring>
+#include "hexcodec.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HEX_X86 1
+#include <immintrin.h>
+#endif
+
+static const char hexDigits[] = "0123456789abcdef";
+
+
+/**
+  Value of a single hex digit
+  @param c: character to convert
+  @return 0-15, or -1 if c is not a hex digit
+*/
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+  Whether a character may separate bytes
+  @param c: character to check
+  @return true for spaces, tabs and carriage returns
+*/
+static bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+  Copy text leaving out the separators
+  @param text: input text
+  @param length: number of characters
+  @param dest: buffer with room for length characters
+  @return number of characters written
+*/
+static std::size_t removeSeparators(const char* text, std::size_t length, char* dest) {
+    std::size_t written = 0;
+    std::size_t i = 0;
+
+#ifdef HEX_X86
+    // Blocks without separators, the common no-space case, are copied whole
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i carriageReturn = _mm_set1_epi8('\r');
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (text + i));
+        __m128i separators = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, space), _mm_cmpeq_epi8(block, tab)),
+                                          _mm_cmpeq_epi8(block, carriageReturn));
+        if (_mm_movemask_epi8(separators) == 0) {
+            _mm_storeu_si128((__m128i*) (dest + written), block);
+            written += 16;
+        }
+        else {
+            for (std::size_t j = i; j < i + 16; j++) {
+                if (!isSeparator(text[j]))
+                    dest[written++] = text[j];
+            }
+        }
+    }
+#endif
+
+    for (; i < length; i++) {
+        if (!isSeparator(text[i]))
+            dest[written++] = text[i];
+    }
+    return written;
+}
+
+#ifdef HEX_X86
+/**
+  Convert 16 hex characters to nibble values with SSE2
+  @param chars: 16 characters
+  @param nibbles: the 16 values, valid only if the function returns true
+  @return true if every character is a hex digit
+*/
+static inline bool nibblesSse2(__m128i chars, __m128i& nibbles) {
+    const __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+    const __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                                          _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    const __m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                          _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    if (_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xFFFF)
+        return false;
+
+    nibbles = _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+                           _mm_and_si128(isAlpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+    return true;
+}
+
+/**
+  Join pairs of nibbles, high nibble first, into 16 bit lanes holding one byte each
+  @param nibbles: 16 nibble values
+  @return 8 byte values in 16 bit lanes
+*/
+static inline __m128i joinNibblesSse2(__m128i nibbles) {
+    const __m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4);
+    const __m128i low = _mm_srli_epi16(nibbles, 8);
+    return _mm_or_si128(high, low);
+}
+
+/**
+  Decode pairs of hex digits with SSE2, 32 characters at a time
+  @param text: hex digits without separators
+  @param numChars: number of characters, stops at the first invalid block
+  @param out: buffer for numChars / 2 bytes
+  @return number of characters decoded
+*/
+static std::size_t decodeSse2(const char* text, std::size_t numChars, unsigned char* out) {
+    std::size_t i = 0;
+    for (; i + 32 <= numChars; i += 32) {
+        __m128i first, second;
+        if (!nibblesSse2(_mm_loadu_si128((const __m128i*) (text + i)), first) ||
+            !nibblesSse2(_mm_loadu_si128((const __m128i*) (text + i + 16)), second))
+            break;
+        __m128i bytes = _mm_packus_epi16(joinNibblesSse2(first), joinNibblesSse2(second));
+        _mm_storeu_si128((__m128i*) (out + (i / 2)), bytes);
+    }
+    return i;
+}
+
+/**
+  Decode pairs of hex digits with AVX2, 64 characters at a time
+  @param text: hex digits without separators
+  @param numChars: number of characters, stops at the first invalid block
+  @param out: buffer for numChars / 2 bytes
+  @return number of characters decoded
+*/
+__attribute__((target("avx2")))
+static std::size_t decodeAvx2(const char* text, std::size_t numChars, unsigned char* out) {
+    const __m256i caseBit = _mm256_set1_epi8(0x20);
+    const __m256i digitLow = _mm256_set1_epi8('0' - 1);
+    const __m256i digitHigh = _mm256_set1_epi8('9' + 1);
+    const __m256i alphaLow = _mm256_set1_epi8('a' - 1);
+    const __m256i alphaHigh = _mm256_set1_epi8('f' + 1);
+    const __m256i lowByte = _mm256_set1_epi16(0x00FF);
+
+    std::size_t i = 0;
+    for (; i + 64 <= numChars; i += 64) {
+        __m256i joined[2];
+        bool valid = true;
+        for (int half = 0; half < 2; half++) {
+            const __m256i chars = _mm256_loadu_si256((const __m256i*) (text + i + (32 * half)));
+            const __m256i lower = _mm256_or_si256(chars, caseBit);
+            const __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, digitLow), _mm256_cmpgt_epi8(digitHigh, chars));
+            const __m256i isAlpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, alphaLow), _mm256_cmpgt_epi8(alphaHigh, lower));
+            if (_mm256_movemask_epi8(_mm256_or_si256(isDigit, isAlpha)) != -1) {
+                valid = false;
+                break;
+            }
+            const __m256i nibbles = _mm256_or_si256(_mm256_and_si256(isDigit, _mm256_sub_epi8(chars, _mm256_set1_epi8('0'))),
+                                                    _mm256_and_si256(isAlpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+            joined[half] = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(nibbles, lowByte), 4),
+                                           _mm256_srli_epi16(nibbles, 8));
+        }
+        if (!valid)
+            break;
+
+        // packus works within each 128 bit lane, so the quarters are put back in order afterwards
+        __m256i bytes = _mm256_packus_epi16(joined[0], joined[1]);
+        bytes = _mm256_permute4x64_epi64(bytes, 0xD8);
+        _mm256_storeu_si256((__m256i*) (out + (i / 2)), bytes);
+    }
+    return i;
+}
+
+/**
+  Encode bytes as hex digits with SSSE3, 16 bytes at a time
+  @param data: bytes to encode
+  @param length: number of bytes
+  @param spaced: true to follow each byte with a space
+  @param out: buffer for 2 or 3 characters per byte
+  @return number of bytes encoded
+*/
+__attribute__((target("ssse3")))
+static std::size_t encodeSsse3(const unsigned char* data, std::size_t length, bool spaced, char* out) {
+    const __m128i digits = _mm_loadu_si128((const __m128i*) hexDigits);
+    const __m128i lowNibble = _mm_set1_epi8(0x0F);
+
+    // Shuffles spreading 32 hex characters (first: 0-15, second: 16-31) into 48 characters with spaces
+    // An index of -1 leaves a zero which is then filled with a space
+    const __m128i spread0 = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10);
+    const __m128i spread1First = _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i spread1Second = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 1, -1, 2, 3, -1, 4, 5);
+    const __m128i spread2 = _mm_setr_epi8(-1, 6, 7, -1, 8, 9, -1, 10, 11, -1, 12, 13, -1, 14, 15, -1);
+    const __m128i spaces0 = _mm_setr_epi8(0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0);
+    const __m128i spaces1 = _mm_setr_epi8(0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0);
+    const __m128i spaces2 = _mm_setr_epi8(' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ');
+
+    std::size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i bytes = _mm_loadu_si128((const __m128i*) (data + i));
+        const __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), lowNibble));
+        const __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, lowNibble));
+        const __m128i first = _mm_unpacklo_epi8(high, low);
+        const __m128i second = _mm_unpackhi_epi8(high, low);
+
+        if (!spaced) {
+            _mm_storeu_si128((__m128i*) (out + (2 * i)), first);
+            _mm_storeu_si128((__m128i*) (out + (2 * i) + 16), second);
+            continue;
+        }
+
+        char* dest = out + (3 * i);
+        _mm_storeu_si128((__m128i*) dest, _mm_or_si128(_mm_shuffle_epi8(first, spread0), spaces0));
+        _mm_storeu_si128((__m128i*) (dest + 16),
+                         _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(first, spread1First), _mm_shuffle_epi8(second, spread1Second)), spaces1));
+        _mm_storeu_si128((__m128i*) (dest + 32), _mm_or_si128(_mm_shuffle_epi8(second, spread2), spaces2));
+    }
+    return i;
+}
+#endif
+
+/**
+  Decode hex text into bytes
+  Bytes may be separated by spaces, tabs or carriage returns or written without separators, upper and lower case are accepted.
+  A trailing single digit is taken as a byte on its own.
+  @param text: hex text
+  @param length: number of characters
+  @param out: vector the bytes are appended to
+  @return false if the text contains anything other than hex digits and separators, out is left unchanged
+*/
+bool hexDecode(const char* text, std::size_t length, std::vector<unsigned char>& out) {
+    std::string digits(length, '\0');
+    const std::size_t numChars = removeSeparators(text, length, &digits[0]);
+
+    const std::size_t start = out.size();
+    out.resize(start + ((numChars + 1) / 2));
+    unsigned char* dest = out.data() + start;
+
+    std::size_t i = 0;
+#ifdef HEX_X86
+    if (__builtin_cpu_supports("avx2"))
+        i = decodeAvx2(digits.data(), numChars, dest);
+    i += decodeSse2(digits.data() + i, numChars - i, dest + (i / 2));
+#endif
+
+    for (; i + 1 < numChars; i += 2) {
+        const int high = hexValue(digits[i]);
+        const int low = hexValue(digits[i + 1]);
+        if (high < 0 || low < 0) {
+            out.resize(start);
+            return false;
+        }
+        dest[i / 2] = (unsigned char) ((high << 4) | low);
+    }
+
+    if (i < numChars) {
+        const int value = hexValue(digits[i]);
+        if (value < 0) {
+            out.resize(start);
+            return false;
+        }
+        dest[i / 2] = (unsigned char) value;
+    }
+    return true;
+}
+
+/**
+  Encode bytes as lower case hex text
+  @param data: bytes to encode
+  @param length: number of bytes
+  @param spaced: true to follow each byte with a space, as printed by printVector()
+  @param out: string the text is appended to
+  @return none
+*/
+void hexEncode(const unsigned char* data, std::size_t length, bool spaced, std::string& out) {
+    const std::size_t width = spaced ? 3 : 2;
+    const std::size_t start = out.size();
+    out.resize(start + (width * length));
+    char* dest = &out[start];
+
+    std::size_t i = 0;
+#ifdef HEX_X86
+    if (__builtin_cpu_supports("ssse3"))
+        i = encodeSsse3(data, length, spaced, dest);
+#endif
+
+    for (; i < length; i++) {
+        dest[width * i] = hexDigits[data[i] >> 4];
+        dest[(width * i) + 1] = hexDigits[data[i] & 0x0F];
+        if (spaced)
+            dest[(width * i) + 2] = ' ';
+    }
+}
@@ -0,0 +1,14 @@
+/**
+  @file hexcodec.hpp: Conversion between bytes and hex text
+*/
+#ifndef SRC_HEXCODEC_HPP
+#define SRC_HEXCODEC_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+bool hexDecode(const char* text, std::size_t length, std::vector<unsigned char>& out);
+void hexEncode(const unsigned char* data, std::size_t length, bool spaced, std::string& out);
+
+#endif
@@ -3,22 +3,25 @@
 */
 
 #include "interface.hpp"
+#include "hexcodec.hpp"
 
 
 
 /**
    Print the contents of a vector as bytes
     @param vec: vector of unsigned char values to be printed in hex format
+    @param stream: stream to print to, standard output by default
     @return none
  */
-void printVector(std::vector<unsigned char>& vec) {
-    for(std::size_t i = 0; i < vec.size(); i++) { 
-        if((int) vec[i] < 16) {
-            std::cout << '0';
-        }
-        std::cout << std::hex << (int) vec[i] << " ";
-    }
-    std::cout << std::endl;
+void printVector(std::vector<unsigned char>& vec, std::ostream& stream) {
+    // Build the whole line first so it goes out in a single write
+    std::string line;
+    line.reserve(3 * vec.size() + 1);
+    hexEncode(vec.data(), vec.size(), true, line);
+    line.push_back('\n');
+
+    stream.write(line.data(), line.size());
+    stream.flush();
 }
 
 /**
@@ -109,24 +112,46 @@ int getKeySizeInBytes(char* keySize) {
 }
 
 /**
-    Method for testing. Print the contents of vector as bytes
-    @param vec: vector of hex values to be printed
-    @return none
+    Convert the name of a mode of operation from the command line
+    @param mode: mode name in lower or upper case
+    @return the matching mode, or MODE_INVALID
+ */
+AESMode getMode(const char* mode) {
+    if(std::strcmp(mode, "ecb") == 0 || std::strcmp(mode, "ECB") == 0)
+        return MODE_ECB;
+    if(std::strcmp(mode, "cbc") == 0 || std::strcmp(mode, "CBC") == 0)
+        return MODE_CBC;
+    if(std::strcmp(mode, "cts") == 0 || std::strcmp(mode, "CTS") == 0)
+        return MODE_CTS;
+    if(std::strcmp(mode, "cfb") == 0 || std::strcmp(mode, "CFB") == 0)
+        return MODE_CFB;
+    if(std::strcmp(mode, "ofb") == 0 || std::strcmp(mode, "OFB") == 0)
+        return MODE_OFB;
+    if(std::strcmp(mode, "ctr") == 0 || std::strcmp(mode, "CTR") == 0)
+        return MODE_CTR;
+
+    return MODE_INVALID;
+}
+
+/**
+    Read a line of hex from standard input into a vector
+    @param vec: vector the bytes are appended to
+    @return false if the line is not valid hex, vec is left unchanged
  */
-void inputToVector(std::vector<unsigned char>& vec) {
+bool inputToVector(std::vector<unsigned char>& vec) {
     std::string line;
-    unsigned char char_iterator;;
 
     std::getline(std::cin, line);
 
-    // Remove spaces from input
-    std::string::iterator end_pos = std::remove(line.begin(), line.end(), ' ');
-    line.erase(end_pos, line.end());
-
+    return hexToVector(line, vec);
+}
 
-    // Convert each byte to integer, then store as unsigned char in input vector
-    for (std::size_t i = 0; i < line.size(); i += 2) { 
-        unsigned char byteValue = (unsigned char) std::stoi(line.substr(i, 2), nullptr, 16);
-        vec.push_back(byteValue); 
-    }
+/**
+    Convert a line of hex digits, with or without spaces between bytes, to bytes
+    @param line: hex string to convert
+    @param vec: vector the bytes are appended to
+    @return false if the line is not valid hex, vec is left unchanged
+ */
+bool hexToVector(const std::string& line, std::vector<unsigned char>& vec) {
+    return hexDecode(line.data(), line.size(), vec);
 }
@@ -10,13 +10,16 @@
 #include <algorithm>
 #include <cstring>
 #include "AESmath.hpp"
+#include "AESmodes.hpp"
 
-void printVector(std::vector<unsigned char>& vec);
+void printVector(std::vector<unsigned char>& vec, std::ostream& stream = std::cout);
 void printEncryptionResults(std::vector<unsigned char>& output, std::vector<unsigned char>& key);
 void printEncryptionResults(std::vector<unsigned char>& output, std::vector<unsigned char>& key, std::vector<unsigned char>& iv);
 void printEncryptionResults(std::vector<unsigned char>& output, std::vector<unsigned char>& key, std::array<unsigned char, NUM_BYTES / 2>& nonce);
 void printDecrpytionResults(std::vector<unsigned char>& output);
 int getKeySizeInBytes(char* keySize);
-void inputToVector(std::vector<unsigned char>& vec);
+AESMode getMode(const char* mode);
+bool inputToVector(std::vector<unsigned char>& vec);
+bool hexToVector(const std::string& line, std::vector<unsigned char>& vec);
 
 #endif
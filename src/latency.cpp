@@ -0,0 +1,294 @@
+/**
+  @file latency.cpp: Latency benchmark for the mode functions on small messages
+  Each encrypt_* and decrypt_* function is called repeatedly on one message size, with a fresh output vector
+  per call as a caller would pass. Every call is timed on its own into a log-linear histogram, and the heap
+  allocations made during the calls are counted by replacing the global operator new.
+  Percentiles, the mean and allocations per call are written as JSON on stdout; progress goes to stderr.
+  Usage: ./latency [--sizes 64,128,256,512] [--iterations N] [--warmup N] [--out FILE]
+*/
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <array>
+#include <string>
+#include <chrono>
+#include <random>
+#include <new>
+#include <cstdint>
+#include <cstdlib>
+#include "AESmodes.hpp"
+
+// Sub-buckets per power of two in the histogram, giving about 3% resolution
+#define LATENCY_SUB_BUCKET_BITS 5
+// Powers of two covered by the histogram, enough for calls up to about 18 minutes
+#define LATENCY_MAX_EXPONENT 40
+// Largest message size accepted
+#define LATENCY_MAX_SIZE 65536
+
+// Heap allocations so far. The benchmark is single threaded, so plain counters are enough.
+static std::uint64_t allocationCount = 0;
+static std::uint64_t allocationBytes = 0;
+
+void* operator new(std::size_t size) {
+    allocationCount++;
+    allocationBytes += size;
+    void* pointer = std::malloc(size ? size : 1);
+    if (pointer == nullptr)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+
+//LatencyHistogram class
+//Log-linear buckets in the style of HdrHistogram: values below 2^LATENCY_SUB_BUCKET_BITS are exact, and
+//every power of two above that is split into 2^LATENCY_SUB_BUCKET_BITS equal buckets
+class LatencyHistogram {
+public:
+    LatencyHistogram() : buckets((LATENCY_MAX_EXPONENT + 1) << LATENCY_SUB_BUCKET_BITS, 0), count(0), total(0), maximum(0) {}
+
+    /**
+      Records one value
+      @param value: the value, in nanoseconds
+      @return none
+    */
+    void record(std::uint64_t value) {
+        buckets[std::min(bucketIndex(value), buckets.size() - 1)]++;
+        count++;
+        total += value;
+        maximum = std::max(maximum, value);
+    }
+
+    /**
+      Value at a percentile
+      @param percentile: percentile between 0 and 100
+      @return the highest value of the bucket holding the percentile, 0 if nothing was recorded
+    */
+    std::uint64_t percentile(double percentile) const {
+        if (count == 0)
+            return 0;
+        std::uint64_t rank = (std::uint64_t) (percentile / 100.0 * count + 0.5);
+        rank = std::max<std::uint64_t>(rank, 1);
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < buckets.size(); i++) {
+            seen += buckets[i];
+            if (seen >= rank)
+                return std::min(bucketTop(i), maximum);
+        }
+        return maximum;
+    }
+
+    double mean() const {
+        return count ? (double) total / count : 0.0;
+    }
+
+    std::uint64_t max() const {
+        return maximum;
+    }
+
+private:
+    static std::size_t bucketIndex(std::uint64_t value) {
+        const std::uint64_t subBuckets = 1ULL << LATENCY_SUB_BUCKET_BITS;
+        if (value < subBuckets)
+            return (std::size_t) value;
+        unsigned exponent = 0;
+        while ((value >> exponent) >= 2 * subBuckets)
+            exponent++;
+        // value >> exponent is in [subBuckets, 2 * subBuckets)
+        return (std::size_t) (((exponent + 1) << LATENCY_SUB_BUCKET_BITS) + ((value >> exponent) - subBuckets));
+    }
+
+    static std::uint64_t bucketTop(std::size_t index) {
+        const std::uint64_t subBuckets = 1ULL << LATENCY_SUB_BUCKET_BITS;
+        if (index < subBuckets)
+            return index;
+        const unsigned exponent = (unsigned) (index >> LATENCY_SUB_BUCKET_BITS) - 1;
+        const std::uint64_t mantissa = subBuckets + (index & (subBuckets - 1));
+        return ((mantissa + 1) << exponent) - 1;
+    }
+
+    std::vector<std::uint64_t> buckets;
+    std::uint64_t count;
+    std::uint64_t total;
+    std::uint64_t maximum;
+};
+
+// One mode function under test, called with the message, the output and the key, IV and nonce
+struct LatencyCase {
+    const char* name;
+    bool encrypting;
+    bool (*call)(const std::vector<unsigned char>& input, std::vector<unsigned char>& output,
+                 const std::vector<unsigned char>& key, const std::vector<unsigned char>& iv,
+                 const std::array<unsigned char, NUM_BYTES / 2>& nonce);
+};
+
+static const LatencyCase latencyCases[] = {
+    {"encrypt_ecb", true, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                             const std::vector<unsigned char>&, const std::array<unsigned char, NUM_BYTES / 2>&) {
+        return encrypt_ecb(in, out, key); }},
+    {"decrypt_ecb", false, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                              const std::vector<unsigned char>&, const std::array<unsigned char, NUM_BYTES / 2>&) {
+        return decrypt_ecb(in, out, key); }},
+    {"encrypt_cbc", true, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                             const std::vector<unsigned char>& iv, const std::array<unsigned char, NUM_BYTES / 2>&) {
+        return encrypt_cbc(in, out, key, iv); }},
+    {"decrypt_cbc", false, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                              const std::vector<unsigned char>& iv, const std::array<unsigned char, NUM_BYTES / 2>&) {
+        return decrypt_cbc(in, out, key, iv); }},
+    {"encrypt_cbc_cs3", true, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                                 const std::vector<unsigned char>& iv, const std::array<unsigned char, NUM_BYTES / 2>&) {
+        return encrypt_cbc_cs3(in, out, key, iv); }},
+    {"decrypt_cbc_cs3", false, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                                  const std::vector<unsigned char>& iv, const std::array<unsigned char, NUM_BYTES / 2>&) {
+        return decrypt_cbc_cs3(in, out, key, iv); }},
+    {"encrypt_cfb", true, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                             const std::vector<unsigned char>& iv, const std::array<unsigned char, NUM_BYTES / 2>&) {
+        return encrypt_cfb(in, out, key, iv); }},
+    {"decrypt_cfb", false, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                              const std::vector<unsigned char>& iv, const std::array<unsigned char, NUM_BYTES / 2>&) {
+        return decrypt_cfb(in, out, key, iv); }},
+    {"encrypt_ofb", true, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                             const std::vector<unsigned char>& iv, const std::array<unsigned char, NUM_BYTES / 2>&) {
+        return encrypt_ofb(in, out, key, iv); }},
+    {"decrypt_ofb", false, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                              const std::vector<unsigned char>& iv, const std::array<unsigned char, NUM_BYTES / 2>&) {
+        return decrypt_ofb(in, out, key, iv); }},
+    {"encrypt_ctr", true, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                             const std::vector<unsigned char>&, const std::array<unsigned char, NUM_BYTES / 2>& nonce) {
+        return encrypt_ctr(in, out, key, nonce); }},
+    {"decrypt_ctr", false, [](const std::vector<unsigned char>& in, std::vector<unsigned char>& out, const std::vector<unsigned char>& key,
+                              const std::vector<unsigned char>&, const std::array<unsigned char, NUM_BYTES / 2>& nonce) {
+        return decrypt_ctr(in, out, key, nonce); }},
+};
+
+int main(int argc, char** argv) {
+    std::vector<std::size_t> sizes = {64, 128, 256, 512};
+    unsigned iterations = 2000;
+    unsigned warmup = 100;
+    std::string outPath;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string option = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing or invalid value for option.\n";
+            return 2;
+        }
+        const char* value = argv[++i];
+        bool valid = true;
+        if (option == "--sizes") {
+            sizes.clear();
+            std::stringstream stream(value);
+            std::string item;
+            while (std::getline(stream, item, ',')) {
+                const long size = std::atol(item.c_str());
+                // CTS needs at least one whole block
+                valid = valid && size >= NUM_BYTES && size <= LATENCY_MAX_SIZE;
+                sizes.push_back((std::size_t) size);
+            }
+            valid = valid && !sizes.empty();
+        } else if (option == "--iterations") {
+            iterations = (unsigned) std::atoi(value);
+            valid = iterations >= 1;
+        } else if (option == "--warmup") {
+            warmup = (unsigned) std::atoi(value);
+        } else if (option == "--out") {
+            outPath = value;
+        } else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 2;
+        }
+        if (!valid) {
+            std::cerr << "Missing or invalid value for option.\n";
+            return 2;
+        }
+    }
+
+    std::mt19937 generator(std::random_device{}());
+    std::vector<unsigned char> key(16);
+    std::vector<unsigned char> iv(NUM_BYTES);
+    std::array<unsigned char, NUM_BYTES / 2> nonce;
+    for (unsigned char& byte : key) byte = (unsigned char) generator();
+    for (unsigned char& byte : iv) byte = (unsigned char) generator();
+    for (unsigned char& byte : nonce) byte = (unsigned char) generator();
+
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(2)
+         << "{\n  \"iterations\": " << iterations << ",\n  \"warmup\": " << warmup << ",\n  \"key_bits\": 128,\n"
+         << "  \"results\": [";
+    bool first = true;
+
+    for (std::size_t size : sizes) {
+        std::vector<unsigned char> message(size);
+        for (unsigned char& byte : message) byte = (unsigned char) generator();
+
+        for (std::size_t c = 0; c < sizeof(latencyCases) / sizeof(latencyCases[0]); c++) {
+            const LatencyCase& test = latencyCases[c];
+            std::cerr << test.name << " " << size << " bytes\n";
+
+            // Decryption is timed on the ciphertext of the matching encryption, which precedes it in the table
+            std::vector<unsigned char> input = message;
+            if (!test.encrypting) {
+                input.clear();
+                if (!latencyCases[c - 1].call(message, input, key, iv, nonce)) {
+                    std::cerr << "Error: " << latencyCases[c - 1].name << " failed.\n";
+                    return 3;
+                }
+            }
+
+            bool ok = true;
+            for (unsigned i = 0; i < warmup; i++) {
+                std::vector<unsigned char> output;
+                ok = test.call(input, output, key, iv, nonce) && ok;
+            }
+
+            LatencyHistogram histogram;
+            const std::uint64_t startCount = allocationCount;
+            const std::uint64_t startBytes = allocationBytes;
+            for (unsigned i = 0; i < iterations; i++) {
+                const auto start = std::chrono::steady_clock::now();
+                {
+                    std::vector<unsigned char> output;
+                    ok = test.call(input, output, key, iv, nonce) && ok;
+                }
+                const auto end = std::chrono::steady_clock::now();
+                histogram.record((std::uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+            }
+            const double allocations = (double) (allocationCount - startCount) / iterations;
+            const double allocatedBytes = (double) (allocationBytes - startBytes) / iterations;
+            if (!ok) {
+                std::cerr << "Error: " << test.name << " failed.\n";
+                return 3;
+            }
+
+            json << (first ? "\n" : ",\n") << "    {\"operation\": \"" << test.name << "\", \"bytes\": " << size
+                 << ", \"p50_ns\": " << histogram.percentile(50) << ", \"p90_ns\": " << histogram.percentile(90)
+                 << ", \"p99_ns\": " << histogram.percentile(99) << ", \"p99_9_ns\": " << histogram.percentile(99.9)
+                 << ", \"max_ns\": " << histogram.max() << ", \"mean_ns\": " << histogram.mean()
+                 << ", \"allocations_per_call\": " << allocations << ", \"allocated_bytes_per_call\": " << allocatedBytes << "}";
+            first = false;
+        }
+    }
+    json << "\n  ]\n}\n";
+
+    if (outPath.empty()) {
+        std::cout << json.str();
+        return 0;
+    }
+    std::ofstream out(outPath);
+    out << json.str();
+    if (!out.good()) {
+        std::cerr << "Error: could not write " << outPath << "\n";
+        return 5;
+    }
+    return 0;
+}
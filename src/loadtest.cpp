@@ -0,0 +1,194 @@
+/**
+  @file loadtest.cpp: Load test client for the encryption daemon
+  Each connection registers its own random key and sends encrypt requests back to back, checking a
+  sample of the results by decrypting them. Reports request rate, throughput and latency percentiles.
+  The transport is the socket, or a shared memory ring per connection that is polled (ring-poll) or
+  woken through eventfds (ring-eventfd), with RING_LOADTEST_DEPTH requests kept in flight.
+  Usage: ./loadtest SOCKET [connections] [requests per connection] [message size] [mode] [socket|ring-poll|ring-eventfd]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include "daemonclient.hpp"
+#include "interface.hpp"
+#include "ring.hpp"
+
+// Requests in flight on each ring
+#define RING_LOADTEST_DEPTH 64
+// Every this many requests the ciphertext is decrypted again and compared
+#define LOADTEST_CHECK_INTERVAL 100
+
+
+/**
+  Value at a percentile of sorted samples
+  @param sorted: samples in ascending order
+  @param percentile: percentile between 0 and 100
+  @return the sample, 0 if there are none
+*/
+static std::uint32_t percentile(const std::vector<std::uint32_t>& sorted, double percentile) {
+    if (sorted.empty())
+        return 0;
+    std::size_t index = (std::size_t) (percentile / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: ./loadtest SOCKET [connections] [requests per connection] [message size] [mode]"
+                  << " [socket|ring-poll|ring-eventfd]\n";
+        return 2;
+    }
+    const char* socketPath = argv[1];
+    const unsigned numConnections = (argc > 2) ? (unsigned) std::max(std::atoi(argv[2]), 1) : 4;
+    const unsigned requestsPerConnection = (argc > 3) ? (unsigned) std::max(std::atoi(argv[3]), 1) : 10000;
+    const std::size_t messageSize = (argc > 4) ? (std::size_t) std::max(std::atoi(argv[4]), 0) : 64;
+    const AESMode mode = (argc > 5) ? getMode(argv[5]) : MODE_CBC;
+    if (mode == MODE_INVALID || (mode == MODE_CTS && messageSize < NUM_BYTES)) {
+        std::cerr << "Invalid mode.\n";
+        return 2;
+    }
+    const std::string transport = (argc > 6) ? argv[6] : "socket";
+    if (transport != "socket" && transport != "ring-poll" && transport != "ring-eventfd") {
+        std::cerr << "Invalid transport.\n";
+        return 2;
+    }
+
+    std::mutex resultMutex;
+    std::vector<std::uint32_t> roundTrips;
+    std::vector<std::uint32_t> daemonTimes;
+    unsigned failures = 0;
+
+    auto run = [&](unsigned index) {
+        unsigned numRequests = requestsPerConnection;
+        std::mt19937 generator(std::random_device{}() + index);
+        std::vector<unsigned char> key(32);
+        std::vector<unsigned char> iv((mode == MODE_ECB) ? 0 : (mode == MODE_CTR) ? NUM_BYTES / 2 : NUM_BYTES);
+        std::vector<unsigned char> message(messageSize);
+        for (unsigned char& byte : key) byte = (unsigned char) generator();
+        for (unsigned char& byte : iv) byte = (unsigned char) generator();
+        for (unsigned char& byte : message) byte = (unsigned char) generator();
+
+        std::vector<std::uint32_t> localTrips;
+        std::vector<std::uint32_t> localTimes;
+        unsigned localFailures = 0;
+        localTrips.reserve(numRequests);
+        localTimes.reserve(numRequests);
+
+        DaemonClient client;
+        std::uint32_t keyId;
+        if (!client.connect(socketPath) || !client.registerKey(key, keyId)) {
+            std::lock_guard<std::mutex> lock(resultMutex);
+            failures += requestsPerConnection;
+            return;
+        }
+
+        std::vector<unsigned char> ciphertext;
+        std::vector<unsigned char> plaintext;
+        if (transport != "socket") {
+            // Each slot of the data area holds one message and room for its padding
+            const std::size_t slotSize = ((messageSize + NUM_BYTES + 63) / 64) * 64;
+            SharedRing ring;
+            if (!ring.create(RING_LOADTEST_DEPTH, slotSize * RING_LOADTEST_DEPTH, transport == "ring-eventfd") ||
+                !ring.attach(client) || !client.encrypt(keyId, mode, iv, message, ciphertext)) {
+                localFailures = numRequests;
+                numRequests = 0;
+            }
+
+            std::vector<std::chrono::steady_clock::time_point> submitted(RING_LOADTEST_DEPTH);
+            unsigned sent = 0;
+            unsigned received = 0;
+            while (received < numRequests) {
+                while (sent < numRequests && sent - received < RING_LOADTEST_DEPTH) {
+                    const unsigned slot = sent % RING_LOADTEST_DEPTH;
+                    std::copy(message.begin(), message.end(), ring.data() + slot * slotSize);
+
+                    RingDescriptor descriptor = {};
+                    descriptor.offset = slot * slotSize;
+                    descriptor.length = (std::uint32_t) messageSize;
+                    descriptor.capacity = (std::uint32_t) slotSize;
+                    descriptor.keyId = keyId;
+                    descriptor.mode = (std::uint8_t) mode;
+                    descriptor.encrypting = 1;
+                    descriptor.ivLength = (std::uint8_t) iv.size();
+                    std::copy(iv.begin(), iv.end(), descriptor.iv);
+                    descriptor.userData = slot;
+                    submitted[slot] = std::chrono::steady_clock::now();
+                    ring.submit(descriptor);
+                    sent++;
+                }
+
+                RingCompletion completion;
+                if (!ring.wait(completion))
+                    break;
+                received++;
+                const auto trip = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - submitted[completion.userData]).count();
+
+                // The ciphertext is compared in place against the socket's answer
+                const unsigned char* result = ring.data() + completion.userData * slotSize;
+                if (completion.status != DAEMON_OK || completion.length != ciphertext.size() ||
+                    (received % LOADTEST_CHECK_INTERVAL == 0 && !std::equal(ciphertext.begin(), ciphertext.end(), result))) {
+                    localFailures++;
+                    continue;
+                }
+                localTrips.push_back((std::uint32_t) trip);
+                localTimes.push_back(completion.micros);
+            }
+        }
+
+        for (unsigned i = 0; i < numRequests && transport == "socket"; i++) {
+            std::uint32_t micros = 0;
+            const auto start = std::chrono::steady_clock::now();
+            bool ok = client.encrypt(keyId, mode, iv, message, ciphertext, &micros);
+            const auto trip = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+            if (ok && i % LOADTEST_CHECK_INTERVAL == 0)
+                ok = client.decrypt(keyId, mode, iv, ciphertext, plaintext) && plaintext == message;
+            if (!ok) {
+                localFailures++;
+                continue;
+            }
+            localTrips.push_back((std::uint32_t) trip);
+            localTimes.push_back(micros);
+        }
+        client.unregisterKey(keyId);
+
+        std::lock_guard<std::mutex> lock(resultMutex);
+        roundTrips.insert(roundTrips.end(), localTrips.begin(), localTrips.end());
+        daemonTimes.insert(daemonTimes.end(), localTimes.begin(), localTimes.end());
+        failures += localFailures;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < numConnections; i++) {
+        threads.emplace_back(run, i);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(roundTrips.begin(), roundTrips.end());
+    std::sort(daemonTimes.begin(), daemonTimes.end());
+    const double completed = (double) roundTrips.size();
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "Connections: " << numConnections << ", requests: " << roundTrips.size() << ", failures: " << failures
+              << ", message size: " << messageSize << "\n"
+              << "Requests/s: " << (seconds > 0 ? completed / seconds : 0.0)
+              << ", throughput: " << (seconds > 0 ? completed * messageSize / seconds / (1024 * 1024) : 0.0) << " MiB/s\n"
+              << "Round trip us p50/p90/p99/max: " << percentile(roundTrips, 50) << "/" << percentile(roundTrips, 90) << "/"
+              << percentile(roundTrips, 99) << "/" << percentile(roundTrips, 100) << "\n"
+              << "Daemon us p50/p90/p99/max: " << percentile(daemonTimes, 50) << "/" << percentile(daemonTimes, 90) << "/"
+              << percentile(daemonTimes, 99) << "/" << percentile(daemonTimes, 100) << std::endl;
+    return failures == 0 ? 0 : 1;
+}
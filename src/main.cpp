@@ -7,21 +7,83 @@
 #include <string>
 #include <algorithm>
 #include <cstring>
+#include <cstdlib>
 #include "AESRand.hpp"
 #include "AESmodes.hpp"
 #include "encrypt.hpp"
 #include "decrypt.hpp"
 #include "interface.hpp"
+#include "filemode.hpp"
+#include "batch.hpp"
+#include "daemon.hpp"
+#include "AESStats.hpp"
+#include "AESTrace.hpp"
+#include "autotune.hpp"
 
 
-// USAGE: ./main [enc, encrypt/ dec, decrypt] [ecb/cbc/cfb/ofb/ctr] [-r/-k] [128, 192, 256] (-iv/-nonce)
+// USAGE: ./main [enc, encrypt/ dec, decrypt] [ecb/cbc/cts/cfb/ofb/ctr] [-r/-k] [128, 192, 256] (-iv/-nonce)
 
 // [] - required parameters*
 // () - optional parameters
 // *[-r/-k] omitted for decryption
+// Binary data: add --in FILE, --out FILE or --binary (raw standard input/output),
+// optionally with --key HEX and --iv HEX / --nonce HEX
+// Batch: ./main batch reads one record per line from standard input, see batch.cpp
+// Daemon: ./main daemon SOCKET serves requests on a Unix domain socket, see daemon.cpp
+// Statistics: --stats anywhere on the command line prints the runtime counters to standard error on exit
+// Autotune: ./main autotune measures this host and saves the fastest settings, which later runs load, see autotune.cpp
+// Tracing: --trace FILE anywhere on the command line writes Chrome trace event JSON to FILE on exit
+
+// File given with --trace
+static const char* tracePath = nullptr;
+
+/**
+    Print the runtime counters, registered with atexit() for --stats
+    @return none
+ */
+static void printStats() {
+    AESStats::report(std::cerr);
+}
+
+/**
+    Write the trace, registered with atexit() for --trace
+    @return none
+ */
+static void writeTrace() {
+    if (!AESTrace::writeFile(tracePath))
+        std::cerr << "Error: could not write the trace to " << tracePath << "\n";
+}
 
 int main(int argc, char** argv) {
-    AESRand rand;
+    // --stats and --trace apply to every mode, so they are taken out before the other arguments are looked at
+    bool stats = false;
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+            continue;
+        }
+        if (std::strcmp(argv[i], "--trace") == 0) {
+            if (i + 1 >= argc) {
+                std::cout << "Missing or invalid value for option.\n";
+                return 2;
+            }
+            tracePath = argv[++i];
+            continue;
+        }
+        argv[kept++] = argv[i];
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    if (stats)
+        std::atexit(printStats);
+    if (tracePath != nullptr) {
+        AESTrace::start();
+        AESTrace::nameThread("main");
+        std::atexit(writeTrace);
+    }
+
+    AESRand& rand = AESRand::threadLocal();
     std::vector<unsigned char> input;
     std::vector<unsigned char> output;
     std::vector<unsigned char> key;
@@ -33,6 +95,23 @@ int main(int argc, char** argv) {
 
     bool algorithmSuccess;
 
+    // Binary file and stream data bypasses the hex prompts
+    FileOptions fileOptions;
+    applyAutotuneConfig(fileOptions);
+    if (!extractFileOptions(argc, argv, fileOptions)) {
+        std::cout << "Missing or invalid value for option.\n";
+        return 2;
+    }
+    if (fileOptions.enabled)
+        return runFileMode(argc, argv, fileOptions);
+
+    if (argc >= 2 && std::strcmp(argv[1], "autotune") == 0)
+        return runAutotune(argc, argv);
+    if (argc == 2 && std::strcmp(argv[1], "batch") == 0)
+        return runBatchMode();
+    if (argc == 3 && std::strcmp(argv[1], "daemon") == 0)
+        return runDaemon(argv[2]);
+
     if(argc >= 4) {
         char* aes_function = argv[1];
         char* mode = argv[2];
@@ -63,7 +142,10 @@ int main(int argc, char** argv) {
             // Receive plaintext to encrypt
             std::cout << "Enter plaintext: ";
 
-            inputToVector(input);
+            if (!inputToVector(input)) {
+                std::cout << "Invalid hexadecimal input.\n";
+                return 2;
+            }
 
             // Create random key if -r command line argument is provided
             if (std::strcmp(keyType, "-r") == 0) {
@@ -72,7 +154,10 @@ int main(int argc, char** argv) {
             // Receive key from user input if -k command line argument is provided
             else if (std::strcmp(keyType, "-k") == 0) {
                 std::cout << "Enter key: ";
-                inputToVector(key);
+                if (!inputToVector(key)) {
+                    std::cout << "Invalid hexadecimal input.\n";
+                    return 2;
+                }
                 // Check that user entered correct number of bytes for designated key size
                 if (key.size() != keyByteSize) {
                     std::cout << "Invalid number of bytes entered for key.\n";
@@ -103,7 +188,10 @@ int main(int argc, char** argv) {
                 // If -iv command line argument is provided, receive value of IV from user
                 if (argc == 6 && std::strcmp(argv[5], "-iv") == 0) {
                     std::cout << "Enter IV: ";
-                    inputToVector(iv);
+                    if (!inputToVector(iv)) {
+                        std::cout << "Invalid hexadecimal input.\n";
+                        return 2;
+                    }
 
                     // Ensure IV size is correct
                     if (iv.size() != NUM_BYTES) {
@@ -123,12 +211,43 @@ int main(int argc, char** argv) {
 
                 printEncryptionResults(output, key, iv);
             }
+            // Encryption with CBC and ciphertext stealing (no padding)
+            else if (std::strcmp(mode, "cts") == 0 || std::strcmp(mode, "CTS") == 0) {
+                // If -iv command line argument is provided, receive value of IV from user
+                if (argc == 6 && std::strcmp(argv[5], "-iv") == 0) {
+                    std::cout << "Enter IV: ";
+                    if (!inputToVector(iv)) {
+                        std::cout << "Invalid hexadecimal input.\n";
+                        return 2;
+                    }
+
+                    // Ensure IV size is correct
+                    if (iv.size() != NUM_BYTES) {
+                        std::cout << "Invalid number of bytes entered for IV\n";
+                        return 2;
+                    }
+
+                }
+                else {
+                    iv = rand.generateBytes(IV_SIZE);
+                }
+                algorithmSuccess = encrypt_cbc_cs3(input, output, key, iv);
+
+                // Stop execution if encryption is unsuccessful
+                if (!algorithmSuccess)
+                    return 3;
+
+                printEncryptionResults(output, key, iv);
+            }
             // Encryption with CFB
             else if (std::strcmp(mode, "cfb") == 0 || std::strcmp(mode, "CFB") == 0) {
                 // If -iv command line argument is provided, receive value of IV from user
                 if (argc == 6 && std::strcmp(argv[5], "-iv") == 0) {
                     std::cout << "Enter IV: ";
-                    inputToVector(iv);
+                    if (!inputToVector(iv)) {
+                        std::cout << "Invalid hexadecimal input.\n";
+                        return 2;
+                    }
 
                     // Ensure IV size is correct
                     if (iv.size() != NUM_BYTES) {
@@ -154,7 +273,10 @@ int main(int argc, char** argv) {
                 // If -iv command line argument is provided, receive value of IV from user
                 if (argc == 6 && std::strcmp(argv[5], "-iv") == 0) {
                     std::cout << "Enter IV: ";
-                    inputToVector(iv);
+                    if (!inputToVector(iv)) {
+                        std::cout << "Invalid hexadecimal input.\n";
+                        return 2;
+                    }
 
                     // Ensure IV size is correct
                     if (iv.size() != NUM_BYTES) {
@@ -184,7 +306,10 @@ int main(int argc, char** argv) {
                 // If -nonce command line argument is provided, receive value of nonce from user
                 if (argc == 6 && std::strcmp(argv[5], "-nonce") == 0) {
                     std::cout << "Enter nonce: ";
-                    inputToVector(vectorNonce);
+                    if (!inputToVector(vectorNonce)) {
+                        std::cout << "Invalid hexadecimal input.\n";
+                        return 2;
+                    }
 
                     if (vectorNonce.size() != NUM_BYTES / 2) {
                         std::cout << "Invalid number of bytes entered for nonce.\n";
@@ -226,11 +351,17 @@ int main(int argc, char** argv) {
 
             // Receive ciphertext to decrypt
             std::cout << "Enter ciphertext: ";
-            inputToVector(input);
+            if (!inputToVector(input)) {
+                std::cout << "Invalid hexadecimal input.\n";
+                return 2;
+            }
 
             // Receive key
             std::cout << "Enter key: ";
-            inputToVector(key);
+            if (!inputToVector(key)) {
+                std::cout << "Invalid hexadecimal input.\n";
+                return 2;
+            }
 
             // Ensure key is right size
             if (key.size() != 16 && key.size() != 24 && key.size() != 32) {
@@ -250,7 +381,10 @@ int main(int argc, char** argv) {
                 // Receive IV
                 std::cout << "Enter IV: ";
 
-                inputToVector(iv);
+                if (!inputToVector(iv)) {
+                    std::cout << "Invalid hexadecimal input.\n";
+                    return 2;
+                }
 
                 // Ensure IV size is correct
                 if (iv.size() != NUM_BYTES) {
@@ -265,11 +399,35 @@ int main(int argc, char** argv) {
                     return 3;
 
             }
+            // Decryption with CBC and ciphertext stealing
+            else if (std::strcmp(mode, "cts") == 0 || std::strcmp(mode, "CTS") == 0) {
+                // Receive IV
+                std::cout << "Enter IV: ";
+                if (!inputToVector(iv)) {
+                    std::cout << "Invalid hexadecimal input.\n";
+                    return 2;
+                }
+
+                // Ensure IV size is correct
+                if (iv.size() != NUM_BYTES) {
+                    std::cout << "Invalid number of bytes entered for IV\n";
+                    return 2;
+                }
+
+                algorithmSuccess = decrypt_cbc_cs3(input, output, key, iv);
+
+                // Stop execution if decryption is unsuccessful
+                if (!algorithmSuccess)
+                    return 3;
+            }
             // Decryption with CFB
             else if (std::strcmp(mode, "cfb") == 0|| std::strcmp(mode, "CFB") == 0) {
                 // Receive IV
                 std::cout << "Enter IV: ";
-                inputToVector(iv);
+                if (!inputToVector(iv)) {
+                    std::cout << "Invalid hexadecimal input.\n";
+                    return 2;
+                }
 
 
                 // Ensure IV size is correct
@@ -288,7 +446,10 @@ int main(int argc, char** argv) {
             else if (std::strcmp(mode, "ofb") == 0 || std::strcmp(mode, "OFB") == 0) {
                 // Receive IV
                 std::cout << "Enter IV: ";
-                inputToVector(iv);
+                if (!inputToVector(iv)) {
+                    std::cout << "Invalid hexadecimal input.\n";
+                    return 2;
+                }
 
 
                 // Ensure IV size is correct
@@ -310,7 +471,10 @@ int main(int argc, char** argv) {
 
                 // Receive nonce of initial counter
                 std::cout << "Enter nonce: ";
-                inputToVector(vectorNonce);
+                if (!inputToVector(vectorNonce)) {
+                    std::cout << "Invalid hexadecimal input.\n";
+                    return 2;
+                }
 
                 // Ensure proper number of bytes entered for upper half of initial counter
                 if (vectorNonce.size() != NUM_BYTES / 2) {
@@ -0,0 +1,572 @@
+/**
+  @file pipeline.cpp: Overlapping file I/O with encryption
+  A fixed pool of chunk buffers moves through read -> encrypt/decrypt -> write, so the disk keeps working
+  while the cipher runs and the throughput approaches the slower of the two instead of their sum.
+  Regular files use io_uring when the kernel provides it, with reads and writes at explicit offsets
+  completed by the kernel while the calling thread runs the cipher.
+  Anything else, such as pipes, or a kernel without io_uring, uses a reader thread and a writer thread.
+  The cipher always runs on the calling thread, in order, since the chained modes are sequential.
+*/
+
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "pipeline.hpp"
+#include "AESStats.hpp"
+#include "AESTrace.hpp"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PIPELINE_URING 1
+#include <linux/io_uring.h>
+#endif
+#endif
+
+
+// One buffer of the pool
+struct Slot {
+    std::vector<unsigned char> input;
+    std::size_t length = 0;
+    std::vector<unsigned char> output;
+};
+
+
+//BlockingQueue class, a mutex protected queue whose pop waits for an item
+template <typename T>
+class BlockingQueue {
+public:
+    void push(T item) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->items.push_back(item);
+        }
+        this->ready.notify_one();
+    }
+
+    T pop() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->ready.wait(lock, [this]() { return !this->items.empty(); });
+        T item = this->items.front();
+        this->items.pop_front();
+        return item;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<T> items;
+};
+
+
+/**
+  Read until the buffer is full or the input ends
+  @param fd: file descriptor to read from
+  @param buffer: buffer to fill
+  @param size: size of the buffer
+  @return number of bytes read, or -1 on an error
+*/
+static long readFull(int fd, unsigned char* buffer, std::size_t size) {
+    AES_STAT_TIMER(timer, STAT_NS_READ);
+    AESTrace::Span span("read", "bytes", (std::int64_t) size);
+    std::size_t filled = 0;
+    while (filled < size) {
+        ssize_t count = read(fd, buffer + filled, size - filled);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (count == 0)
+            break;
+        filled += (std::size_t) count;
+    }
+    return (long) filled;
+}
+
+/**
+  Write a whole buffer
+  @param fd: file descriptor to write to
+  @param data: bytes to write
+  @param length: number of bytes
+  @return false on a write error
+*/
+static bool writeFull(int fd, const unsigned char* data, std::size_t length) {
+    AES_STAT_TIMER(timer, STAT_NS_WRITE);
+    AESTrace::Span span("write", "bytes", (std::int64_t) length);
+    std::size_t written = 0;
+    while (written < length) {
+        ssize_t count = write(fd, data + written, length - written);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        written += (std::size_t) count;
+    }
+    return true;
+}
+
+/**
+  Pipeline using a reader thread and a writer thread
+  @param inFd: file descriptor to read from
+  @param outFd: file descriptor to write to
+  @param stream: cipher stream for the chosen mode and direction
+  @param slots: buffer pool
+  @return 0 on success, 3 on a cipher error, 5 on an I/O error
+*/
+static int threadPipeline(int inFd, int outFd, AESStream& stream, std::vector<Slot>& slots) {
+    BlockingQueue<int> freeSlots;
+    BlockingQueue<int> readSlots;
+    BlockingQueue<int> writeSlots;
+    std::atomic<bool> readError(false);
+    std::atomic<bool> writeError(false);
+
+    for (std::size_t i = 0; i < slots.size(); i++) {
+        freeSlots.push((int) i);
+    }
+
+    // An empty slot marks the end of the input
+    std::thread reader([&]() {
+        AESTrace::nameThread("reader");
+        while (true) {
+            int index = freeSlots.pop();
+            Slot& slot = slots[index];
+            long count = readFull(inFd, slot.input.data(), slot.input.size());
+            if (count < 0) {
+                readError = true;
+                count = 0;
+            }
+            slot.length = (std::size_t) count;
+            readSlots.push(index);
+            if (count == 0)
+                break;
+        }
+    });
+
+    // -1 marks the end of the output
+    std::thread writer([&]() {
+        AESTrace::nameThread("writer");
+        while (true) {
+            int index = writeSlots.pop();
+            if (index < 0)
+                break;
+            Slot& slot = slots[index];
+            if (!writeError && !writeFull(outFd, slot.output.data(), slot.output.size()))
+                writeError = true;
+            freeSlots.push(index);
+        }
+    });
+
+    bool cipherError = false;
+    while (true) {
+        int index = readSlots.pop();
+        Slot& slot = slots[index];
+        slot.output.clear();
+
+        if (slot.length == 0) {
+            if (!cipherError && !readError && !stream.finish(slot.output))
+                cipherError = true;
+            writeSlots.push(index);
+            break;
+        }
+
+        // After an error the remaining input is drained without being processed
+        if (!cipherError && !stream.update(slot.input.data(), slot.length, slot.output))
+            cipherError = true;
+        writeSlots.push(index);
+    }
+    writeSlots.push(-1);
+
+    reader.join();
+    writer.join();
+
+    if (readError || writeError)
+        return 5;
+    return cipherError ? 3 : 0;
+}
+
+#ifdef PIPELINE_URING
+
+//Uring class, a minimal io_uring submission and completion queue driven by raw system calls
+class Uring {
+public:
+    Uring() = default;
+
+    Uring(const Uring&) = delete;
+
+    Uring& operator=(const Uring&) = delete;
+
+    ~Uring() {
+        if (this->sqes != nullptr)
+            munmap(this->sqes, this->sqesLength);
+        if (this->cqRing != nullptr && this->cqRing != this->sqRing)
+            munmap(this->cqRing, this->cqLength);
+        if (this->sqRing != nullptr)
+            munmap(this->sqRing, this->sqLength);
+        if (this->fd >= 0)
+            close(this->fd);
+    }
+
+    /**
+      Create the ring and map its queues
+      @param entries: number of submission queue entries
+      @return false if io_uring is not available
+    */
+    bool init(unsigned entries) {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        this->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+        if (this->fd < 0)
+            return false;
+
+        this->sqLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        this->cqLength = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap)
+            this->sqLength = this->cqLength = std::max(this->sqLength, this->cqLength);
+
+        void* map = mmap(nullptr, this->sqLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING);
+        if (map == MAP_FAILED)
+            return false;
+        this->sqRing = (unsigned char*) map;
+
+        if (singleMap) {
+            this->cqRing = this->sqRing;
+        }
+        else {
+            map = mmap(nullptr, this->cqLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_CQ_RING);
+            if (map == MAP_FAILED)
+                return false;
+            this->cqRing = (unsigned char*) map;
+        }
+
+        this->sqesLength = params.sq_entries * sizeof(struct io_uring_sqe);
+        map = mmap(nullptr, this->sqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES);
+        if (map == MAP_FAILED)
+            return false;
+        this->sqes = (struct io_uring_sqe*) map;
+
+        this->sqHead = (unsigned*) (this->sqRing + params.sq_off.head);
+        this->sqTail = (unsigned*) (this->sqRing + params.sq_off.tail);
+        this->sqMask = *(unsigned*) (this->sqRing + params.sq_off.ring_mask);
+        this->sqEntries = params.sq_entries;
+        this->sqArray = (unsigned*) (this->sqRing + params.sq_off.array);
+        this->cqHead = (unsigned*) (this->cqRing + params.cq_off.head);
+        this->cqTail = (unsigned*) (this->cqRing + params.cq_off.tail);
+        this->cqMask = *(unsigned*) (this->cqRing + params.cq_off.ring_mask);
+        this->cqes = (struct io_uring_cqe*) (this->cqRing + params.cq_off.cqes);
+        return true;
+    }
+
+    /**
+      Queue a read or write at an explicit file offset
+      @param opcode: IORING_OP_READ or IORING_OP_WRITE
+      @param fd: file descriptor
+      @param buffer: data buffer
+      @param length: number of bytes
+      @param offset: file offset
+      @param userData: value returned with the completion
+      @return false if the submission queue is full
+    */
+    bool queue(unsigned char opcode, int fd, unsigned char* buffer, std::size_t length, unsigned long long offset,
+               unsigned long long userData) {
+        const unsigned tail = *this->sqTail;
+        const unsigned head = __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE);
+        if (tail - head >= this->sqEntries)
+            return false;
+
+        const unsigned index = tail & this->sqMask;
+        struct io_uring_sqe* sqe = &this->sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = (unsigned long long) buffer;
+        sqe->len = (unsigned) length;
+        sqe->off = offset;
+        sqe->user_data = userData;
+        this->sqArray[index] = index;
+
+        __atomic_store_n(this->sqTail, tail + 1, __ATOMIC_RELEASE);
+        this->unsubmitted++;
+        return true;
+    }
+
+    /**
+      Submit queued entries and optionally wait for a completion
+      @param wait: true to block until at least one completion is available
+      @return false on an error
+    */
+    bool submit(bool wait) {
+        while (true) {
+            long result = syscall(__NR_io_uring_enter, this->fd, this->unsubmitted, wait ? 1 : 0,
+                                  wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            this->unsubmitted -= (unsigned) result;
+            return true;
+        }
+    }
+
+    /**
+      Take the next completion if there is one
+      @param userData: set to the value given when queueing
+      @param result: set to the operation's result, bytes transferred or a negative errno
+      @return false if no completion is available
+    */
+    bool complete(unsigned long long& userData, int& result) {
+        const unsigned head = *this->cqHead;
+        const unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+            return false;
+
+        const struct io_uring_cqe& cqe = this->cqes[head & this->cqMask];
+        userData = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(this->cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    int fd = -1;
+    unsigned char* sqRing = nullptr;
+    unsigned char* cqRing = nullptr;
+    struct io_uring_sqe* sqes = nullptr;
+    std::size_t sqLength = 0;
+    std::size_t cqLength = 0;
+    std::size_t sqesLength = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    struct io_uring_cqe* cqes = nullptr;
+    unsigned unsubmitted = 0;
+};
+
+// Where a slot is in the pipeline
+enum SlotState { SLOT_FREE, SLOT_READING, SLOT_READY, SLOT_WRITING };
+
+/**
+  Pipeline using io_uring, for regular files
+  Reads and writes start at the current offsets of the descriptors, which are left at the end of the data
+  @param inFd: file descriptor to read from
+  @param outFd: file descriptor to write to
+  @param stream: cipher stream for the chosen mode and direction
+  @param slots: buffer pool
+  @param result: set to 0 on success, 3 on a cipher error, 5 on an I/O error
+  @return false if io_uring is unavailable and nothing was done
+*/
+static bool uringPipeline(int inFd, int outFd, AESStream& stream, std::vector<Slot>& slots, int& result) {
+    struct stat info;
+    if (fstat(inFd, &info) != 0 || !S_ISREG(info.st_mode))
+        return false;
+    const off_t inputStart = lseek(inFd, 0, SEEK_CUR);
+    if (inputStart < 0)
+        return false;
+    const unsigned long long inputSize = (unsigned long long) std::max(info.st_size - inputStart, (off_t) 0);
+    // Appending writes ignore their offsets and could land out of order, so they go through the threads
+    const int outFlags = fcntl(outFd, F_GETFL);
+    if (fstat(outFd, &info) != 0 || !S_ISREG(info.st_mode) || outFlags < 0 || (outFlags & O_APPEND) != 0)
+        return false;
+    const off_t outputStart = lseek(outFd, 0, SEEK_CUR);
+    if (outputStart < 0)
+        return false;
+
+    Uring ring;
+    if (!ring.init((unsigned) (2 * slots.size())))
+        return false;
+
+    // Older kernels without IORING_OP_READ fail this empty read, and the threads are used instead
+    unsigned long long userData;
+    int probe = -1;
+    if (!ring.queue(IORING_OP_READ, inFd, slots[0].input.data(), 0, 0, 0) || !ring.submit(true) ||
+        !ring.complete(userData, probe) || probe < 0)
+        return false;
+
+    const std::size_t chunkSize = slots[0].input.size();
+    const std::size_t numSlots = slots.size();
+    std::vector<SlotState> state(numSlots, SLOT_FREE);
+    std::vector<unsigned long long> sequence(numSlots, 0);
+    std::vector<std::size_t> done(numSlots, 0);
+    std::vector<unsigned long long> writeOffset(numSlots, 0);
+
+    const unsigned long long numChunks = (inputSize + chunkSize - 1) / chunkSize;
+    unsigned long long nextRead = 0;
+    unsigned long long nextCipher = 0;
+    unsigned long long outputOffset = (unsigned long long) outputStart;
+    std::size_t inFlight = 0;
+    bool cipherError = false;
+    bool ioError = false;
+
+    // Chunk i is read into slot i % numSlots, so the slot for the next chunk to process is known
+    while (!ioError) {
+        // Start reads into every free slot
+        while (nextRead < numChunks && state[nextRead % numSlots] == SLOT_FREE) {
+            const std::size_t index = nextRead % numSlots;
+            Slot& slot = slots[index];
+            slot.length = (std::size_t) std::min((unsigned long long) chunkSize, inputSize - (nextRead * chunkSize));
+            done[index] = 0;
+            sequence[index] = nextRead;
+            state[index] = SLOT_READING;
+            ring.queue(IORING_OP_READ, inFd, slot.input.data(), slot.length, inputStart + nextRead * chunkSize, index);
+            inFlight++;
+            nextRead++;
+        }
+
+        // Run the cipher on the next chunk as soon as it has arrived, queueing its write
+        const std::size_t cipherIndex = nextCipher % numSlots;
+        if (nextCipher < numChunks && state[cipherIndex] == SLOT_READY && sequence[cipherIndex] == nextCipher) {
+            Slot& slot = slots[cipherIndex];
+            slot.output.clear();
+            if (!cipherError && !stream.update(slot.input.data(), slot.length, slot.output))
+                cipherError = true;
+
+            nextCipher++;
+            if (slot.output.empty() || cipherError) {
+                state[cipherIndex] = SLOT_FREE;
+            }
+            else {
+                done[cipherIndex] = 0;
+                writeOffset[cipherIndex] = outputOffset;
+                outputOffset += slot.output.size();
+                state[cipherIndex] = SLOT_WRITING;
+                ring.queue(IORING_OP_WRITE, outFd, slot.output.data(), slot.output.size(), writeOffset[cipherIndex], cipherIndex);
+                inFlight++;
+            }
+            continue;
+        }
+
+        if (inFlight == 0)
+            break;
+
+        // Submit everything queued and wait for something to finish
+        bool submitted;
+        {
+            AESTrace::Span span("io wait", "in flight", (std::int64_t) inFlight);
+            submitted = ring.submit(true);
+        }
+        if (!submitted) {
+            ioError = true;
+            break;
+        }
+
+        int res;
+        while (ring.complete(userData, res)) {
+            const std::size_t index = (std::size_t) userData;
+            Slot& slot = slots[index];
+            inFlight--;
+
+            if (res <= 0) {
+                // Zero bytes before the expected end is as much an error as a failed operation
+                ioError = true;
+                continue;
+            }
+            done[index] += (std::size_t) res;
+
+            if (state[index] == SLOT_READING) {
+                if (done[index] < slot.length) {
+                    ring.queue(IORING_OP_READ, inFd, slot.input.data() + done[index], slot.length - done[index],
+                               inputStart + (sequence[index] * chunkSize) + done[index], index);
+                    inFlight++;
+                }
+                else {
+                    state[index] = SLOT_READY;
+                }
+            }
+            else {
+                if (done[index] < slot.output.size()) {
+                    ring.queue(IORING_OP_WRITE, outFd, slot.output.data() + done[index], slot.output.size() - done[index],
+                               writeOffset[index] + done[index], index);
+                    inFlight++;
+                }
+                else {
+                    state[index] = SLOT_FREE;
+                }
+            }
+        }
+    }
+
+    // Wait out anything still in flight so no buffer is released while the kernel uses it
+    while (inFlight > 0 && ring.submit(true)) {
+        int res;
+        while (ring.complete(userData, res)) {
+            inFlight--;
+        }
+    }
+
+    if (ioError) {
+        result = 5;
+        return true;
+    }
+
+    // The padded or unpadded end of the stream is small and written directly
+    std::vector<unsigned char> tail;
+    if (cipherError || !stream.finish(tail)) {
+        result = 3;
+        return true;
+    }
+    std::size_t written = 0;
+    while (written < tail.size()) {
+        ssize_t count = pwrite(outFd, tail.data() + written, tail.size() - written, (off_t) (outputOffset + written));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0) {
+            result = 5;
+            return true;
+        }
+        written += (std::size_t) count;
+    }
+
+    // Leave both descriptors where sequential reads and writes would have
+    if (lseek(inFd, (off_t) (inputStart + inputSize), SEEK_SET) < 0 ||
+        lseek(outFd, (off_t) (outputOffset + written), SEEK_SET) < 0) {
+        result = 5;
+        return true;
+    }
+    result = 0;
+    return true;
+}
+
+#endif
+
+/**
+  Stream the input through the cipher into the output with I/O overlapping the cipher
+  @param inFd: file descriptor to read from
+  @param outFd: file descriptor to write to
+  @param stream: cipher stream for the chosen mode and direction
+  @param chunkSize: size of each buffer
+  @param numBuffers: number of buffers in the pool, at least 2
+  @return 0 on success, 3 on a cipher error, 5 on an I/O error
+*/
+int pipelineData(int inFd, int outFd, AESStream& stream, std::size_t chunkSize, std::size_t numBuffers) {
+    std::vector<Slot> slots(std::max(numBuffers, (std::size_t) 2));
+    for (Slot& slot : slots) {
+        slot.input.resize(chunkSize);
+        slot.output.reserve(chunkSize + 2 * NUM_BYTES);
+    }
+
+#ifdef PIPELINE_URING
+    int result;
+    if (uringPipeline(inFd, outFd, stream, slots, result))
+        return result;
+#endif
+
+    return threadPipeline(inFd, outFd, stream, slots);
+}
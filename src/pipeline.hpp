@@ -0,0 +1,15 @@
+/**
+  @file pipeline.hpp: Overlapping file I/O with encryption
+*/
+#ifndef SRC_PIPELINE_HPP
+#define SRC_PIPELINE_HPP
+
+#include <cstddef>
+#include "AESstream.hpp"
+
+// Default number of chunk buffers in flight
+#define PIPELINE_BUFFERS 4
+
+int pipelineData(int inFd, int outFd, AESStream& stream, std::size_t chunkSize, std::size_t numBuffers);
+
+#endif
@@ -0,0 +1,229 @@
+/**
+  @file ring.cpp: Shared memory submission and completion ring for the encryption daemon
+  The producer creates a memfd holding the ring header, the submission queue, the completion queue and
+  a data area, and hands it to the daemon over its socket. Plaintext written into the data area is
+  encrypted in place by the daemon, so no data is copied between the processes.
+  Either side waits for the other by polling, or, with RING_FLAG_EVENTFD, by sleeping on an eventfd
+  that the other side only writes after seeing the sleeping flag set.
+*/
+
+#include <new>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include "ring.hpp"
+
+// Longest single sleep on an eventfd before the ring is checked again, in milliseconds
+#define RING_WAIT_INTERVAL 100
+
+
+/**
+  SharedRing constructor
+*/
+SharedRing::SharedRing()
+        : memFd(-1), submitFd(-1), completeFd(-1), region(nullptr), regionSize(0), header(nullptr), sq(nullptr), cq(nullptr),
+          inFlight(0) {
+}
+
+/**
+  SharedRing destructor
+*/
+SharedRing::~SharedRing() {
+    this->close();
+}
+
+/**
+  Create the shared region
+  @param entries: queue size, a power of two
+  @param dataSize: size of the data area
+  @param useEventfd: true to wake the other side through eventfds, false to poll
+  @return false on failure
+*/
+bool SharedRing::create(std::uint32_t entries, std::size_t dataSize, bool useEventfd) {
+    this->close();
+    if (entries == 0 || (entries & (entries - 1)) != 0)
+        return false;
+
+    const std::size_t page = (std::size_t) sysconf(_SC_PAGESIZE);
+    const std::size_t sqOffset = RING_HEADER_SIZE;
+    const std::size_t cqOffset = sqOffset + entries * sizeof(RingDescriptor);
+    const std::size_t dataOffset = ((cqOffset + entries * sizeof(RingCompletion) + page - 1) / page) * page;
+    this->regionSize = dataOffset + dataSize;
+
+    // Sealed against shrinking, so the daemon's mapping cannot be cut short
+    this->memFd = memfd_create("aes-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (this->memFd < 0 || ftruncate(this->memFd, (off_t) this->regionSize) != 0 ||
+        fcntl(this->memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        this->close();
+        return false;
+    }
+    void* map = mmap(nullptr, this->regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->memFd, 0);
+    if (map == MAP_FAILED) {
+        this->close();
+        return false;
+    }
+    this->region = (unsigned char*) map;
+
+    if (useEventfd) {
+        this->submitFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        this->completeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (this->submitFd < 0 || this->completeFd < 0) {
+            this->close();
+            return false;
+        }
+    }
+
+    this->header = new (this->region) RingHeader();
+    this->header->magic = RING_MAGIC;
+    this->header->version = RING_VERSION;
+    this->header->entries = entries;
+    this->header->flags = useEventfd ? RING_FLAG_EVENTFD : 0;
+    this->header->sqOffset = sqOffset;
+    this->header->cqOffset = cqOffset;
+    this->header->dataOffset = dataOffset;
+    this->header->dataSize = dataSize;
+    this->header->sqHead = 0;
+    this->header->sqTail = 0;
+    this->header->cqHead = 0;
+    this->header->cqTail = 0;
+    this->header->engineSleeping = 0;
+    this->header->producerSleeping = 0;
+    this->header->closed = 0;
+
+    this->sq = (RingDescriptor*) (this->region + sqOffset);
+    this->cq = (RingCompletion*) (this->region + cqOffset);
+    this->inFlight = 0;
+    return true;
+}
+
+/**
+  Hand the ring to the daemon, which serves it until close() or the connection ends
+  @param client: connection to the daemon, key IDs in descriptors are those registered on it
+  @return false on failure
+*/
+bool SharedRing::attach(DaemonClient& client) {
+    if (this->header == nullptr)
+        return false;
+
+    std::vector<int> fds(1, this->memFd);
+    if (this->submitFd >= 0) {
+        fds.push_back(this->submitFd);
+        fds.push_back(this->completeFd);
+    }
+    return client.attachRing(fds);
+}
+
+/**
+  Start of the data area, descriptor offsets are relative to it
+  @return pointer to the data area
+*/
+unsigned char* SharedRing::data() const {
+    return (this->header == nullptr) ? nullptr : this->region + this->header->dataOffset;
+}
+
+/**
+  Size of the data area
+  @return size in bytes
+*/
+std::size_t SharedRing::dataSize() const {
+    return (this->header == nullptr) ? 0 : (std::size_t) this->header->dataSize;
+}
+
+/**
+  Post a request
+  @param descriptor: request, its data must already be in place
+  @return false if every entry is in flight
+*/
+bool SharedRing::submit(const RingDescriptor& descriptor) {
+    if (this->header == nullptr || this->inFlight == this->header->entries)
+        return false;
+
+    const std::uint32_t tail = this->header->sqTail.load(std::memory_order_relaxed);
+    this->sq[tail & (this->header->entries - 1)] = descriptor;
+    this->header->sqTail.store(tail + 1, std::memory_order_seq_cst);
+    this->inFlight++;
+
+    if (this->submitFd >= 0 && this->header->engineSleeping.load(std::memory_order_seq_cst) != 0)
+        eventfd_write(this->submitFd, 1);
+    return true;
+}
+
+/**
+  Take a completion without waiting
+  @param completion: set to the completion
+  @return false if none is ready
+*/
+bool SharedRing::poll(RingCompletion& completion) {
+    if (this->header == nullptr)
+        return false;
+
+    const std::uint32_t head = this->header->cqHead.load(std::memory_order_relaxed);
+    if (head == this->header->cqTail.load(std::memory_order_acquire))
+        return false;
+
+    completion = this->cq[head & (this->header->entries - 1)];
+    this->header->cqHead.store(head + 1, std::memory_order_release);
+    this->inFlight--;
+    return true;
+}
+
+/**
+  Wait for a completion, by polling or by sleeping on the completion eventfd
+  @param completion: set to the completion
+  @return false if nothing is in flight
+*/
+bool SharedRing::wait(RingCompletion& completion) {
+    for (unsigned spins = 0; this->inFlight > 0; spins++) {
+        if (this->poll(completion))
+            return true;
+
+        if (this->completeFd < 0) {
+            if (spins >= RING_SPIN_LIMIT)
+                std::this_thread::yield();
+            continue;
+        }
+
+        // Announce the sleep, then check again so a completion posted in between is not missed
+        this->header->producerSleeping.store(1, std::memory_order_seq_cst);
+        if (this->header->cqTail.load(std::memory_order_seq_cst) == this->header->cqHead.load(std::memory_order_relaxed)) {
+            struct pollfd waiting = {this->completeFd, POLLIN, 0};
+            ::poll(&waiting, 1, RING_WAIT_INTERVAL);
+            eventfd_t value;
+            eventfd_read(this->completeFd, &value);
+        }
+        this->header->producerSleeping.store(0, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+/**
+  Tell the daemon to stop serving the ring and release it
+  @return none
+*/
+void SharedRing::close() {
+    if (this->header != nullptr) {
+        this->header->closed.store(1, std::memory_order_seq_cst);
+        if (this->submitFd >= 0)
+            eventfd_write(this->submitFd, 1);
+    }
+    if (this->region != nullptr)
+        munmap(this->region, this->regionSize);
+    if (this->memFd >= 0)
+        ::close(this->memFd);
+    if (this->submitFd >= 0)
+        ::close(this->submitFd);
+    if (this->completeFd >= 0)
+        ::close(this->completeFd);
+
+    this->memFd = this->submitFd = this->completeFd = -1;
+    this->region = nullptr;
+    this->header = nullptr;
+    this->sq = nullptr;
+    this->cq = nullptr;
+    this->inFlight = 0;
+}
@@ -0,0 +1,106 @@
+/**
+  @file ring.hpp: Shared memory submission and completion ring for the encryption daemon
+*/
+#ifndef SRC_RING_HPP
+#define SRC_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "daemonclient.hpp"
+
+#define RING_MAGIC 0x52494e47
+#define RING_VERSION 1
+// The header takes the first page of the region, the queues and data area follow
+#define RING_HEADER_SIZE 4096
+// Header flag for eventfd wakeups instead of polling
+#define RING_FLAG_EVENTFD 0x01
+// Polls of an empty queue before yielding the processor
+#define RING_SPIN_LIMIT 1024
+
+// A request, the data at offset in the data area is encrypted or decrypted in place
+struct RingDescriptor {
+    std::uint64_t offset;
+    std::uint32_t length;
+    // Bytes available at offset, at least length + 16 when encrypting to leave room for padding
+    std::uint32_t capacity;
+    std::uint32_t keyId;
+    std::uint8_t mode;
+    std::uint8_t encrypting;
+    std::uint8_t ivLength;
+    std::uint8_t reserved;
+    std::uint8_t iv[16];
+    std::uint64_t userData;
+};
+
+// The result of a request, length is the new length of the data at its offset
+struct RingCompletion {
+    std::uint64_t userData;
+    std::uint32_t length;
+    std::uint32_t micros;
+    std::uint8_t status;
+    std::uint8_t reserved[7];
+};
+
+// Start of the shared region, each index on its own cache line
+struct RingHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t entries;
+    std::uint32_t flags;
+    std::uint64_t sqOffset;
+    std::uint64_t cqOffset;
+    std::uint64_t dataOffset;
+    std::uint64_t dataSize;
+    alignas(64) std::atomic<std::uint32_t> sqHead;
+    alignas(64) std::atomic<std::uint32_t> sqTail;
+    alignas(64) std::atomic<std::uint32_t> cqHead;
+    alignas(64) std::atomic<std::uint32_t> cqTail;
+    alignas(64) std::atomic<std::uint32_t> engineSleeping;
+    alignas(64) std::atomic<std::uint32_t> producerSleeping;
+    alignas(64) std::atomic<std::uint32_t> closed;
+};
+
+static_assert(sizeof(RingHeader) <= RING_HEADER_SIZE, "RingHeader must fit in its page");
+
+
+//SharedRing class, the producer side of a ring, not shared between threads
+class SharedRing {
+public:
+    SharedRing();
+
+    SharedRing(const SharedRing&) = delete;
+
+    SharedRing& operator=(const SharedRing&) = delete;
+
+    ~SharedRing();
+
+    bool create(std::uint32_t entries, std::size_t dataSize, bool useEventfd);
+
+    bool attach(DaemonClient& client);
+
+    unsigned char* data() const;
+
+    std::size_t dataSize() const;
+
+    bool submit(const RingDescriptor& descriptor);
+
+    bool poll(RingCompletion& completion);
+
+    bool wait(RingCompletion& completion);
+
+    void close();
+
+private:
+    int memFd;
+    int submitFd;
+    int completeFd;
+    unsigned char* region;
+    std::size_t regionSize;
+    RingHeader* header;
+    RingDescriptor* sq;
+    RingCompletion* cq;
+    std::uint32_t inFlight;
+};
+
+#endif